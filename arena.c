@@ -0,0 +1,138 @@
+#include <string.h>
+#include "arena.h"
+
+static ArenaBlock* newBlock(size_t size, ArenaBlock* next);
+
+Arena arenaInit(size_t blockSize)
+{
+    // If no block size is provided, use default value
+    if(blockSize == 0)
+        blockSize = 4096;
+
+    return (Arena){NULL, blockSize, 0};
+}
+
+/************************************************
+ * arenaAlloc:  Bump allocate from the current
+ *              block, chaining a new block when
+ *              it is full. Memory is only given
+ *              back by arenaReset/arenaDestroy
+ *
+ * pArena:      Arena to allocate from
+ *
+ * size:        Number of bytes wanted
+ *
+ * return:      Zeroed memory aligned for any
+ *              type, or NULL on failure
+ ***********************************************/
+void* arenaAlloc(Arena* pArena, size_t size)
+{
+    if(!pArena)
+        return NULL;
+
+    size_t align = sizeof(max_align_t);
+    size = (size + align - 1) & ~(align - 1);
+    if(size == 0)
+        size = align;
+
+    ArenaBlock* block = pArena->head;
+    if(!block || block->size - block->used < size) {
+        size_t blockSize = pArena->blockSize;
+        while(blockSize < size)
+            blockSize *= 2;
+
+        block = newBlock(blockSize, pArena->head);
+        if(!block)
+            return NULL;
+
+        pArena->head = block;
+        pArena->total += blockSize;
+    }
+
+    void* ptr = (char*)block->data + block->used;
+    block->used += size;
+    return memset(ptr, 0, size);
+}
+
+/************************************************
+ * arenaStrndup:    Copy at most size bytes of a
+ *                  string into the arena
+ *
+ * pArena:          Arena to allocate from
+ *
+ * string:          String to copy
+ *
+ * size:            Maximum number of bytes to
+ *                  copy
+ *
+ * return:          NUL terminated copy, or NULL
+ *                  on failure
+ ***********************************************/
+char* arenaStrndup(Arena* pArena, const char* string, size_t size)
+{
+    if(!string)
+        return NULL;
+
+    size = strnlen(string, size);
+    char* copy = arenaAlloc(pArena, size + 1);
+    if(copy)
+        memcpy(copy, string, size);
+
+    return copy;
+}
+
+/************************************************
+ * arenaReset:  Release everything allocated
+ *              from the arena in one step. If it
+ *              grew past one block, the blocks
+ *              are replaced by a single one large
+ *              enough for all of them so the next
+ *              use of similar size never chains
+ *
+ * pArena:      Arena to reset
+ ***********************************************/
+void arenaReset(Arena* pArena)
+{
+    if(!pArena || !pArena->head)
+        return;
+
+    if(!pArena->head->next) {
+        pArena->head->used = 0;
+        return;
+    }
+
+    size_t total = pArena->total;
+    arenaDestroy(pArena);
+
+    pArena->head = newBlock(total, NULL);
+    if(pArena->head)
+        pArena->total = total;
+}
+
+void arenaDestroy(Arena* pArena)
+{
+    if(!pArena)
+        return;
+
+    ArenaBlock* block = pArena->head;
+    while(block) {
+        ArenaBlock* next = block->next;
+        free(block);
+        block = next;
+    }
+
+    pArena->head = NULL;
+    pArena->total = 0;
+}
+
+static ArenaBlock* newBlock(size_t size, ArenaBlock* next)
+{
+    ArenaBlock* block = malloc(sizeof(ArenaBlock) + size);
+    if(!block)
+        return NULL;
+
+    block->next = next;
+    block->size = size;
+    block->used = 0;
+    return block;
+}
@@ -0,0 +1,28 @@
+#ifndef ARENA_H
+#define ARENA_H
+#include <stddef.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct arena_block_t {
+    struct arena_block_t* next;
+    size_t size;
+    size_t used;
+    max_align_t data[];
+} ArenaBlock;
+
+typedef struct arena_t {
+    ArenaBlock* head;
+    size_t blockSize;
+    size_t total;
+} Arena;
+
+
+Arena arenaInit(size_t blockSize);
+void* arenaAlloc(Arena* pArena, size_t size);
+char* arenaStrndup(Arena* pArena, const char* string, size_t size);
+void arenaReset(Arena* pArena);
+void arenaDestroy(Arena* pArena);
+
+#endif
@@ -0,0 +1,289 @@
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "cmdindex.h"
+
+static bool setPath(CommandIndex* pIndex, const char* pathVar);
+static void freeDirs(CommandIndex* pIndex);
+static bool scanDir(CommandDir* pDir);
+static bool mergeNames(CommandIndex* pIndex);
+static void collectNames(const StringPool* pPool, const char** names, size_t* pCount);
+static int compareNames(const void* a, const void* b);
+
+CommandIndex commandIndexInit(void)
+{
+    CommandIndex index = {0};
+    index.extra = stringPoolInit(0);
+    index.names = stringPoolInit(0);
+    index.dirty = true;
+    return index;
+}
+
+bool commandIndexAddExtra(CommandIndex* pIndex, const char* name)
+{
+    if(!pIndex || !name)
+        return false;
+
+    pIndex->dirty = true;
+    return stringPoolInsert(&pIndex->extra, name, strlen(name));
+}
+
+/************************************************
+ * commandIndexPrefix:  Find the commands starting
+ *                      with a prefix. Each $PATH
+ *                      directory is stat'ed and
+ *                      only rescanned if its mtime
+ *                      changed, so a lookup costs a
+ *                      stat per directory and two
+ *                      binary searches
+ *
+ * pIndex:              Index to search
+ *
+ * pathVar:             Current value of $PATH
+ *
+ * prefix:              Start of the names to find
+ *
+ * length:              Length of prefix
+ *
+ * pFirst:              Set to the first match
+ *
+ * pLast:               Set to one past the last
+ *                      match
+ *
+ * return:              False if out of memory
+ ***********************************************/
+bool commandIndexPrefix(CommandIndex* pIndex, const char* pathVar, const char* prefix, size_t length, size_t* pFirst, size_t* pLast)
+{
+    if(!pIndex || !prefix)
+        return false;
+
+    if(!setPath(pIndex, pathVar ? pathVar : ""))
+        return false;
+
+    for(size_t i = 0; i < pIndex->numDirs; i++) {
+        CommandDir* dir = &pIndex->dirs[i];
+        struct stat st;
+        if(stat(dir->path, &st) == -1 || !S_ISDIR(st.st_mode)) {
+            if(dir->names.size > 0 || dir->ino != 0) {
+                stringPoolClear(&dir->names);
+                dir->dev = 0;
+                dir->ino = 0;
+                pIndex->dirty = true;
+            }
+            continue;
+        }
+
+        if(dir->dev == st.st_dev && dir->ino == st.st_ino
+            && dir->mtime.tv_sec == st.st_mtim.tv_sec && dir->mtime.tv_nsec == st.st_mtim.tv_nsec)
+            continue;
+
+        scanDir(dir);
+        dir->dev = st.st_dev;
+        dir->ino = st.st_ino;
+        dir->mtime = st.st_mtim;
+        pIndex->dirty = true;
+    }
+
+    if(pIndex->dirty && !mergeNames(pIndex))
+        return false;
+
+    size_t low = 0;
+    size_t high = pIndex->names.size;
+    while(low < high) {
+        size_t mid = low + (high - low) / 2;
+        if(strncmp(stringPoolGet(&pIndex->names, mid), prefix, length) < 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    *pFirst = low;
+
+    high = pIndex->names.size;
+    while(low < high) {
+        size_t mid = low + (high - low) / 2;
+        if(strncmp(stringPoolGet(&pIndex->names, mid), prefix, length) <= 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    *pLast = low;
+    return true;
+}
+
+const char* commandIndexGet(const CommandIndex* pIndex, size_t position, size_t* pLength)
+{
+    *pLength = stringPoolLength(&pIndex->names, position);
+    return stringPoolGet(&pIndex->names, position);
+}
+
+void commandIndexDestroy(CommandIndex* pIndex)
+{
+    if(!pIndex)
+        return;
+
+    freeDirs(pIndex);
+    free(pIndex->pathVar);
+    stringPoolDestroy(&pIndex->extra);
+    stringPoolDestroy(&pIndex->names);
+    pIndex->pathVar = NULL;
+}
+
+/************************************************
+ * setPath:     Split a new $PATH into
+ *              directories. Nothing happens if
+ *              it is unchanged
+ *
+ * pIndex:      Index to update
+ *
+ * pathVar:     Value of $PATH
+ *
+ * return:      False if out of memory
+ ***********************************************/
+static bool setPath(CommandIndex* pIndex, const char* pathVar)
+{
+    if(pIndex->pathVar && strcmp(pIndex->pathVar, pathVar) == 0)
+        return true;
+
+    freeDirs(pIndex);
+    free(pIndex->pathVar);
+    pIndex->pathVar = strdup(pathVar);
+    if(!pIndex->pathVar) {
+        perror("strdup");
+        return false;
+    }
+
+    size_t numDirs = 1;
+    for(const char* c = pathVar; *c; c++) {
+        if(*c == ':')
+            numDirs++;
+    }
+
+    pIndex->dirs = calloc(numDirs, sizeof(CommandDir));
+    if(!pIndex->dirs) {
+        perror("calloc");
+        return false;
+    }
+
+    const char* start = pathVar;
+    for(size_t i = 0; i < numDirs; i++) {
+        const char* end = strchr(start, ':');
+        size_t length = end ? (size_t)(end - start) : strlen(start);
+
+        // An empty entry means the current directory
+        CommandDir* dir = &pIndex->dirs[pIndex->numDirs];
+        dir->path = length ? strndup(start, length) : strdup(".");
+        dir->names = stringPoolInit(0);
+        if(!dir->path) {
+            stringPoolDestroy(&dir->names);
+            break;
+        }
+
+        pIndex->numDirs++;
+        start = end ? end + 1 : start + length;
+    }
+
+    pIndex->dirty = true;
+    return true;
+}
+
+static void freeDirs(CommandIndex* pIndex)
+{
+    for(size_t i = 0; i < pIndex->numDirs; i++) {
+        free(pIndex->dirs[i].path);
+        stringPoolDestroy(&pIndex->dirs[i].names);
+    }
+
+    free(pIndex->dirs);
+    pIndex->dirs = NULL;
+    pIndex->numDirs = 0;
+}
+
+/************************************************
+ * scanDir:     Read the executables of one $PATH
+ *              directory. Entries are stat'ed
+ *              relative to the open directory so
+ *              no paths are built
+ *
+ * pDir:        Directory to scan
+ *
+ * return:      False if it couldn't be read
+ ***********************************************/
+static bool scanDir(CommandDir* pDir)
+{
+    stringPoolClear(&pDir->names);
+
+    DIR* dirp = opendir(pDir->path);
+    if(!dirp)
+        return false;
+
+    int fd = dirfd(dirp);
+    struct dirent* dent;
+    while((dent = readdir(dirp))) {
+        if(dent->d_type == DT_DIR || strcmp(dent->d_name, ".") == 0 || strcmp(dent->d_name, "..") == 0)
+            continue;
+
+        struct stat st;
+        if(fstatat(fd, dent->d_name, &st, 0) == -1)
+            continue;
+        if(!S_ISREG(st.st_mode) || (st.st_mode & (S_IXUSR | S_IXGRP | S_IXOTH)) == 0)
+            continue;
+
+        stringPoolInsert(&pDir->names, dent->d_name, strlen(dent->d_name));
+    }
+
+    closedir(dirp);
+    return true;
+}
+
+/************************************************
+ * mergeNames:  Rebuild the sorted name list from
+ *              every directory and the extra
+ *              names, dropping duplicates
+ *
+ * pIndex:      Index to rebuild
+ *
+ * return:      False if out of memory
+ ***********************************************/
+static bool mergeNames(CommandIndex* pIndex)
+{
+    size_t total = pIndex->extra.size;
+    for(size_t i = 0; i < pIndex->numDirs; i++)
+        total += pIndex->dirs[i].names.size;
+
+    const char** names = malloc((total ? total : 1) * sizeof(char*));
+    if(!names) {
+        perror("malloc");
+        return false;
+    }
+
+    size_t count = 0;
+    collectNames(&pIndex->extra, names, &count);
+    for(size_t i = 0; i < pIndex->numDirs; i++)
+        collectNames(&pIndex->dirs[i].names, names, &count);
+
+    qsort(names, count, sizeof(char*), compareNames);
+
+    stringPoolClear(&pIndex->names);
+    for(size_t i = 0; i < count; i++) {
+        if(i > 0 && strcmp(names[i], names[i - 1]) == 0)
+            continue;
+        stringPoolInsert(&pIndex->names, names[i], strlen(names[i]));
+    }
+
+    free(names);
+    pIndex->dirty = false;
+    return true;
+}
+
+static void collectNames(const StringPool* pPool, const char** names, size_t* pCount)
+{
+    for(size_t i = 0; i < pPool->size; i++)
+        names[(*pCount)++] = stringPoolGet(pPool, i);
+}
+
+static int compareNames(const void* a, const void* b)
+{
+    return strcmp(*(const char* const*)a, *(const char* const*)b);
+}
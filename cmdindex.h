@@ -0,0 +1,37 @@
+#ifndef CMDINDEX_H
+#define CMDINDEX_H
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sys/types.h>
+#include "vector.h"
+
+// Executables found in one $PATH directory when it had this mtime
+typedef struct command_dir_t {
+    char* path;
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    StringPool names;
+} CommandDir;
+
+// Sorted, duplicate free names of every executable on $PATH plus extra
+// names such as builtins. Directories are rescanned only when they change
+typedef struct command_index_t {
+    CommandDir* dirs;
+    size_t numDirs;
+    char* pathVar;
+    StringPool extra;
+    StringPool names;
+    bool dirty;
+} CommandIndex;
+
+
+CommandIndex commandIndexInit(void);
+bool commandIndexAddExtra(CommandIndex* pIndex, const char* name);
+bool commandIndexPrefix(CommandIndex* pIndex, const char* pathVar, const char* prefix, size_t length, size_t* pFirst, size_t* pLast);
+const char* commandIndexGet(const CommandIndex* pIndex, size_t position, size_t* pLength);
+void commandIndexDestroy(CommandIndex* pIndex);
+
+#endif
@@ -0,0 +1,468 @@
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "dircache.h"
+#include "match.h"
+
+typedef struct sort_entry_t {
+    const char* name;
+    uint32_t index;
+} SortEntry;
+
+typedef struct rank_entry_t {
+    const char* name;
+    int32_t score;
+    uint32_t length;
+    uint32_t index;
+} RankEntry;
+
+static bool readListing(DirListing* pListing, const char* path);
+static void freeListing(DirListing* pListing);
+static DirListing* newSlot(DirCache* pCache);
+static int compareEntries(const void* a, const void* b);
+static int compareRanks(const void* a, const void* b);
+
+DirCache dirCacheInit(size_t capacity)
+{
+    // If no capacity is provided, use default value
+    if(capacity == 0)
+        capacity = 32;
+
+    DirCache cache = {0, capacity, NULL, 0};
+    cache.listings = calloc(capacity, sizeof(DirListing*));
+    if(!cache.listings)
+        cache.capacity = 0;
+
+    return cache;
+}
+
+/************************************************
+ * dirCacheGet: Get the entries of a directory,
+ *              reading it only if it isn't
+ *              cached or its mtime changed. The
+ *              listing is keyed by device and
+ *              inode so any path to a directory
+ *              shares one listing
+ *
+ * pCache:      Cache to search
+ *
+ * path:        Directory to list
+ *
+ * return:      Listing which stays valid until
+ *              dirCacheRelease, NULL on error
+ ***********************************************/
+DirListing* dirCacheGet(DirCache* pCache, const char* path)
+{
+    if(!pCache || !path || pCache->capacity == 0)
+        return NULL;
+
+    struct stat st;
+    if(stat(path[0] ? path : ".", &st) == -1 || !S_ISDIR(st.st_mode))
+        return NULL;
+
+    DirListing* listing = NULL;
+    for(size_t i = 0; i < pCache->size; i++) {
+        DirListing* candidate = pCache->listings[i];
+        if(candidate->dev == st.st_dev && candidate->ino == st.st_ino) {
+            listing = candidate;
+            break;
+        }
+    }
+
+    // A listing in use is never rewritten, callers see it as it was
+    bool stale = listing && (listing->mtime.tv_sec != st.st_mtim.tv_sec ||
+                             listing->mtime.tv_nsec != st.st_mtim.tv_nsec);
+    if(stale && listing->pins == 0) {
+        freeListing(listing);
+        if(!readListing(listing, path)) {
+            listing->dev = 0;
+            listing->ino = 0;
+            return NULL;
+        }
+        listing->mtime = st.st_mtim;
+    }
+
+    if(!listing) {
+        listing = newSlot(pCache);
+        if(!listing || !readListing(listing, path))
+            return NULL;
+
+        listing->dev = st.st_dev;
+        listing->ino = st.st_ino;
+        listing->mtime = st.st_mtim;
+    }
+
+    listing->lastUsed = ++pCache->clock;
+    listing->pins++;
+    return listing;
+}
+
+void dirCacheRelease(DirListing* pListing)
+{
+    if(pListing && pListing->pins > 0)
+        pListing->pins--;
+}
+
+/************************************************
+ * dirCacheFresh:   Check whether a directory's
+ *                  listing is cached and current,
+ *                  without reading it
+ *
+ * pCache:          Cache to search
+ *
+ * path:            Directory to check
+ *
+ * return:          Whether dirCacheGet would
+ *                  return without reading
+ ***********************************************/
+bool dirCacheFresh(DirCache* pCache, const char* path)
+{
+    struct stat st;
+    if(!pCache || !path || stat(path[0] ? path : ".", &st) == -1)
+        return false;
+
+    for(size_t i = 0; i < pCache->size; i++) {
+        DirListing* listing = pCache->listings[i];
+        if(listing->dev == st.st_dev && listing->ino == st.st_ino)
+            return listing->mtime.tv_sec == st.st_mtim.tv_sec && listing->mtime.tv_nsec == st.st_mtim.tv_nsec;
+    }
+
+    return false;
+}
+
+/************************************************
+ * dirCacheAdopt:   Add a listing read elsewhere,
+ *                  such as by a background scan.
+ *                  Its names, types and order move
+ *                  into the cache and pListing is
+ *                  left empty
+ *
+ * pCache:          Cache to add to
+ *
+ * pListing:        Listing with dev, ino and mtime
+ *                  set
+ *
+ * return:          Whether the cache took it. A
+ *                  listing is dropped if the cached
+ *                  copy of the directory is in use
+ ***********************************************/
+bool dirCacheAdopt(DirCache* pCache, DirListing* pListing)
+{
+    if(!pCache || !pListing || pCache->capacity == 0)
+        return false;
+
+    DirListing* listing = NULL;
+    for(size_t i = 0; i < pCache->size; i++) {
+        DirListing* candidate = pCache->listings[i];
+        if(candidate->dev == pListing->dev && candidate->ino == pListing->ino) {
+            listing = candidate;
+            break;
+        }
+    }
+
+    if(listing && listing->pins > 0) {
+        dirListingDestroy(pListing);
+        return false;
+    }
+
+    if(listing)
+        freeListing(listing);
+    else
+        listing = newSlot(pCache);
+
+    if(!listing) {
+        dirListingDestroy(pListing);
+        return false;
+    }
+
+    *listing = *pListing;
+    listing->pins = 0;
+    listing->lastUsed = ++pCache->clock;
+    *pListing = (DirListing){0};
+    return true;
+}
+
+void dirListingDestroy(DirListing* pListing)
+{
+    if(pListing)
+        freeListing(pListing);
+}
+
+void dirCacheDestroy(DirCache* pCache)
+{
+    if(pCache) {
+        for(size_t i = 0; i < pCache->size; i++) {
+            freeListing(pCache->listings[i]);
+            free(pCache->listings[i]);
+        }
+        free(pCache->listings);
+        pCache->listings = NULL;
+        pCache->size = 0;
+        pCache->capacity = 0;
+    }
+}
+
+/************************************************
+ * dirListingPrefix:    Find the names starting
+ *                      with a prefix. The listing
+ *                      is sorted the first time it
+ *                      is searched, after that a
+ *                      lookup is two binary searches
+ *
+ * pListing:            Pinned listing to search
+ *
+ * prefix:              Start of the names to find
+ *
+ * length:              Length of prefix
+ *
+ * pFirst:              Set to the first match, as
+ *                      a position in sorted
+ *
+ * pLast:               Set to one past the last
+ *                      match
+ *
+ * return:              False if out of memory
+ ***********************************************/
+bool dirListingPrefix(DirListing* pListing, const char* prefix, size_t length, size_t* pFirst, size_t* pLast)
+{
+    if(!pListing || !prefix)
+        return false;
+
+    if(!pListing->sorted && !dirListingSort(pListing))
+        return false;
+
+    size_t low = 0;
+    size_t high = pListing->names.size;
+    while(low < high) {
+        size_t mid = low + (high - low) / 2;
+        if(strncmp(stringPoolGet(&pListing->names, pListing->sorted[mid]), prefix, length) < 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    *pFirst = low;
+
+    high = pListing->names.size;
+    while(low < high) {
+        size_t mid = low + (high - low) / 2;
+        if(strncmp(stringPoolGet(&pListing->names, pListing->sorted[mid]), prefix, length) <= 0)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    *pLast = low;
+    return true;
+}
+
+/************************************************
+ * dirListingFuzzy: Rank the names containing a
+ *                  query's characters in order,
+ *                  ignoring case. Hidden names are
+ *                  only considered for a query
+ *                  starting with '.'
+ *
+ * pListing:        Pinned listing to search
+ *
+ * query:           Characters typed
+ *
+ * length:          Length of query
+ *
+ * pMatches:        Set to an allocated array of
+ *                  name indices, best first and
+ *                  then shortest and in name order
+ *
+ * pCount:          Set to the number of matches
+ *
+ * return:          False if out of memory
+ ***********************************************/
+bool dirListingFuzzy(DirListing* pListing, const char* query, size_t length, uint32_t** pMatches, size_t* pCount)
+{
+    if(!pListing || !query || !pMatches || !pCount)
+        return false;
+
+    size_t size = pListing->names.size;
+    RankEntry* ranks = malloc((size ? size : 1) * sizeof(RankEntry));
+    if(!ranks)
+        return false;
+
+    size_t count = 0;
+    bool hidden = length > 0 && query[0] == '.';
+    // Names are visited in the order they are stored, not sorted order,
+    // since a huge directory is mostly cache misses otherwise
+    for(size_t i = 0; i < size; i++) {
+        const char* name = stringPoolGet(&pListing->names, i);
+        size_t nameLen = stringPoolLength(&pListing->names, i);
+        if(name[0] == '.' && !hidden)
+            continue;
+
+        int32_t score = matchScore(name, nameLen, query, length);
+        if(score != MATCH_NONE)
+            ranks[count++] = (RankEntry){name, score, nameLen, i};
+    }
+
+    qsort(ranks, count, sizeof(RankEntry), compareRanks);
+
+    // The ranks are no longer needed once sorted, so the indices reuse them
+    uint32_t* matches = (uint32_t*)ranks;
+    for(size_t i = 0; i < count; i++)
+        matches[i] = ranks[i].index;
+
+    *pMatches = matches;
+    *pCount = count;
+    return true;
+}
+
+/************************************************
+ * dirListingIsDir: Check whether an entry is a
+ *                  directory. Symlinks and entries
+ *                  the filesystem didn't type are
+ *                  stat'ed once and the answer is
+ *                  kept in the listing
+ *
+ * pListing:        Pinned listing
+ *
+ * index:           Entry to check
+ *
+ * entryPath:       Path of the entry, only used
+ *                  when it has to be stat'ed
+ *
+ * return:          Whether the entry is, or links
+ *                  to, a directory
+ ***********************************************/
+bool dirListingIsDir(DirListing* pListing, size_t index, const char* entryPath)
+{
+    uint8_t type = pListing->types[index];
+    if(type == DT_DIR)
+        return true;
+    if(type != DT_LNK && type != DT_UNKNOWN)
+        return (type & DIR_TYPE_IS_DIR) != 0;
+
+    struct stat st;
+    bool isDir = stat(entryPath, &st) == 0 && S_ISDIR(st.st_mode);
+    pListing->types[index] = DIR_TYPE_RESOLVED | (isDir ? DIR_TYPE_IS_DIR : 0);
+    return isDir;
+}
+
+static bool readListing(DirListing* pListing, const char* path)
+{
+    DIR* dirp = opendir(path[0] ? path : ".");
+    if(!dirp)
+        return false;
+
+    pListing->names = stringPoolInit(64);
+    size_t typesCap = 64;
+    pListing->types = malloc(typesCap);
+    if(pListing->names.capacity == 0 || !pListing->types) {
+        closedir(dirp);
+        freeListing(pListing);
+        return false;
+    }
+
+    struct dirent* dent;
+    while((dent = readdir(dirp))) {
+        if(pListing->names.size >= typesCap) {
+            uint8_t* temp = realloc(pListing->types, typesCap * 2);
+            if(!temp)
+                break;
+            pListing->types = temp;
+            typesCap *= 2;
+        }
+
+        size_t index = pListing->names.size;
+        if(stringPoolInsert(&pListing->names, dent->d_name, strnlen(dent->d_name, sizeof(dent->d_name))))
+            pListing->types[index] = dent->d_type;
+    }
+
+    closedir(dirp);
+    return true;
+}
+
+static void freeListing(DirListing* pListing)
+{
+    stringPoolDestroy(&pListing->names);
+    free(pListing->types);
+    free(pListing->sorted);
+    pListing->types = NULL;
+    pListing->sorted = NULL;
+}
+
+static DirListing* newSlot(DirCache* pCache)
+{
+    if(pCache->size < pCache->capacity) {
+        DirListing* listing = calloc(1, sizeof(DirListing));
+        if(listing)
+            pCache->listings[pCache->size++] = listing;
+        return listing;
+    }
+
+    // Evict the least recently used listing nobody is reading
+    DirListing* oldest = NULL;
+    for(size_t i = 0; i < pCache->size; i++) {
+        DirListing* listing = pCache->listings[i];
+        if(listing->pins == 0 && (!oldest || listing->lastUsed < oldest->lastUsed))
+            oldest = listing;
+    }
+
+    if(oldest) {
+        freeListing(oldest);
+        *oldest = (DirListing){0};
+        return oldest;
+    }
+
+    DirListing** temp = realloc(pCache->listings, pCache->capacity * 2 * sizeof(DirListing*));
+    if(!temp)
+        return NULL;
+
+    pCache->listings = temp;
+    pCache->capacity *= 2;
+    return newSlot(pCache);
+}
+
+/************************************************
+ * dirListingSort:  Build the sorted order of a
+ *                  listing's names. The names stay
+ *                  where they are, sorted holds
+ *                  their indices
+ *
+ * pListing:        Listing to sort
+ *
+ * return:          False if out of memory
+ ***********************************************/
+bool dirListingSort(DirListing* pListing)
+{
+    size_t size = pListing->names.size;
+    SortEntry* entries = malloc((size ? size : 1) * sizeof(SortEntry));
+    pListing->sorted = malloc((size ? size : 1) * sizeof(uint32_t));
+    if(!entries || !pListing->sorted) {
+        free(entries);
+        free(pListing->sorted);
+        pListing->sorted = NULL;
+        return false;
+    }
+
+    for(size_t i = 0; i < size; i++)
+        entries[i] = (SortEntry){stringPoolGet(&pListing->names, i), i};
+
+    qsort(entries, size, sizeof(SortEntry), compareEntries);
+    for(size_t i = 0; i < size; i++)
+        pListing->sorted[i] = entries[i].index;
+
+    free(entries);
+    return true;
+}
+
+static int compareEntries(const void* a, const void* b)
+{
+    return strcmp(((const SortEntry*)a)->name, ((const SortEntry*)b)->name);
+}
+
+static int compareRanks(const void* a, const void* b)
+{
+    const RankEntry* x = a;
+    const RankEntry* y = b;
+    if(x->score != y->score)
+        return x->score > y->score ? -1 : 1;
+    if(x->length != y->length)
+        return x->length < y->length ? -1 : 1;
+    return strcmp(x->name, y->name);
+}
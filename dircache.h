@@ -0,0 +1,45 @@
+#ifndef DIRCACHE_H
+#define DIRCACHE_H
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sys/types.h>
+#include "vector.h"
+
+// Set in types once a symlink or unknown entry has been stat'ed
+#define DIR_TYPE_RESOLVED   0x40
+#define DIR_TYPE_IS_DIR     0x80
+
+typedef struct dirlisting_t {
+    dev_t dev;
+    ino_t ino;
+    struct timespec mtime;
+    StringPool names;
+    uint8_t* types;
+    uint32_t* sorted;
+    uint64_t lastUsed;
+    int pins;
+} DirListing;
+
+typedef struct dircache_t {
+    size_t size;
+    size_t capacity;
+    DirListing** listings;
+    uint64_t clock;
+} DirCache;
+
+
+DirCache dirCacheInit(size_t capacity);
+DirListing* dirCacheGet(DirCache* pCache, const char* path);
+void dirCacheRelease(DirListing* pListing);
+bool dirCacheFresh(DirCache* pCache, const char* path);
+bool dirCacheAdopt(DirCache* pCache, DirListing* pListing);
+bool dirListingSort(DirListing* pListing);
+void dirListingDestroy(DirListing* pListing);
+bool dirListingPrefix(DirListing* pListing, const char* prefix, size_t length, size_t* pFirst, size_t* pLast);
+bool dirListingFuzzy(DirListing* pListing, const char* query, size_t length, uint32_t** pMatches, size_t* pCount);
+bool dirListingIsDir(DirListing* pListing, size_t index, const char* entryPath);
+void dirCacheDestroy(DirCache* pCache);
+
+#endif
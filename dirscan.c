@@ -0,0 +1,275 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include "dirscan.h"
+
+// Big enough that a directory of a million entries is a few dozen calls
+#define SCAN_BATCH (1 << 20)
+
+struct linux_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+static void* scanWorker(void* arg);
+static bool readBatch(DirScan* pScan, int dirFd, const char* buffer, size_t size, size_t* pTypesCap);
+static void notify(DirScan* pScan);
+static void releaseScan(DirScan* pScan);
+
+/************************************************
+ * dirScanStart:    Start reading a directory on
+ *                  a worker thread. Signals stay
+ *                  blocked on the worker so job
+ *                  control keeps running in the
+ *                  shell's own thread
+ *
+ * path:            Directory to read, "" for the
+ *                  current one
+ *
+ * prefix:          Names starting with this are
+ *                  counted as matches, and their
+ *                  symlinks are resolved
+ *
+ * length:          Length of prefix
+ *
+ * return:          The scan, NULL on error
+ ***********************************************/
+DirScan* dirScanStart(const char* path, const char* prefix, size_t length)
+{
+    DirScan* scan = calloc(1, sizeof(DirScan));
+    if(!scan) {
+        perror("calloc");
+        return NULL;
+    }
+
+    int fds[2];
+    scan->path = strdup(path[0] ? path : ".");
+    scan->prefix = strndup(prefix, length);
+    scan->prefixLength = length;
+    if(!scan->path || !scan->prefix || pipe2(fds, O_CLOEXEC | O_NONBLOCK) == -1) {
+        perror("dirScanStart");
+        free(scan->path);
+        free(scan->prefix);
+        free(scan);
+        return NULL;
+    }
+    scan->fd = fds[0];
+    scan->notifyFd = fds[1];
+    atomic_init(&scan->refs, 2);
+
+    sigset_t all;
+    sigset_t old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+
+    pthread_t thread;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    int ret = pthread_create(&thread, &attr, scanWorker, scan);
+    pthread_attr_destroy(&attr);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if(ret != 0) {
+        errno = ret;
+        perror("pthread_create");
+        atomic_store(&scan->refs, 1);
+        releaseScan(scan);
+        return NULL;
+    }
+
+    return scan;
+}
+
+int dirScanFd(const DirScan* pScan)
+{
+    return pScan->fd;
+}
+
+/************************************************
+ * dirScanPoll: Consume the scan's wakeups
+ *
+ * pScan:       Scan to check
+ *
+ * return:      Whether the scan has finished
+ ***********************************************/
+bool dirScanPoll(DirScan* pScan)
+{
+    char buffer[64];
+    while(read(pScan->fd, buffer, sizeof(buffer)) > 0);
+
+    return atomic_load(&pScan->done);
+}
+
+/************************************************
+ * dirScanTake: Move the finished listing out of
+ *              a scan, sorted and ready for
+ *              dirCacheAdopt
+ *
+ * pScan:       Finished scan
+ *
+ * pListing:    Receives the listing
+ *
+ * return:      False if the directory could not
+ *              be read
+ ***********************************************/
+bool dirScanTake(DirScan* pScan, DirListing* pListing)
+{
+    if(!atomic_load(&pScan->done) || atomic_load(&pScan->failed))
+        return false;
+
+    *pListing = pScan->listing;
+    pScan->listing = (DirListing){0};
+    return true;
+}
+
+/************************************************
+ * dirScanCancel:   Let go of a scan, stopping it
+ *                  after its current batch if it
+ *                  is still running. The shell
+ *                  never waits for the worker
+ *
+ * pScan:           Scan to drop
+ ***********************************************/
+void dirScanCancel(DirScan* pScan)
+{
+    if(!pScan)
+        return;
+
+    atomic_store(&pScan->cancel, true);
+    releaseScan(pScan);
+}
+
+static void* scanWorker(void* arg)
+{
+    DirScan* scan = arg;
+    char* buffer = malloc(SCAN_BATCH);
+    int dirFd = open(scan->path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    struct stat st;
+    bool ok = buffer && dirFd != -1 && fstat(dirFd, &st) == 0;
+    if(ok) {
+        scan->listing.dev = st.st_dev;
+        scan->listing.ino = st.st_ino;
+        scan->listing.mtime = st.st_mtim;
+        scan->listing.names = stringPoolInit(1024);
+        scan->listing.types = malloc(1024);
+        ok = scan->listing.names.capacity != 0 && scan->listing.types;
+    }
+
+    size_t typesCap = 1024;
+    while(ok && !atomic_load(&scan->cancel)) {
+        long size = syscall(SYS_getdents64, dirFd, buffer, SCAN_BATCH);
+        if(size <= 0) {
+            ok = size == 0;
+            break;
+        }
+
+        ok = readBatch(scan, dirFd, buffer, size, &typesCap);
+        notify(scan);
+    }
+
+    // Sorting here keeps the first prefix lookup off the shell's thread
+    if(ok && !atomic_load(&scan->cancel))
+        ok = dirListingSort(&scan->listing);
+
+    if(dirFd != -1)
+        close(dirFd);
+    free(buffer);
+
+    atomic_store(&scan->failed, !ok);
+    atomic_store(&scan->done, true);
+    notify(scan);
+    releaseScan(scan);
+    return NULL;
+}
+
+/************************************************
+ * readBatch:   Add one getdents64 batch to the
+ *              listing. Only matching names whose
+ *              type is a symlink or unknown are
+ *              stat'ed, since only they need a
+ *              trailing '/' decided
+ *
+ * pScan:       Scan being run
+ *
+ * dirFd:       Open directory
+ *
+ * buffer:      Records from getdents64
+ *
+ * size:        Bytes in buffer
+ *
+ * pTypesCap:   Capacity of the listing's types
+ *
+ * return:      False if out of memory
+ ***********************************************/
+static bool readBatch(DirScan* pScan, int dirFd, const char* buffer, size_t size, size_t* pTypesCap)
+{
+    DirListing* listing = &pScan->listing;
+    size_t entries = 0;
+    size_t matches = 0;
+    for(size_t offset = 0; offset < size;) {
+        const struct linux_dirent64* dent = (const struct linux_dirent64*)(buffer + offset);
+        offset += dent->d_reclen;
+
+        if(listing->names.size >= *pTypesCap) {
+            uint8_t* temp = realloc(listing->types, *pTypesCap * 2);
+            if(!temp)
+                return false;
+            listing->types = temp;
+            *pTypesCap *= 2;
+        }
+
+        size_t index = listing->names.size;
+        size_t length = strlen(dent->d_name);
+        if(!stringPoolInsert(&listing->names, dent->d_name, length))
+            return false;
+
+        uint8_t type = dent->d_type;
+        if(length >= pScan->prefixLength && strncmp(dent->d_name, pScan->prefix, pScan->prefixLength) == 0) {
+            if(type == DT_LNK || type == DT_UNKNOWN) {
+                struct stat st;
+                bool isDir = fstatat(dirFd, dent->d_name, &st, 0) == 0 && S_ISDIR(st.st_mode);
+                type = DIR_TYPE_RESOLVED | (isDir ? DIR_TYPE_IS_DIR : 0);
+            }
+            matches++;
+        }
+
+        listing->types[index] = type;
+        entries++;
+    }
+
+    atomic_fetch_add(&pScan->entries, entries);
+    atomic_fetch_add(&pScan->matches, matches);
+    return true;
+}
+
+static void notify(DirScan* pScan)
+{
+    // A full pipe already means the shell has a wakeup waiting
+    ssize_t ret = write(pScan->notifyFd, "", 1);
+    (void)ret;
+}
+
+static void releaseScan(DirScan* pScan)
+{
+    if(atomic_fetch_sub(&pScan->refs, 1) != 1)
+        return;
+
+    dirListingDestroy(&pScan->listing);
+    close(pScan->fd);
+    close(pScan->notifyFd);
+    free(pScan->path);
+    free(pScan->prefix);
+    free(pScan);
+}
@@ -0,0 +1,35 @@
+#ifndef DIRSCAN_H
+#define DIRSCAN_H
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "dircache.h"
+
+// A directory read on a worker thread. The shell polls fd, which becomes
+// readable after every batch of entries, and may walk away at any time by
+// cancelling. Whichever side lets go last frees the scan
+typedef struct dir_scan_t {
+    char* path;
+    char* prefix;
+    size_t prefixLength;
+    int fd;
+    int notifyFd;
+    atomic_bool cancel;
+    atomic_bool done;
+    atomic_bool failed;
+    atomic_size_t entries;
+    atomic_size_t matches;
+    atomic_int refs;
+    DirListing listing;
+} DirScan;
+
+
+DirScan* dirScanStart(const char* path, const char* prefix, size_t length);
+int dirScanFd(const DirScan* pScan);
+bool dirScanPoll(DirScan* pScan);
+bool dirScanTake(DirScan* pScan, DirListing* pListing);
+void dirScanCancel(DirScan* pScan);
+
+#endif
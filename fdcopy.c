@@ -0,0 +1,128 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "fdcopy.h"
+
+#define COPY_CHUNK (1 << 20)
+#define COPY_BUFFER (1 << 17)
+
+static ssize_t copyFileRange(int inFd, int outFd, bool* fallback);
+static ssize_t spliceLoop(int inFd, int outFd, bool* fallback);
+static ssize_t readWriteLoop(int inFd, int outFd);
+
+/************************************************
+ * fdCopy:  Copy everything from inFd to outFd.
+ *          File to file copies use
+ *          copy_file_range and copies with a
+ *          pipe on either end use splice so the
+ *          data never passes through user space.
+ *          Anything else, or a kernel which
+ *          refuses, falls back to a large buffer
+ *          read/write loop
+ *
+ * inFd:    Descriptor to read from
+ *
+ * outFd:   Descriptor to write to
+ *
+ * return:  Bytes copied, -1 on error with errno
+ *          set
+ ***********************************************/
+ssize_t fdCopy(int inFd, int outFd)
+{
+    struct stat in, out;
+    if(fstat(inFd, &in) == -1 || fstat(outFd, &out) == -1)
+        return -1;
+
+    ssize_t total = 0;
+    bool fallback = true;
+
+    if(S_ISREG(in.st_mode) && S_ISREG(out.st_mode))
+        total = copyFileRange(inFd, outFd, &fallback);
+    else if(S_ISFIFO(in.st_mode) || S_ISFIFO(out.st_mode))
+        total = spliceLoop(inFd, outFd, &fallback);
+
+    if(total == -1 || !fallback)
+        return total;
+
+    // Only reached before any bytes moved, or for unsupported fd types
+    ssize_t rest = readWriteLoop(inFd, outFd);
+    return rest == -1 ? -1 : total + rest;
+}
+
+static ssize_t copyFileRange(int inFd, int outFd, bool* fallback)
+{
+    ssize_t total = 0;
+    while(true) {
+        ssize_t n = copy_file_range(inFd, NULL, outFd, NULL, COPY_CHUNK, 0);
+        if(n == -1 && errno == EINTR)
+            continue;
+
+        if(n == -1) {
+            // Cross filesystem on old kernels, O_APPEND output or unsupported file types
+            if(total == 0 && (errno == EXDEV || errno == EINVAL || errno == EBADF || errno == ENOSYS || errno == EOPNOTSUPP))
+                return 0;
+            return -1;
+        }
+
+        if(n == 0)
+            break;
+        total += n;
+    }
+
+    *fallback = false;
+    return total;
+}
+
+static ssize_t spliceLoop(int inFd, int outFd, bool* fallback)
+{
+    ssize_t total = 0;
+    while(true) {
+        ssize_t n = splice(inFd, NULL, outFd, NULL, COPY_CHUNK, SPLICE_F_MOVE | SPLICE_F_MORE);
+        if(n == -1 && errno == EINTR)
+            continue;
+
+        if(n == -1) {
+            // The other end is a tty or something else splice can't use
+            if(total == 0 && (errno == EINVAL || errno == ENOSYS))
+                return 0;
+            return -1;
+        }
+
+        if(n == 0)
+            break;
+        total += n;
+    }
+
+    *fallback = false;
+    return total;
+}
+
+static ssize_t readWriteLoop(int inFd, int outFd)
+{
+    static char buffer[COPY_BUFFER];
+
+    ssize_t total = 0;
+    while(true) {
+        ssize_t n = read(inFd, buffer, COPY_BUFFER);
+        if(n == -1 && errno == EINTR)
+            continue;
+        if(n == -1)
+            return -1;
+        if(n == 0)
+            break;
+
+        for(ssize_t off = 0; off < n;) {
+            ssize_t w = write(outFd, buffer + off, n - off);
+            if(w == -1 && errno == EINTR)
+                continue;
+            if(w == -1)
+                return -1;
+            off += w;
+        }
+        total += n;
+    }
+
+    return total;
+}
@@ -0,0 +1,9 @@
+#ifndef FDCOPY_H
+#define FDCOPY_H
+#include <stdlib.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+ssize_t fdCopy(int inFd, int outFd);
+
+#endif
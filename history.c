@@ -0,0 +1,863 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include "history.h"
+
+#define HISTORY_MAGIC       "SHHIST01"
+#define HISTORY_INDEX_MAGIC "SHHIDX01"
+#define HISTORY_HEADER_SIZE 8
+#define HISTORY_BATCH       512
+
+// Records are a 32 bit length and the line, padded to keep lengths aligned
+#define RECORD_SIZE(length) ((sizeof(uint32_t) + (length) + 3) & ~(size_t)3)
+
+static bool openFiles(History* pHistory);
+static void closeFiles(History* pHistory);
+static bool checkHeader(int fd, const char* magic, bool reset);
+static bool mapFiles(History* pHistory);
+static void unmapFiles(History* pHistory);
+static bool repairIndex(History* pHistory);
+static bool compactLocked(History* pHistory, size_t keep);
+static bool writeAll(int fd, const void* buffer, size_t size);
+static const char* entryText(const History* pHistory, size_t index, size_t* pLength);
+static uint64_t fingerprint(const char* line, size_t length);
+static size_t findDup(const History* pHistory, uint64_t key);
+static bool putDup(History* pHistory, uint64_t key, size_t id);
+static void forgetDup(History* pHistory, size_t index);
+static bool rebuildDups(History* pHistory);
+
+/************************************************
+ * historyOpen: Map the history files, creating
+ *              them if needed. A stale or torn
+ *              index is repaired, and history
+ *              over twice the limit is compacted
+ *              down to the limit
+ *
+ * path:        Data file, the index is kept
+ *              next to it with an .idx suffix.
+ *              NULL keeps history in memory only
+ *
+ * limit:       Number of lines to keep, 0 for
+ *              no limit
+ *
+ * return:      The history. If the files can't
+ *              be used only this session's lines
+ *              are kept
+ ***********************************************/
+History historyOpen(const char* path, size_t limit)
+{
+    History history = {0};
+    history.fd = -1;
+    history.indexFd = -1;
+    history.limit = HISTORY_NONE;
+    if(!path)
+        return history;
+
+    size_t pathLen = strlen(path);
+    history.path = strdup(path);
+    history.indexPath = malloc(pathLen + sizeof(".idx"));
+    if(!history.path || !history.indexPath) {
+        perror("malloc");
+        free(history.path);
+        free(history.indexPath);
+        history.path = history.indexPath = NULL;
+        return history;
+    }
+    memcpy(history.indexPath, path, pathLen);
+    memcpy(history.indexPath + pathLen, ".idx", sizeof(".idx"));
+
+    if(!openFiles(&history))
+        return history;
+
+    // Held while checking so a concurrent append can't look like a torn index
+    if(flock(history.fd, LOCK_EX) == -1) {
+        perror("flock");
+        closeFiles(&history);
+        return history;
+    }
+
+    bool ok = checkHeader(history.fd, HISTORY_MAGIC, false);
+    if(!ok)
+        fprintf(stderr, "%s: not a history file\n", path);
+
+    ok = ok && checkHeader(history.indexFd, HISTORY_INDEX_MAGIC, true);
+    ok = ok && mapFiles(&history) && repairIndex(&history);
+    if(ok && limit > 0 && history.count > limit * 2)
+        compactLocked(&history, limit);
+
+    flock(history.fd, LOCK_UN);
+    if(!ok) {
+        unmapFiles(&history);
+        closeFiles(&history);
+    }
+
+    return history;
+}
+
+/************************************************
+ * historyConfigure:    Set how many lines stay
+ *                      visible and whether older
+ *                      duplicates are hidden.
+ *                      Session lines past the limit
+ *                      are dropped
+ *
+ * pHistory:            History to configure
+ *
+ * limit:               Number of visible lines,
+ *                      0 for no limit
+ *
+ * eraseDups:           Whether only the newest
+ *                      copy of a line is visible
+ *
+ * return:              False if out of memory
+ ***********************************************/
+bool historyConfigure(History* pHistory, size_t limit, bool eraseDups)
+{
+    if(!pHistory)
+        return false;
+
+    pHistory->limit = limit ? limit : HISTORY_NONE;
+    while(pHistory->ringSize > pHistory->limit) {
+        free(pHistory->ring[pHistory->ringHead]);
+        pHistory->ringHead = (pHistory->ringHead + 1) % pHistory->ringCapacity;
+        pHistory->ringSize--;
+    }
+
+    // Unwrap the ring so it can grow again if the limit went up
+    if(pHistory->ringHead != 0) {
+        char** ring = malloc(pHistory->ringCapacity * sizeof(char*));
+        uint32_t* lengths = malloc(pHistory->ringCapacity * sizeof(uint32_t));
+        if(!ring || !lengths) {
+            perror("malloc");
+            free(ring);
+            free(lengths);
+            return false;
+        }
+
+        for(size_t i = 0; i < pHistory->ringSize; i++) {
+            size_t slot = (pHistory->ringHead + i) % pHistory->ringCapacity;
+            ring[i] = pHistory->ring[slot];
+            lengths[i] = pHistory->ringLengths[slot];
+        }
+
+        free(pHistory->ring);
+        free(pHistory->ringLengths);
+        pHistory->ring = ring;
+        pHistory->ringLengths = lengths;
+        pHistory->ringHead = 0;
+    }
+
+    pHistory->eraseDups = eraseDups;
+    return rebuildDups(pHistory);
+}
+
+size_t historyFirst(const History* pHistory)
+{
+    size_t end = historyCount(pHistory);
+    return end > pHistory->limit ? end - pHistory->limit : 0;
+}
+
+size_t historyCount(const History* pHistory)
+{
+    return pHistory->count + pHistory->appended;
+}
+
+/************************************************
+ * historyPrevious: Step to an older visible line
+ *
+ * pHistory:        History to walk
+ *
+ * index:           Starting position, which may
+ *                  be historyCount
+ *
+ * return:          Index of the newest visible
+ *                  line before index, or
+ *                  HISTORY_NONE
+ ***********************************************/
+size_t historyPrevious(const History* pHistory, size_t index)
+{
+    size_t first = historyFirst(pHistory);
+    size_t length;
+    while(index > first) {
+        if(historyGet(pHistory, --index, &length))
+            return index;
+    }
+
+    return HISTORY_NONE;
+}
+
+/************************************************
+ * historyNext: Step to a newer visible line
+ *
+ * pHistory:    History to walk
+ *
+ * index:       Starting position
+ *
+ * return:      Index of the oldest visible line
+ *              after index, or historyCount if
+ *              there is none
+ ***********************************************/
+size_t historyNext(const History* pHistory, size_t index)
+{
+    size_t end = historyCount(pHistory);
+    size_t length;
+    while(index + 1 < end) {
+        if(historyGet(pHistory, ++index, &length))
+            return index;
+    }
+
+    return end;
+}
+
+/************************************************
+ * historyGet:  Look up a line by index, oldest
+ *              first. Lines from the file are not
+ *              NUL terminated
+ *
+ * pHistory:    History to read
+ *
+ * index:       Position of the line
+ *
+ * pLength:     Set to the length of the line
+ *
+ * return:      The line, or NULL if index is out
+ *              of range or an older duplicate
+ ***********************************************/
+const char* historyGet(const History* pHistory, size_t index, size_t* pLength)
+{
+    if(index < historyFirst(pHistory) || index >= historyCount(pHistory))
+        return NULL;
+
+    const char* text = entryText(pHistory, index, pLength);
+    if(pHistory->eraseDups && findDup(pHistory, fingerprint(text, *pLength)) != index)
+        return NULL;
+
+    return text;
+}
+
+/************************************************
+ * historyAppend:   Add a line to this session and
+ *                  to the end of the file. Each
+ *                  record and its index entry are
+ *                  written under an exclusive lock
+ *                  with O_APPEND, so concurrent
+ *                  shells never interleave
+ *
+ * pHistory:        History to add to
+ *
+ * line:            Line to add
+ *
+ * length:          Length of line
+ *
+ * return:          False if the line could not
+ *                  be stored
+ ***********************************************/
+bool historyAppend(History* pHistory, const char* line, size_t length)
+{
+    if(!pHistory || !line || length > UINT32_MAX)
+        return false;
+
+    char* copy = malloc(length + 1);
+    if(!copy) {
+        perror("malloc");
+        return false;
+    }
+    memcpy(copy, line, length);
+    copy[length] = '\0';
+
+    // The ring only wraps once it holds limit lines, until then it doubles
+    if(pHistory->ringSize == pHistory->ringCapacity && pHistory->ringSize < pHistory->limit) {
+        size_t capacity = pHistory->ringCapacity ? pHistory->ringCapacity * 2 : 64;
+        if(capacity > pHistory->limit)
+            capacity = pHistory->limit;
+
+        char** ring = realloc(pHistory->ring, capacity * sizeof(char*));
+        if(ring)
+            pHistory->ring = ring;
+        uint32_t* lengths = realloc(pHistory->ringLengths, capacity * sizeof(uint32_t));
+        if(lengths)
+            pHistory->ringLengths = lengths;
+        if(!ring || !lengths) {
+            perror("realloc");
+            free(copy);
+            return false;
+        }
+        pHistory->ringCapacity = capacity;
+    }
+
+    // The line leaving the window stops owning its fingerprint
+    size_t first = historyFirst(pHistory);
+    if(historyCount(pHistory) + 1 > pHistory->limit)
+        forgetDup(pHistory, first);
+
+    if(pHistory->ringSize == pHistory->limit) {
+        free(pHistory->ring[pHistory->ringHead]);
+        pHistory->ringHead = (pHistory->ringHead + 1) % pHistory->ringCapacity;
+        pHistory->ringSize--;
+    }
+
+    size_t slot = (pHistory->ringHead + pHistory->ringSize) % pHistory->ringCapacity;
+    pHistory->ringSize++;
+    pHistory->ring[slot] = copy;
+    pHistory->ringLengths[slot] = length;
+    pHistory->appended++;
+
+    if(pHistory->eraseDups)
+        putDup(pHistory, fingerprint(line, length), historyCount(pHistory) - 1);
+
+    if(pHistory->fd == -1)
+        return true;
+
+    size_t recordSize = RECORD_SIZE(length);
+    char* record = calloc(recordSize, 1);
+    if(!record) {
+        perror("calloc");
+        return false;
+    }
+    uint32_t length32 = length;
+    memcpy(record, &length32, sizeof(uint32_t));
+    memcpy(record + sizeof(uint32_t), line, length);
+
+    if(flock(pHistory->fd, LOCK_EX) == -1) {
+        perror("flock");
+        free(record);
+        return false;
+    }
+
+    // Another shell compacted the files, so follow them to the new ones
+    struct stat st;
+    if(stat(pHistory->path, &st) == -1 || st.st_ino != pHistory->ino) {
+        flock(pHistory->fd, LOCK_UN);
+        closeFiles(pHistory);
+        if(!openFiles(pHistory) || flock(pHistory->fd, LOCK_EX) == -1) {
+            closeFiles(pHistory);
+            free(record);
+            return false;
+        }
+        checkHeader(pHistory->fd, HISTORY_MAGIC, false);
+        checkHeader(pHistory->indexFd, HISTORY_INDEX_MAGIC, true);
+    }
+
+    bool ok = fstat(pHistory->fd, &st) == 0;
+    uint64_t offset = st.st_size;
+    ok = ok && writeAll(pHistory->fd, record, recordSize);
+    ok = ok && writeAll(pHistory->indexFd, &offset, sizeof(offset));
+    if(!ok)
+        perror(pHistory->path);
+
+    flock(pHistory->fd, LOCK_UN);
+    free(record);
+    return ok;
+}
+
+void historyClose(History* pHistory)
+{
+    if(!pHistory)
+        return;
+
+    unmapFiles(pHistory);
+    closeFiles(pHistory);
+    for(size_t i = 0; i < pHistory->ringSize; i++)
+        free(pHistory->ring[(pHistory->ringHead + i) % pHistory->ringCapacity]);
+    free(pHistory->ring);
+    free(pHistory->ringLengths);
+    free(pHistory->dupKeys);
+    free(pHistory->dupIds);
+    pHistory->ring = NULL;
+    pHistory->ringLengths = NULL;
+    pHistory->dupKeys = NULL;
+    pHistory->dupIds = NULL;
+    pHistory->ringSize = pHistory->ringCapacity = pHistory->dupSize = pHistory->dupCapacity = 0;
+    free(pHistory->path);
+    free(pHistory->indexPath);
+    pHistory->path = pHistory->indexPath = NULL;
+}
+
+static bool openFiles(History* pHistory)
+{
+    int flags = O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC;
+    pHistory->fd = open(pHistory->path, flags, 0600);
+    if(pHistory->fd == -1) {
+        perror(pHistory->path);
+        return false;
+    }
+
+    pHistory->indexFd = open(pHistory->indexPath, flags, 0600);
+    if(pHistory->indexFd == -1) {
+        perror(pHistory->indexPath);
+        closeFiles(pHistory);
+        return false;
+    }
+
+    struct stat st;
+    if(fstat(pHistory->fd, &st) == -1) {
+        perror("fstat");
+        closeFiles(pHistory);
+        return false;
+    }
+    pHistory->ino = st.st_ino;
+    return true;
+}
+
+static void closeFiles(History* pHistory)
+{
+    if(pHistory->fd != -1)
+        close(pHistory->fd);
+    if(pHistory->indexFd != -1)
+        close(pHistory->indexFd);
+
+    pHistory->fd = -1;
+    pHistory->indexFd = -1;
+}
+
+/************************************************
+ * checkHeader: Write the header of an empty
+ *              file, or verify an existing one.
+ *              The lock must be held
+ *
+ * fd:          File to check
+ *
+ * magic:       Expected header
+ *
+ * reset:       Whether a bad file is emptied
+ *              and given a new header. Only safe
+ *              for files that can be rebuilt
+ *
+ * return:      Whether the header is valid
+ ***********************************************/
+static bool checkHeader(int fd, const char* magic, bool reset)
+{
+    struct stat st;
+    if(fstat(fd, &st) == -1) {
+        perror("fstat");
+        return false;
+    }
+
+    char header[HISTORY_HEADER_SIZE];
+    if(st.st_size >= HISTORY_HEADER_SIZE) {
+        if(pread(fd, header, HISTORY_HEADER_SIZE, 0) == HISTORY_HEADER_SIZE
+            && memcmp(header, magic, HISTORY_HEADER_SIZE) == 0)
+            return true;
+    }
+
+    if(st.st_size != 0 && !reset)
+        return false;
+
+    if(ftruncate(fd, 0) == -1 || !writeAll(fd, magic, HISTORY_HEADER_SIZE)) {
+        perror("history");
+        return false;
+    }
+    return true;
+}
+
+static bool mapFiles(History* pHistory)
+{
+    struct stat st;
+    struct stat indexSt;
+    if(fstat(pHistory->fd, &st) == -1 || fstat(pHistory->indexFd, &indexSt) == -1) {
+        perror("fstat");
+        return false;
+    }
+
+    pHistory->dataSize = st.st_size;
+    pHistory->indexSize = indexSt.st_size;
+    pHistory->count = 0;
+
+    if(pHistory->dataSize > HISTORY_HEADER_SIZE) {
+        void* data = mmap(NULL, pHistory->dataSize, PROT_READ, MAP_SHARED, pHistory->fd, 0);
+        if(data == MAP_FAILED) {
+            perror("mmap");
+            pHistory->dataSize = 0;
+            return false;
+        }
+        pHistory->data = data;
+    }
+
+    if(pHistory->indexSize > HISTORY_HEADER_SIZE) {
+        void* index = mmap(NULL, pHistory->indexSize, PROT_READ, MAP_SHARED, pHistory->indexFd, 0);
+        if(index == MAP_FAILED) {
+            perror("mmap");
+            pHistory->indexSize = 0;
+            return false;
+        }
+        pHistory->offsets = (const uint64_t*)((const char*)index + HISTORY_HEADER_SIZE);
+        pHistory->count = (pHistory->indexSize - HISTORY_HEADER_SIZE) / sizeof(uint64_t);
+    }
+
+    return true;
+}
+
+static void unmapFiles(History* pHistory)
+{
+    if(pHistory->data)
+        munmap((void*)pHistory->data, pHistory->dataSize);
+    if(pHistory->offsets)
+        munmap((char*)pHistory->offsets - HISTORY_HEADER_SIZE, pHistory->indexSize);
+
+    pHistory->data = NULL;
+    pHistory->offsets = NULL;
+    pHistory->dataSize = 0;
+    pHistory->indexSize = 0;
+    pHistory->count = 0;
+}
+
+/************************************************
+ * repairIndex: Make the index describe every
+ *              record in the data file. Only the
+ *              last entry is checked, so a clean
+ *              start touches a single page. A
+ *              torn record at the end of the data
+ *              is cut off. The lock must be held
+ *
+ * pHistory:    Mapped history
+ *
+ * return:      False on error
+ ***********************************************/
+static bool repairIndex(History* pHistory)
+{
+    size_t end = HISTORY_HEADER_SIZE;
+    size_t keep = 0;
+    if(pHistory->count > 0) {
+        uint64_t offset = pHistory->offsets[pHistory->count - 1];
+        uint32_t length = 0;
+        if(offset >= HISTORY_HEADER_SIZE && offset + sizeof(uint32_t) <= pHistory->dataSize)
+            memcpy(&length, pHistory->data + offset, sizeof(uint32_t));
+
+        if(offset >= HISTORY_HEADER_SIZE && offset + RECORD_SIZE(length) <= pHistory->dataSize) {
+            end = offset + RECORD_SIZE(length);
+            keep = pHistory->count;
+        }
+    }
+
+    size_t indexEnd = HISTORY_HEADER_SIZE + keep * sizeof(uint64_t);
+    if(end == pHistory->dataSize && indexEnd == pHistory->indexSize)
+        return true;
+
+    // Walk the records the index is missing, a full rebuild if it was bad
+    if(indexEnd != pHistory->indexSize && ftruncate(pHistory->indexFd, indexEnd) == -1) {
+        perror(pHistory->indexPath);
+        return false;
+    }
+
+    uint64_t batch[HISTORY_BATCH];
+    size_t batchSize = 0;
+    while(end + sizeof(uint32_t) <= pHistory->dataSize) {
+        uint32_t length;
+        memcpy(&length, pHistory->data + end, sizeof(uint32_t));
+        if(end + RECORD_SIZE(length) > pHistory->dataSize)
+            break;
+
+        batch[batchSize++] = end;
+        end += RECORD_SIZE(length);
+        if(batchSize == HISTORY_BATCH) {
+            if(!writeAll(pHistory->indexFd, batch, sizeof(batch))) {
+                perror(pHistory->indexPath);
+                return false;
+            }
+            batchSize = 0;
+        }
+    }
+
+    if(!writeAll(pHistory->indexFd, batch, batchSize * sizeof(uint64_t))) {
+        perror(pHistory->indexPath);
+        return false;
+    }
+
+    if(end < pHistory->dataSize && ftruncate(pHistory->fd, end) == -1) {
+        perror(pHistory->path);
+        return false;
+    }
+
+    unmapFiles(pHistory);
+    return mapFiles(pHistory);
+}
+
+/************************************************
+ * compactLocked:   Copy the newest records into
+ *                  new files and rename them over
+ *                  the old ones. Records are
+ *                  contiguous, so the kept tail
+ *                  is one write. The lock must be
+ *                  held on a freshly mapped and
+ *                  repaired history
+ *
+ * pHistory:        History to compact
+ *
+ * keep:            Number of lines to keep
+ *
+ * return:          False on error
+ ***********************************************/
+static bool compactLocked(History* pHistory, size_t keep)
+{
+    if(pHistory->count <= keep)
+        return true;
+
+    size_t pathLen = strlen(pHistory->path);
+    char dataTemp[pathLen + sizeof(".tmp")];
+    char indexTemp[pathLen + sizeof(".idx.tmp")];
+    snprintf(dataTemp, sizeof(dataTemp), "%s.tmp", pHistory->path);
+    snprintf(indexTemp, sizeof(indexTemp), "%s.idx.tmp", pHistory->path);
+
+    int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+    int dataFd = open(dataTemp, flags, 0600);
+    int indexFd = open(indexTemp, flags, 0600);
+    if(dataFd == -1 || indexFd == -1) {
+        perror("history");
+        if(dataFd != -1)
+            close(dataFd);
+        if(indexFd != -1)
+            close(indexFd);
+        unlink(dataTemp);
+        unlink(indexTemp);
+        return false;
+    }
+
+    size_t first = pHistory->count - keep;
+    uint64_t start = pHistory->offsets[first];
+    uint64_t shift = start - HISTORY_HEADER_SIZE;
+
+    bool ok = writeAll(dataFd, HISTORY_MAGIC, HISTORY_HEADER_SIZE);
+    ok = ok && writeAll(dataFd, pHistory->data + start, pHistory->dataSize - start);
+    ok = ok && writeAll(indexFd, HISTORY_INDEX_MAGIC, HISTORY_HEADER_SIZE);
+
+    uint64_t batch[HISTORY_BATCH];
+    for(size_t i = first; ok && i < pHistory->count; i += HISTORY_BATCH) {
+        size_t batchSize = pHistory->count - i < HISTORY_BATCH ? pHistory->count - i : HISTORY_BATCH;
+        for(size_t j = 0; j < batchSize; j++)
+            batch[j] = pHistory->offsets[i + j] - shift;
+        ok = writeAll(indexFd, batch, batchSize * sizeof(uint64_t));
+    }
+
+    ok = close(dataFd) == 0 && ok;
+    ok = close(indexFd) == 0 && ok;
+    ok = ok && rename(dataTemp, pHistory->path) == 0;
+    ok = ok && rename(indexTemp, pHistory->indexPath) == 0;
+    if(!ok) {
+        perror("history");
+        unlink(dataTemp);
+        unlink(indexTemp);
+        return false;
+    }
+
+    // The old lock goes with the old files
+    unmapFiles(pHistory);
+    closeFiles(pHistory);
+    return openFiles(pHistory) && mapFiles(pHistory);
+}
+
+static bool writeAll(int fd, const void* buffer, size_t size)
+{
+    const char* data = buffer;
+    while(size > 0) {
+        ssize_t written = write(fd, data, size);
+        if(written == -1) {
+            if(errno == EINTR)
+                continue;
+            return false;
+        }
+
+        data += written;
+        size -= written;
+    }
+
+    return true;
+}
+
+/************************************************
+ * entryText:   Look up a line by index without
+ *              checking the window or duplicates
+ *
+ * pHistory:    History to read
+ *
+ * index:       Position of the line, at least
+ *              historyFirst
+ *
+ * pLength:     Set to the length of the line
+ *
+ * return:      The line
+ ***********************************************/
+static const char* entryText(const History* pHistory, size_t index, size_t* pLength)
+{
+    if(index >= pHistory->count) {
+        size_t oldest = pHistory->count + pHistory->appended - pHistory->ringSize;
+        size_t slot = (pHistory->ringHead + (index - oldest)) % pHistory->ringCapacity;
+        *pLength = pHistory->ringLengths[slot];
+        return pHistory->ring[slot];
+    }
+
+    uint64_t offset = pHistory->offsets[index];
+    uint32_t length = 0;
+    if(offset + sizeof(uint32_t) <= pHistory->dataSize)
+        memcpy(&length, pHistory->data + offset, sizeof(uint32_t));
+
+    // Only the last record was checked at startup
+    if(offset + RECORD_SIZE(length) > pHistory->dataSize) {
+        *pLength = 0;
+        return "";
+    }
+
+    *pLength = length;
+    return pHistory->data + offset + sizeof(uint32_t);
+}
+
+static uint64_t fingerprint(const char* line, size_t length)
+{
+    // FNV-1a, 0 marks an empty slot
+    uint64_t hash = 14695981039346656037ull;
+    for(size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)line[i];
+        hash *= 1099511628211ull;
+    }
+
+    return hash ? hash : 1;
+}
+
+/************************************************
+ * findDup:     Look up the newest index holding a
+ *              line with a given fingerprint
+ *
+ * pHistory:    History to search
+ *
+ * key:         Fingerprint of the line
+ *
+ * return:      The index, or HISTORY_NONE
+ ***********************************************/
+static size_t findDup(const History* pHistory, uint64_t key)
+{
+    if(pHistory->dupCapacity == 0)
+        return HISTORY_NONE;
+
+    size_t mask = pHistory->dupCapacity - 1;
+    for(size_t slot = key & mask; pHistory->dupKeys[slot] != 0; slot = (slot + 1) & mask) {
+        if(pHistory->dupKeys[slot] == key)
+            return pHistory->dupIds[slot];
+    }
+
+    return HISTORY_NONE;
+}
+
+static bool putDup(History* pHistory, uint64_t key, size_t id)
+{
+    if((pHistory->dupSize + 1) * 2 > pHistory->dupCapacity) {
+        size_t capacity = pHistory->dupCapacity ? pHistory->dupCapacity * 2 : 64;
+        uint64_t* keys = calloc(capacity, sizeof(uint64_t));
+        size_t* ids = calloc(capacity, sizeof(size_t));
+        if(!keys || !ids) {
+            perror("calloc");
+            free(keys);
+            free(ids);
+            return false;
+        }
+
+        for(size_t i = 0; i < pHistory->dupCapacity; i++) {
+            if(pHistory->dupKeys[i] == 0)
+                continue;
+
+            size_t slot = pHistory->dupKeys[i] & (capacity - 1);
+            while(keys[slot] != 0)
+                slot = (slot + 1) & (capacity - 1);
+            keys[slot] = pHistory->dupKeys[i];
+            ids[slot] = pHistory->dupIds[i];
+        }
+
+        free(pHistory->dupKeys);
+        free(pHistory->dupIds);
+        pHistory->dupKeys = keys;
+        pHistory->dupIds = ids;
+        pHistory->dupCapacity = capacity;
+    }
+
+    size_t mask = pHistory->dupCapacity - 1;
+    size_t slot = key & mask;
+    while(pHistory->dupKeys[slot] != 0 && pHistory->dupKeys[slot] != key)
+        slot = (slot + 1) & mask;
+
+    if(pHistory->dupKeys[slot] == 0)
+        pHistory->dupSize++;
+
+    pHistory->dupKeys[slot] = key;
+    pHistory->dupIds[slot] = id;
+    return true;
+}
+
+/************************************************
+ * forgetDup:   Drop a line's fingerprint if the
+ *              line is its newest copy. Later
+ *              entries are shifted back so probing
+ *              needs no tombstones
+ *
+ * pHistory:    History to update
+ *
+ * index:       Position of the line
+ ***********************************************/
+static void forgetDup(History* pHistory, size_t index)
+{
+    if(!pHistory->eraseDups || pHistory->dupCapacity == 0)
+        return;
+
+    size_t length;
+    const char* text = entryText(pHistory, index, &length);
+    uint64_t key = fingerprint(text, length);
+
+    size_t mask = pHistory->dupCapacity - 1;
+    size_t slot = key & mask;
+    while(pHistory->dupKeys[slot] != key) {
+        if(pHistory->dupKeys[slot] == 0)
+            return;
+        slot = (slot + 1) & mask;
+    }
+
+    if(pHistory->dupIds[slot] != index)
+        return;
+
+    size_t next = (slot + 1) & mask;
+    while(pHistory->dupKeys[next] != 0) {
+        size_t home = pHistory->dupKeys[next] & mask;
+        if(((next - home) & mask) >= ((next - slot) & mask)) {
+            pHistory->dupKeys[slot] = pHistory->dupKeys[next];
+            pHistory->dupIds[slot] = pHistory->dupIds[next];
+            slot = next;
+        }
+        next = (next + 1) & mask;
+    }
+
+    pHistory->dupKeys[slot] = 0;
+    pHistory->dupSize--;
+}
+
+/************************************************
+ * rebuildDups: Refill the duplicate set from the
+ *              visible lines, oldest first so the
+ *              newest copy wins. Costs one pass
+ *              over the window, so it only runs
+ *              when the configuration or file
+ *              changes
+ *
+ * pHistory:    History to update
+ *
+ * return:      False if out of memory
+ ***********************************************/
+static bool rebuildDups(History* pHistory)
+{
+    if(pHistory->dupCapacity > 0) {
+        memset(pHistory->dupKeys, 0, pHistory->dupCapacity * sizeof(uint64_t));
+        pHistory->dupSize = 0;
+    }
+
+    if(!pHistory->eraseDups)
+        return true;
+
+    for(size_t i = historyFirst(pHistory); i < historyCount(pHistory); i++) {
+        size_t length;
+        const char* text = entryText(pHistory, i, &length);
+        if(!putDup(pHistory, fingerprint(text, length), i))
+            return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,53 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#define HISTORY_NONE SIZE_MAX
+
+// On disk: a data file of length-prefixed records after a small header, and
+// an index file holding the offset of every record. Both are mapped, so
+// startup cost and resident memory don't depend on how long history is.
+// Lines added this session sit in a ring of at most limit entries, and
+// only the newest limit lines overall are visible. With eraseDups, a hash
+// set maps each line's fingerprint to its newest index and older copies
+// are skipped
+typedef struct history_t {
+    char* path;
+    char* indexPath;
+    int fd;
+    int indexFd;
+    ino_t ino;
+    const char* data;
+    size_t dataSize;
+    const uint64_t* offsets;
+    size_t indexSize;
+    size_t count;
+    size_t limit;
+    char** ring;
+    uint32_t* ringLengths;
+    size_t ringCapacity;
+    size_t ringSize;
+    size_t ringHead;
+    size_t appended;
+    bool eraseDups;
+    uint64_t* dupKeys;
+    size_t* dupIds;
+    size_t dupCapacity;
+    size_t dupSize;
+} History;
+
+
+History historyOpen(const char* path, size_t limit);
+bool historyConfigure(History* pHistory, size_t limit, bool eraseDups);
+size_t historyFirst(const History* pHistory);
+size_t historyCount(const History* pHistory);
+size_t historyPrevious(const History* pHistory, size_t index);
+size_t historyNext(const History* pHistory, size_t index);
+const char* historyGet(const History* pHistory, size_t index, size_t* pLength);
+bool historyAppend(History* pHistory, const char* line, size_t length);
+void historyClose(History* pHistory);
+
+#endif
@@ -0,0 +1,313 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include "histsearch.h"
+#include "match.h"
+
+#define SEARCH_DEFAULT_WINDOW   65536
+#define SEARCH_MIN_SLOTS        1024
+#define SEARCH_MAX_KEYS         32
+
+// Keys are never 0, which marks an empty slot
+#define UNIGRAM_KEY(a)          ((1u << 25) | (uint32_t)(a))
+#define TRIGRAM_KEY(a, b, c)    ((((uint32_t)(a) << 16) | ((uint32_t)(b) << 8) | (uint32_t)(c)) + 1)
+
+static PostingList* findList(const HistorySearch* pSearch, uint32_t key);
+static bool addPosting(HistorySearch* pSearch, uint32_t key, uint32_t id);
+static bool growTable(HistorySearch* pSearch);
+static void indexEntry(HistorySearch* pSearch, uint32_t id, const char* text, size_t length);
+static bool containsId(const PostingList* pList, uint32_t id);
+
+static inline uint32_t hashKey(uint32_t key)
+{
+    return key * 2654435761u;
+}
+
+static inline unsigned char fold(char c)
+{
+    return tolower((unsigned char)c);
+}
+
+/************************************************
+ * historySearchInit:   Create an empty index
+ *
+ * window:              Number of the newest entries
+ *                      to keep searchable, 0 picks
+ *                      a default. Bounds memory
+ *                      when history is very long
+ *
+ * return:              The index
+ ***********************************************/
+HistorySearch historySearchInit(size_t window)
+{
+    if(window == 0)
+        window = SEARCH_DEFAULT_WINDOW;
+
+    return (HistorySearch){NULL, NULL, 0, 0, window, 0, 0};
+}
+
+/************************************************
+ * historySearchUpdate: Index every entry added to
+ *                      history since the last call.
+ *                      The first call starts at the
+ *                      oldest entry in the window.
+ *                      Lines that later leave the
+ *                      history are skipped when a
+ *                      search reaches them
+ *
+ * pSearch:             Index to update
+ *
+ * pHistory:            History being indexed
+ ***********************************************/
+void historySearchUpdate(HistorySearch* pSearch, const History* pHistory)
+{
+    size_t count = historyCount(pHistory);
+
+    // Start over once the window has slid by its own length, so postings
+    // for lines long gone don't pile up in a session that runs for weeks
+    if(pSearch->slotCapacity != 0 && count - pSearch->first > pSearch->window * 2)
+        historySearchDestroy(pSearch);
+
+    if(pSearch->slotCapacity == 0) {
+        pSearch->first = count > pSearch->window ? count - pSearch->window : 0;
+        if(pSearch->first < historyFirst(pHistory))
+            pSearch->first = historyFirst(pHistory);
+        pSearch->indexed = pSearch->first;
+        if(!growTable(pSearch))
+            return;
+    }
+
+    for(; pSearch->indexed < count && pSearch->indexed < UINT32_MAX; pSearch->indexed++) {
+        size_t length = 0;
+        const char* text = historyGet(pHistory, pSearch->indexed, &length);
+        if(text)
+            indexEntry(pSearch, pSearch->indexed, text, length);
+    }
+}
+
+/************************************************
+ * historySearch:   Find the newest entry before a
+ *                  position that matches a query.
+ *                  Candidates come from the
+ *                  shortest posting list of the
+ *                  query's n-grams and are checked
+ *                  against the others, so only
+ *                  likely matches are compared
+ *
+ * pSearch:         Index to search
+ *
+ * pHistory:        History being indexed
+ *
+ * query:           Text to look for
+ *
+ * length:          Length of query
+ *
+ * fuzzy:           Whether the query characters
+ *                  only need to appear in order,
+ *                  ignoring case. Otherwise the
+ *                  query must be a substring
+ *
+ * before:          Only entries older than this
+ *                  index are considered
+ *
+ * return:          Index of the match, or
+ *                  SEARCH_NONE
+ ***********************************************/
+size_t historySearch(HistorySearch* pSearch, const History* pHistory, const char* query, size_t length, bool fuzzy, size_t before)
+{
+    historySearchUpdate(pSearch, pHistory);
+    if(!query || length == 0 || pSearch->slotCapacity == 0)
+        return SEARCH_NONE;
+
+    // Every key's list must hold a match, so the shortest bounds the work
+    PostingList* lists[SEARCH_MAX_KEYS];
+    size_t numLists = 0;
+    if(!fuzzy && length >= 3) {
+        for(size_t i = 0; i + 2 < length && numLists < SEARCH_MAX_KEYS; i++) {
+            uint32_t key = TRIGRAM_KEY(fold(query[i]), fold(query[i + 1]), fold(query[i + 2]));
+            lists[numLists] = findList(pSearch, key);
+            if(!lists[numLists])
+                return SEARCH_NONE;
+            numLists++;
+        }
+    } else {
+        for(size_t i = 0; i < length && numLists < SEARCH_MAX_KEYS; i++) {
+            lists[numLists] = findList(pSearch, UNIGRAM_KEY(fold(query[i])));
+            if(!lists[numLists])
+                return SEARCH_NONE;
+            numLists++;
+        }
+    }
+
+    size_t shortest = 0;
+    for(size_t i = 1; i < numLists; i++) {
+        if(lists[i]->size < lists[shortest]->size)
+            shortest = i;
+    }
+
+    const PostingList* candidates = lists[shortest];
+    size_t low = 0;
+    size_t high = candidates->size;
+    while(low < high) {
+        size_t mid = low + (high - low) / 2;
+        if(candidates->ids[mid] < before)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    for(size_t i = low; i-- > 0;) {
+        uint32_t id = candidates->ids[i];
+
+        bool present = true;
+        for(size_t j = 0; j < numLists && present; j++) {
+            if(j != shortest)
+                present = containsId(lists[j], id);
+        }
+        if(!present)
+            continue;
+
+        size_t textLength = 0;
+        const char* text = historyGet(pHistory, id, &textLength);
+        if(!text)
+            continue;
+
+        if(fuzzy ? matchSubsequence(text, textLength, query, length) : memmem(text, textLength, query, length) != NULL)
+            return id;
+    }
+
+    return SEARCH_NONE;
+}
+
+void historySearchDestroy(HistorySearch* pSearch)
+{
+    if(!pSearch)
+        return;
+
+    for(size_t i = 0; i < pSearch->slotCapacity; i++) {
+        if(pSearch->keys[i] != 0)
+            free(pSearch->lists[i].ids);
+    }
+
+    free(pSearch->keys);
+    free(pSearch->lists);
+    *pSearch = historySearchInit(pSearch->window);
+}
+
+static PostingList* findList(const HistorySearch* pSearch, uint32_t key)
+{
+    size_t mask = pSearch->slotCapacity - 1;
+    for(size_t slot = hashKey(key) & mask; pSearch->keys[slot] != 0; slot = (slot + 1) & mask) {
+        if(pSearch->keys[slot] == key)
+            return &pSearch->lists[slot];
+    }
+
+    return NULL;
+}
+
+/************************************************
+ * addPosting:  Record that an entry contains a
+ *              key. Entries are indexed in order,
+ *              so lists stay sorted and a repeat
+ *              of the same key is the last id
+ *
+ * pSearch:     Index to add to
+ *
+ * key:         N-gram key
+ *
+ * id:          History index of the entry
+ *
+ * return:      False if out of memory
+ ***********************************************/
+static bool addPosting(HistorySearch* pSearch, uint32_t key, uint32_t id)
+{
+    if((pSearch->used + 1) * 2 > pSearch->slotCapacity && !growTable(pSearch))
+        return false;
+
+    size_t mask = pSearch->slotCapacity - 1;
+    size_t slot = hashKey(key) & mask;
+    while(pSearch->keys[slot] != 0 && pSearch->keys[slot] != key)
+        slot = (slot + 1) & mask;
+
+    PostingList* list = &pSearch->lists[slot];
+    if(pSearch->keys[slot] == 0) {
+        pSearch->keys[slot] = key;
+        *list = (PostingList){NULL, 0, 0};
+        pSearch->used++;
+    } else if(list->size > 0 && list->ids[list->size - 1] == id) {
+        return true;
+    }
+
+    if(list->size == list->capacity) {
+        uint32_t capacity = list->capacity ? list->capacity * 2 : 4;
+        uint32_t* temp = realloc(list->ids, capacity * sizeof(uint32_t));
+        if(!temp) {
+            perror("realloc");
+            return false;
+        }
+        list->ids = temp;
+        list->capacity = capacity;
+    }
+
+    list->ids[list->size++] = id;
+    return true;
+}
+
+static bool growTable(HistorySearch* pSearch)
+{
+    size_t capacity = pSearch->slotCapacity ? pSearch->slotCapacity * 2 : SEARCH_MIN_SLOTS;
+    uint32_t* keys = calloc(capacity, sizeof(uint32_t));
+    PostingList* lists = calloc(capacity, sizeof(PostingList));
+    if(!keys || !lists) {
+        perror("calloc");
+        free(keys);
+        free(lists);
+        return false;
+    }
+
+    size_t mask = capacity - 1;
+    for(size_t i = 0; i < pSearch->slotCapacity; i++) {
+        uint32_t key = pSearch->keys[i];
+        if(key == 0)
+            continue;
+
+        size_t slot = hashKey(key) & mask;
+        while(keys[slot] != 0)
+            slot = (slot + 1) & mask;
+
+        keys[slot] = key;
+        lists[slot] = pSearch->lists[i];
+    }
+
+    free(pSearch->keys);
+    free(pSearch->lists);
+    pSearch->keys = keys;
+    pSearch->lists = lists;
+    pSearch->slotCapacity = capacity;
+    return true;
+}
+
+static void indexEntry(HistorySearch* pSearch, uint32_t id, const char* text, size_t length)
+{
+    for(size_t i = 0; i < length; i++) {
+        addPosting(pSearch, UNIGRAM_KEY(fold(text[i])), id);
+        if(i + 2 < length)
+            addPosting(pSearch, TRIGRAM_KEY(fold(text[i]), fold(text[i + 1]), fold(text[i + 2])), id);
+    }
+}
+
+static bool containsId(const PostingList* pList, uint32_t id)
+{
+    size_t low = 0;
+    size_t high = pList->size;
+    while(low < high) {
+        size_t mid = low + (high - low) / 2;
+        if(pList->ids[mid] < id)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+
+    return low < pList->size && pList->ids[low] == id;
+}
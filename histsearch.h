@@ -0,0 +1,35 @@
+#ifndef HISTSEARCH_H
+#define HISTSEARCH_H
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "history.h"
+
+#define SEARCH_NONE SIZE_MAX
+
+// Ascending history indices of the entries containing one n-gram
+typedef struct posting_list_t {
+    uint32_t* ids;
+    uint32_t size;
+    uint32_t capacity;
+} PostingList;
+
+// Trigram and single byte postings for the newest window entries of a
+// History. Entries are indexed once, the first time a search sees them
+typedef struct history_search_t {
+    uint32_t* keys;
+    PostingList* lists;
+    size_t slotCapacity;
+    size_t used;
+    size_t window;
+    size_t first;
+    size_t indexed;
+} HistorySearch;
+
+
+HistorySearch historySearchInit(size_t window);
+void historySearchUpdate(HistorySearch* pSearch, const History* pHistory);
+size_t historySearch(HistorySearch* pSearch, const History* pHistory, const char* query, size_t length, bool fuzzy, size_t before);
+void historySearchDestroy(HistorySearch* pSearch);
+
+#endif
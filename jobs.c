@@ -0,0 +1,446 @@
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include "jobs.h"
+
+static volatile sig_atomic_t childPending = 0;
+
+static void onChild(int sig);
+static void updateState(Job* pJob);
+static bool resizeTable(JobTable* pTable);
+
+JobTable jobsInit(size_t capacity)
+{
+    // If no capacity is provided, use default value
+    if(capacity == 0)
+        capacity = 8;
+
+    JobTable table = {0, capacity, NULL};
+    table.jobs = calloc(table.capacity, sizeof(Job*));
+    if(!table.jobs)
+        table.capacity = 0;
+
+    return table;
+}
+
+/************************************************
+ * jobsInstallHandler:  Catch SIGCHLD so waits
+ *                      can sleep in sigsuspend
+ *                      and wake as soon as any
+ *                      child changes state
+ ***********************************************/
+void jobsInstallHandler(void)
+{
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onChild;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGCHLD, &sa, NULL);
+}
+
+/************************************************
+ * jobsAdd: Create an empty job for a pipeline
+ *
+ * pTable:  Table to add the job to
+ *
+ * command: Command line shown by "jobs"
+ *
+ * maxProcs:Number of stages in the pipeline
+ *
+ * return:  The new job, NULL on error
+ ***********************************************/
+Job* jobsAdd(JobTable* pTable, const char* command, size_t maxProcs)
+{
+    if(!pTable || !command || maxProcs == 0 || pTable->capacity == 0)
+        return NULL;
+
+    if(pTable->size >= pTable->capacity)
+        if(!resizeTable(pTable))
+            return NULL;
+
+    Job* job = calloc(1, sizeof(Job));
+    if(!job)
+        return NULL;
+
+    job->command = strdup(command);
+    job->procs = calloc(maxProcs, sizeof(ProcStats));
+    job->names = calloc(maxProcs, sizeof(char*));
+    if(!job->command || !job->procs || !job->names) {
+        free(job->command);
+        free(job->procs);
+        free(job->names);
+        free(job);
+        return NULL;
+    }
+
+    // Ids count up from the newest job so "%n" stays stable while it runs
+    int id = 0;
+    for(size_t i = 0; i < pTable->size; i++) {
+        if(pTable->jobs[i]->id > id)
+            id = pTable->jobs[i]->id;
+    }
+
+    job->id = id + 1;
+    job->pgid = -1;
+    job->maxProcs = maxProcs;
+    job->state = JOB_DONE;
+    pTable->jobs[pTable->size++] = job;
+
+    return job;
+}
+
+/************************************************
+ * jobsAddProcess:  Record a launched stage. The
+ *                  first stage that started sets
+ *                  the job's process group
+ *
+ * pJob:            Job the stage belongs to
+ *
+ * pid:             Pid of the stage, -1 if it
+ *                  failed to start
+ *
+ * name:            Command name of the stage
+ *
+ * return:          Whether it was recorded
+ ***********************************************/
+bool jobsAddProcess(Job* pJob, pid_t pid, const char* name)
+{
+    if(!pJob || pJob->numProcs >= pJob->maxProcs)
+        return false;
+
+    size_t i = pJob->numProcs;
+    pJob->names[i] = strdup(name ? name : "");
+    processStart(&pJob->procs[i], pid, pJob->names[i]);
+    pJob->numProcs++;
+
+    if(pid != -1 && pJob->pgid == -1)
+        pJob->pgid = pid;
+
+    updateState(pJob);
+    return true;
+}
+
+/************************************************
+ * jobsFind:    Look up a job from a "%n", "n",
+ *              "%+", "%%" or "%-" spec
+ *
+ * pTable:      Table to search
+ *
+ * spec:        Job spec, NULL for the current
+ *              job
+ *
+ * return:      The job, NULL if none matched
+ ***********************************************/
+Job* jobsFind(JobTable* pTable, const char* spec)
+{
+    if(!pTable || pTable->size == 0)
+        return NULL;
+
+    if(!spec || strcmp(spec, "%+") == 0 || strcmp(spec, "%%") == 0 || strcmp(spec, "%") == 0)
+        return pTable->jobs[pTable->size - 1];
+
+    if(strcmp(spec, "%-") == 0)
+        return pTable->size > 1 ? pTable->jobs[pTable->size - 2] : NULL;
+
+    if(spec[0] == '%')
+        spec++;
+
+    char* end;
+    long id = strtol(spec, &end, 10);
+    if(end == spec || *end != '\0')
+        return NULL;
+
+    for(size_t i = 0; i < pTable->size; i++) {
+        if(pTable->jobs[i]->id == id)
+            return pTable->jobs[i];
+    }
+
+    return NULL;
+}
+
+bool jobsRemove(JobTable* pTable, Job* pJob)
+{
+    if(!pTable || !pJob)
+        return false;
+
+    for(size_t i = 0; i < pTable->size; i++) {
+        if(pTable->jobs[i] != pJob)
+            continue;
+
+        for(size_t j = 0; j < pJob->numProcs; j++)
+            free(pJob->names[j]);
+        free(pJob->names);
+        free(pJob->procs);
+        free(pJob->command);
+        free(pJob);
+
+        for(size_t j = i; j < pTable->size - 1; j++)
+            pTable->jobs[j] = pTable->jobs[j+1];
+
+        pTable->jobs[--pTable->size] = NULL;
+        return true;
+    }
+
+    return false;
+}
+
+/************************************************
+ * jobsUpdate:  Reap every tracked child which
+ *              has changed state without
+ *              blocking and record its status
+ *              and resource usage in its job.
+ *              Only the table's own pids are
+ *              waited for, other children such
+ *              as the prompt's git belong to
+ *              whoever started them
+ *
+ * pTable:      Table holding the children
+ ***********************************************/
+void jobsUpdate(JobTable* pTable)
+{
+    if(!pTable || !childPending)
+        return;
+
+    childPending = 0;
+
+    for(size_t i = 0; i < pTable->size; i++) {
+        Job* job = pTable->jobs[i];
+        bool changed = false;
+
+        for(size_t j = 0; j < job->numProcs; j++) {
+            ProcStats* proc = &job->procs[j];
+            int wstatus;
+            struct rusage usage;
+            while(!proc->done && proc->pid > 0
+                  && wait4(proc->pid, &wstatus, WNOHANG | WUNTRACED | WCONTINUED, &usage) > 0) {
+                if(WIFSTOPPED(wstatus)) {
+                    proc->stopped = true;
+                } else if(WIFCONTINUED(wstatus)) {
+                    proc->stopped = false;
+                } else {
+                    clock_gettime(CLOCK_MONOTONIC, &proc->end);
+                    proc->usage = usage;
+                    proc->status = processStatus(wstatus, proc->name);
+                    proc->stopped = false;
+                    proc->done = true;
+                }
+                changed = true;
+            }
+        }
+
+        if(changed) {
+            JobState prev = job->state;
+            updateState(job);
+            if(job->state != prev)
+                job->notified = false;
+        }
+    }
+}
+
+/************************************************
+ * jobsWait:    Sleep until a job has finished or
+ *              been stopped. SIGCHLD is blocked
+ *              between checks and sigsuspend
+ *              wakes on the next state change,
+ *              so no update is ever missed
+ *
+ * pTable:      Table holding the job
+ *
+ * pJob:        Job to wait for
+ *
+ * return:      Final state of the job
+ ***********************************************/
+JobState jobsWait(JobTable* pTable, Job* pJob)
+{
+    if(!pTable || !pJob)
+        return JOB_DONE;
+
+    sigset_t block, prev;
+    sigemptyset(&block);
+    sigaddset(&block, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &block, &prev);
+    sigdelset(&prev, SIGCHLD);
+
+    jobsUpdate(pTable);
+    while(pJob->state == JOB_RUNNING) {
+        sigsuspend(&prev);
+        jobsUpdate(pTable);
+    }
+
+    sigprocmask(SIG_SETMASK, &prev, NULL);
+    return pJob->state;
+}
+
+/************************************************
+ * jobsWaitChange:  Sleep until at least one
+ *                  child has changed state since
+ *                  the last update, then reap
+ *
+ * pTable:          Table holding the children
+ ***********************************************/
+void jobsWaitChange(JobTable* pTable)
+{
+    if(!pTable)
+        return;
+
+    sigset_t block, prev;
+    sigemptyset(&block);
+    sigaddset(&block, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &block, &prev);
+    sigdelset(&prev, SIGCHLD);
+
+    // The flag is only read with SIGCHLD blocked so a wakeup can't be lost
+    if(!childPending)
+        sigsuspend(&prev);
+
+    sigprocmask(SIG_SETMASK, &prev, NULL);
+    jobsUpdate(pTable);
+}
+
+/************************************************
+ * jobsContinue:    Send SIGCONT to every process
+ *                  in a job and mark it running
+ *
+ * pJob:            Job to resume
+ *
+ * return:          Whether the signal was sent
+ ***********************************************/
+bool jobsContinue(Job* pJob)
+{
+    if(!pJob || pJob->state == JOB_DONE)
+        return false;
+
+    bool sent = pJob->pgid > 0 && kill(-pJob->pgid, SIGCONT) == 0;
+    if(!sent) { // Not a process group of its own, signal each stage
+        for(size_t i = 0; i < pJob->numProcs; i++) {
+            if(!pJob->procs[i].done && kill(pJob->procs[i].pid, SIGCONT) == 0)
+                sent = true;
+        }
+    }
+
+    if(sent) {
+        for(size_t i = 0; i < pJob->numProcs; i++)
+            pJob->procs[i].stopped = false;
+        updateState(pJob);
+        pJob->notified = true;
+    }
+
+    return sent;
+}
+
+int jobsStatus(const Job* pJob)
+{
+    if(!pJob || pJob->numProcs == 0)
+        return 0;
+
+    return pJob->procs[pJob->numProcs - 1].status;
+}
+
+void jobsPrint(const JobTable* pTable, const Job* pJob, int fd)
+{
+    if(!pTable || !pJob || fd < 0)
+        return;
+
+    char marker = ' ';
+    if(pTable->size > 0 && pTable->jobs[pTable->size - 1] == pJob)
+        marker = '+';
+    else if(pTable->size > 1 && pTable->jobs[pTable->size - 2] == pJob)
+        marker = '-';
+
+    const char* state = "Running";
+    char done[32];
+    if(pJob->state == JOB_STOPPED) {
+        state = "Stopped";
+    } else if(pJob->state == JOB_DONE) {
+        int status = jobsStatus(pJob);
+        if(status == 0) {
+            state = "Done";
+        } else {
+            snprintf(done, sizeof(done), "Exit %d", status);
+            state = done;
+        }
+    }
+
+    dprintf(fd, "[%d]%c  %-22s %s\n", pJob->id, marker, state, pJob->command);
+}
+
+/************************************************
+ * jobsNotify:  Report jobs which have stopped
+ *              or finished since they were last
+ *              reported and drop the finished
+ *              ones from the table
+ *
+ * pTable:      Table to report on
+ *
+ * fd:          Where to print, -1 to drop
+ *              finished jobs silently
+ ***********************************************/
+void jobsNotify(JobTable* pTable, int fd)
+{
+    if(!pTable)
+        return;
+
+    jobsUpdate(pTable);
+
+    size_t i = 0;
+    while(i < pTable->size) {
+        Job* job = pTable->jobs[i];
+        if(!job->notified && fd >= 0 && job->state != JOB_RUNNING)
+            jobsPrint(pTable, job, fd);
+        job->notified = true;
+
+        if(job->state == JOB_DONE)
+            jobsRemove(pTable, job);
+        else
+            i++;
+    }
+}
+
+void jobsDestroy(JobTable* pTable)
+{
+    if(pTable) {
+        while(pTable->size > 0)
+            jobsRemove(pTable, pTable->jobs[0]);
+        free(pTable->jobs);
+    }
+}
+
+static void onChild(int sig)
+{
+    (void)sig;
+    childPending = 1;
+}
+
+static void updateState(Job* pJob)
+{
+    bool running = false, stopped = false;
+    for(size_t i = 0; i < pJob->numProcs; i++) {
+        if(pJob->procs[i].done)
+            continue;
+
+        if(pJob->procs[i].stopped)
+            stopped = true;
+        else
+            running = true;
+    }
+
+    if(running)
+        pJob->state = JOB_RUNNING;
+    else if(stopped)
+        pJob->state = JOB_STOPPED;
+    else
+        pJob->state = JOB_DONE;
+}
+
+static bool resizeTable(JobTable* pTable)
+{
+    Job** temp = realloc(pTable->jobs, pTable->capacity * 2 * sizeof(Job*));
+    if(!temp)
+        return false;
+
+    pTable->jobs = temp;
+    pTable->capacity *= 2;
+    return true;
+}
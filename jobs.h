@@ -0,0 +1,52 @@
+#ifndef JOBS_H
+#define JOBS_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <termios.h>
+#include <sys/types.h>
+#include "process.h"
+
+typedef enum jobstate_t {
+    JOB_RUNNING,
+    JOB_STOPPED,
+    JOB_DONE
+} JobState;
+
+typedef struct job_t {
+    int id;
+    pid_t pgid;
+    JobState state;
+    bool notified;
+    char* command;
+    size_t numProcs;
+    size_t maxProcs;
+    ProcStats* procs;
+    char** names;
+    bool hasTmodes;
+    struct termios tmodes;
+} Job;
+
+typedef struct jobtable_t {
+    size_t size;
+    size_t capacity;
+    Job** jobs;
+} JobTable;
+
+
+JobTable jobsInit(size_t capacity);
+void jobsInstallHandler(void);
+Job* jobsAdd(JobTable* pTable, const char* command, size_t maxProcs);
+bool jobsAddProcess(Job* pJob, pid_t pid, const char* name);
+Job* jobsFind(JobTable* pTable, const char* spec);
+bool jobsRemove(JobTable* pTable, Job* pJob);
+void jobsUpdate(JobTable* pTable);
+JobState jobsWait(JobTable* pTable, Job* pJob);
+void jobsWaitChange(JobTable* pTable);
+bool jobsContinue(Job* pJob);
+int jobsStatus(const Job* pJob);
+void jobsPrint(const JobTable* pTable, const Job* pJob, int fd);
+void jobsNotify(JobTable* pTable, int fd);
+void jobsDestroy(JobTable* pTable);
+
+#endif
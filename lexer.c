@@ -0,0 +1,318 @@
+#include <string.h>
+#include "lexer.h"
+
+static bool appendSpan(SpanList* pList, size_t offset, size_t length, TokenKind kind, uint8_t flags);
+static size_t expandWord(const char* input, size_t offset, size_t length, LexLookup lookup, void* ctx, char* out, bool pattern);
+static size_t parameterName(const char* input, size_t i, size_t end, size_t* pNameStart, size_t* pNameLen);
+
+SpanList spanListInit(size_t capacity)
+{
+    // If no capacity is provided, use default value
+    if(capacity == 0)
+        capacity = 32;
+
+    SpanList list = {0, capacity, NULL};
+    list.spans = malloc(capacity * sizeof(Span));
+    if(!list.spans)
+        list.capacity = 0;
+
+    return list;
+}
+
+void spanListDestroy(SpanList* pList)
+{
+    if(pList) {
+        free(pList->spans);
+        pList->spans = NULL;
+        pList->size = 0;
+        pList->capacity = 0;
+    }
+}
+
+/************************************************
+ * lexInput:    Split a command line into spans
+ *              in a single pass. Words keep
+ *              their quotes and backslashes,
+ *              they are only removed when the
+ *              word is materialised with
+ *              lexUnquote. Operators are
+ *              recognised outside quotes
+ *
+ * input:       Command line, need not be NUL
+ *              terminated
+ *
+ * size:        Number of bytes in input
+ *
+ * pList:       Cleared and filled with spans
+ *
+ * return:      False if a quote was left open,
+ *              the last word then runs to the
+ *              end of the input
+ ***********************************************/
+bool lexInput(const char* input, size_t size, SpanList* pList)
+{
+    if(!input || !pList)
+        return false;
+
+    pList->size = 0;
+
+    size_t i = 0;
+    while(i < size) {
+        char c = input[i];
+        if(c == ' ' || c == '\t' || c == '\n') {
+            i++;
+            continue;
+        }
+
+        if(c == '|') {
+            appendSpan(pList, i++, 1, TOKEN_PIPE, 0);
+            continue;
+        } else if(c == '&') {
+            appendSpan(pList, i++, 1, TOKEN_BACKGROUND, 0);
+            continue;
+        } else if(c == '<') {
+            appendSpan(pList, i++, 1, TOKEN_IN, 0);
+            continue;
+        } else if(c == '>') {
+            if(i + 1 < size && input[i + 1] == '>') {
+                appendSpan(pList, i, 2, TOKEN_APPEND, 0);
+                i += 2;
+            } else {
+                appendSpan(pList, i++, 1, TOKEN_OUT, 0);
+            }
+            continue;
+        }
+
+        // Word, ends at unquoted whitespace or an operator
+        size_t start = i;
+        uint8_t flags = c == '~' ? SPAN_TILDE : 0;
+        char quote = '\0';
+        for(; i < size; i++) {
+            c = input[i];
+            if(quote == '\'') {
+                if(c == '\'')
+                    quote = '\0';
+            } else if(quote == '"') {
+                if(c == '\\' && i + 1 < size)
+                    i++;
+                else if(c == '"')
+                    quote = '\0';
+                else if(c == '$')
+                    flags |= SPAN_DOLLAR;
+            } else if(c == '$') {
+                flags |= SPAN_DOLLAR;
+            } else if(c == '*' || c == '?' || c == '[') {
+                flags |= SPAN_GLOB;
+            } else if(c == '\\') {
+                flags |= SPAN_QUOTED;
+                if(i + 1 < size)
+                    i++;
+            } else if(c == '\'' || c == '"') {
+                flags |= SPAN_QUOTED;
+                quote = c;
+            } else if(strchr(" \t\n|&<>", c)) {
+                break;
+            }
+        }
+
+        if(!appendSpan(pList, start, i - start, TOKEN_WORD, flags))
+            return false;
+
+        if(quote)
+            return false;
+    }
+
+    return true;
+}
+
+/************************************************
+ * lexUnquote:  Copy part of a word with quotes
+ *              removed and escapes resolved.
+ *              Inside double quotes a backslash
+ *              only escapes \, ", $ and `
+ *
+ * input:       Command line the span refers to
+ *
+ * offset:      Start of the text to copy
+ *
+ * length:      Number of input bytes to copy
+ *
+ * out:         Buffer of at least length bytes,
+ *              NULL to only measure
+ *
+ * return:      Number of bytes written, no NUL
+ *              is added
+ ***********************************************/
+size_t lexUnquote(const char* input, size_t offset, size_t length, char* out)
+{
+    return lexExpand(input, offset, length, NULL, NULL, out);
+}
+
+/************************************************
+ * lexExpand:   Like lexUnquote, but $NAME and
+ *              ${NAME} outside single quotes are
+ *              replaced by their value. Results
+ *              are not split into fields
+ *
+ * input:       Command line the span refers to
+ *
+ * offset:      Start of the text to copy
+ *
+ * length:      Number of input bytes to copy
+ *
+ * lookup:      Returns the value of a name, or
+ *              NULL if it is unset. NULL leaves
+ *              every '$' as it is
+ *
+ * ctx:         Passed to lookup
+ *
+ * out:         Buffer large enough for the
+ *              result, NULL to only measure
+ *
+ * return:      Number of bytes written, no NUL
+ *              is added
+ ***********************************************/
+size_t lexExpand(const char* input, size_t offset, size_t length, LexLookup lookup, void* ctx, char* out)
+{
+    return expandWord(input, offset, length, lookup, ctx, out, false);
+}
+
+/************************************************
+ * lexPattern:  Like lexExpand, but the result is
+ *              a glob pattern. Quoted or
+ *              expanded *, ?, [ and \ are
+ *              escaped with a '\' so only ones
+ *              typed unquoted match
+ *
+ * input:       Command line the span refers to
+ *
+ * offset:      Start of the text to copy
+ *
+ * length:      Number of input bytes to copy
+ *
+ * lookup:      As for lexExpand
+ *
+ * ctx:         Passed to lookup
+ *
+ * out:         Buffer large enough for the
+ *              result, NULL to only measure
+ *
+ * return:      Number of bytes written, no NUL
+ *              is added
+ ***********************************************/
+size_t lexPattern(const char* input, size_t offset, size_t length, LexLookup lookup, void* ctx, char* out)
+{
+    return expandWord(input, offset, length, lookup, ctx, out, true);
+}
+
+bool lexEquals(const char* input, Span span, const char* string)
+{
+    return span.kind == TOKEN_WORD && !(span.flags & SPAN_QUOTED) &&
+           strlen(string) == span.length && strncmp(input + span.offset, string, span.length) == 0;
+}
+
+static bool appendSpan(SpanList* pList, size_t offset, size_t length, TokenKind kind, uint8_t flags)
+{
+    if(pList->size >= pList->capacity) {
+        size_t capacity = pList->capacity ? pList->capacity * 2 : 32;
+        Span* temp = realloc(pList->spans, capacity * sizeof(Span));
+        if(!temp)
+            return false;
+
+        pList->spans = temp;
+        pList->capacity = capacity;
+    }
+
+    pList->spans[pList->size++] = (Span){offset, length, kind, flags};
+    return true;
+}
+
+static size_t parameterName(const char* input, size_t i, size_t end, size_t* pNameStart, size_t* pNameLen)
+{
+    // Special parameters are a single character
+    if(i + 1 < end && (input[i + 1] == '?' || input[i + 1] == '$')) {
+        *pNameStart = i + 1;
+        *pNameLen = 1;
+        return 2;
+    }
+
+    bool braced = i + 1 < end && input[i + 1] == '{';
+    size_t j = i + 1 + braced;
+    *pNameStart = j;
+    while(j < end && (input[j] == '_' || (input[j] >= 'a' && input[j] <= 'z') ||
+          (input[j] >= 'A' && input[j] <= 'Z') || (j > *pNameStart && input[j] >= '0' && input[j] <= '9')))
+        j++;
+
+    *pNameLen = j - *pNameStart;
+    if(*pNameLen == 0)
+        return 0;
+
+    if(braced) {
+        if(j >= end || input[j] != '}')
+            return 0;
+        j++;
+    }
+
+    return j - i;
+}
+
+static size_t expandWord(const char* input, size_t offset, size_t length, LexLookup lookup, void* ctx, char* out, bool pattern)
+{
+    size_t n = 0;
+    size_t end = offset + length;
+    char quote = '\0';
+    for(size_t i = offset; i < end; i++) {
+        char c = input[i];
+        bool literal = quote != '\0';
+        if(quote == '\'') {
+            if(c == '\'') {
+                quote = '\0';
+                continue;
+            }
+        } else if(c == '$' && lookup) {
+            size_t nameStart, nameLen;
+            size_t used = parameterName(input, i, end, &nameStart, &nameLen);
+            if(used > 0) {
+                // Values are never patterns, quoted or not
+                const char* value = lookup(input + nameStart, nameLen, ctx);
+                for(; value && *value; value++) {
+                    if(pattern && strchr("*?[\\", *value)) {
+                        if(out)
+                            out[n] = '\\';
+                        n++;
+                    }
+                    if(out)
+                        out[n] = *value;
+                    n++;
+                }
+                i += used - 1;
+                continue;
+            }
+        } else if(quote == '"') {
+            if(c == '"') {
+                quote = '\0';
+                continue;
+            }
+            if(c == '\\' && i + 1 < end && strchr("\\\"$`", input[i + 1]))
+                c = input[++i];
+        } else if(c == '\'' || c == '"') {
+            quote = c;
+            continue;
+        } else if(c == '\\' && i + 1 < end) {
+            c = input[++i];
+            literal = true;
+        }
+
+        if(pattern && literal && strchr("*?[\\", c)) {
+            if(out)
+                out[n] = '\\';
+            n++;
+        }
+
+        if(out)
+            out[n] = c;
+        n++;
+    }
+
+    return n;
+}
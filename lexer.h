@@ -0,0 +1,45 @@
+#ifndef LEXER_H
+#define LEXER_H
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define SPAN_QUOTED 0x1
+#define SPAN_TILDE  0x2
+#define SPAN_DOLLAR 0x4
+#define SPAN_GLOB   0x8
+
+typedef enum tokenkind_t {
+    TOKEN_WORD,
+    TOKEN_PIPE,
+    TOKEN_IN,
+    TOKEN_OUT,
+    TOKEN_APPEND,
+    TOKEN_BACKGROUND
+} TokenKind;
+
+typedef struct span_t {
+    uint32_t offset;
+    uint32_t length;
+    TokenKind kind;
+    uint8_t flags;
+} Span;
+
+typedef const char* (*LexLookup)(const char* name, size_t length, void* ctx);
+
+typedef struct spanlist_t {
+    size_t size;
+    size_t capacity;
+    Span* spans;
+} SpanList;
+
+
+SpanList spanListInit(size_t capacity);
+void spanListDestroy(SpanList* pList);
+bool lexInput(const char* input, size_t size, SpanList* pList);
+size_t lexUnquote(const char* input, size_t offset, size_t length, char* out);
+size_t lexExpand(const char* input, size_t offset, size_t length, LexLookup lookup, void* ctx, char* out);
+size_t lexPattern(const char* input, size_t offset, size_t length, LexLookup lookup, void* ctx, char* out);
+bool lexEquals(const char* input, Span span, const char* string);
+
+#endif
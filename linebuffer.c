@@ -0,0 +1,390 @@
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include "linebuffer.h"
+
+#define LINE_DEFAULT_CAPACITY 256
+
+static bool reserveGap(LineBuffer* pLine, size_t size);
+
+/************************************************
+ * lineBufferInit:  Create an empty line
+ *
+ * capacity:        Initial size in bytes, 0 picks
+ *                  a default
+ *
+ * return:          The line. data is NULL if the
+ *                  allocation failed
+ ***********************************************/
+LineBuffer lineBufferInit(size_t capacity)
+{
+    if(capacity == 0)
+        capacity = LINE_DEFAULT_CAPACITY;
+
+    LineBuffer line = {0};
+    line.data = malloc(capacity);
+    if(!line.data) {
+        perror("malloc");
+        return line;
+    }
+
+    line.capacity = capacity;
+    line.gapEnd = capacity;
+    line.textDirty = true;
+    return line;
+}
+
+size_t lineBufferLength(const LineBuffer* pLine)
+{
+    return pLine->capacity - (pLine->gapEnd - pLine->gapStart);
+}
+
+size_t lineBufferCursor(const LineBuffer* pLine)
+{
+    return pLine->gapStart;
+}
+
+char lineBufferAt(const LineBuffer* pLine, size_t index)
+{
+    if(index < pLine->gapStart)
+        return pLine->data[index];
+
+    return pLine->data[index + pLine->gapEnd - pLine->gapStart];
+}
+
+/************************************************
+ * lineBufferInsert:    Insert text at the cursor
+ *                      and move the cursor past it
+ *
+ * pLine:               Line to edit
+ *
+ * data:                Text to insert
+ *
+ * size:                Number of bytes in data
+ *
+ * return:              False if out of memory
+ ***********************************************/
+bool lineBufferInsert(LineBuffer* pLine, const char* data, size_t size)
+{
+    if(!pLine || (!data && size > 0))
+        return false;
+
+    if(!reserveGap(pLine, size))
+        return false;
+
+    memcpy(pLine->data + pLine->gapStart, data, size);
+    pLine->gapStart += size;
+    pLine->textDirty = true;
+    return true;
+}
+
+/************************************************
+ * lineBufferDelete:    Remove text around the
+ *                      cursor
+ *
+ * pLine:               Line to edit
+ *
+ * before:              Bytes to remove before the
+ *                      cursor
+ *
+ * after:               Bytes to remove after the
+ *                      cursor
+ *
+ * return:              Number of bytes removed
+ ***********************************************/
+size_t lineBufferDelete(LineBuffer* pLine, size_t before, size_t after)
+{
+    if(!pLine)
+        return 0;
+
+    if(before > pLine->gapStart)
+        before = pLine->gapStart;
+    if(after > pLine->capacity - pLine->gapEnd)
+        after = pLine->capacity - pLine->gapEnd;
+
+    pLine->gapStart -= before;
+    pLine->gapEnd += after;
+    if(before + after > 0)
+        pLine->textDirty = true;
+
+    return before + after;
+}
+
+/************************************************
+ * lineBufferMove:  Put the cursor at an offset.
+ *                  Only the text between the old
+ *                  and new cursor is moved
+ *
+ * pLine:           Line to edit
+ *
+ * cursor:          New offset, clamped to the
+ *                  length of the line
+ ***********************************************/
+void lineBufferMove(LineBuffer* pLine, size_t cursor)
+{
+    if(!pLine)
+        return;
+
+    size_t length = lineBufferLength(pLine);
+    if(cursor > length)
+        cursor = length;
+
+    if(cursor < pLine->gapStart) {
+        size_t count = pLine->gapStart - cursor;
+        memmove(pLine->data + pLine->gapEnd - count, pLine->data + cursor, count);
+        pLine->gapStart -= count;
+        pLine->gapEnd -= count;
+    } else if(cursor > pLine->gapStart) {
+        size_t count = cursor - pLine->gapStart;
+        memmove(pLine->data + pLine->gapStart, pLine->data + pLine->gapEnd, count);
+        pLine->gapStart += count;
+        pLine->gapEnd += count;
+    }
+}
+
+/************************************************
+ * lineBufferCharLeft:  Find the start of the
+ *                      character before the
+ *                      cursor, stepping over
+ *                      UTF-8 continuation bytes
+ *
+ * pLine:               Line to search
+ *
+ * return:              Offset of the character
+ ***********************************************/
+size_t lineBufferCharLeft(const LineBuffer* pLine)
+{
+    size_t i = pLine->gapStart;
+    if(i > 0)
+        i--;
+    while(i > 0 && ((unsigned char)lineBufferAt(pLine, i) & 0xc0) == 0x80)
+        i--;
+
+    return i;
+}
+
+/************************************************
+ * lineBufferCharRight: Find the end of the
+ *                      character after the cursor
+ *
+ * pLine:               Line to search
+ *
+ * return:              Offset just past it
+ ***********************************************/
+size_t lineBufferCharRight(const LineBuffer* pLine)
+{
+    size_t length = lineBufferLength(pLine);
+    size_t i = pLine->gapStart;
+    if(i < length)
+        i++;
+    while(i < length && ((unsigned char)lineBufferAt(pLine, i) & 0xc0) == 0x80)
+        i++;
+
+    return i;
+}
+
+/************************************************
+ * lineBufferWordLeft:  Find the start of the word
+ *                      before the cursor. Words
+ *                      are runs of non-blank
+ *                      characters
+ *
+ * pLine:               Line to search
+ *
+ * return:              Offset of the word start
+ ***********************************************/
+size_t lineBufferWordLeft(const LineBuffer* pLine)
+{
+    size_t i = pLine->gapStart;
+    while(i > 0 && isspace((unsigned char)lineBufferAt(pLine, i - 1)))
+        i--;
+    while(i > 0 && !isspace((unsigned char)lineBufferAt(pLine, i - 1)))
+        i--;
+
+    return i;
+}
+
+/************************************************
+ * lineBufferWordRight: Find the end of the word
+ *                      after the cursor
+ *
+ * pLine:               Line to search
+ *
+ * return:              Offset just past the word
+ ***********************************************/
+size_t lineBufferWordRight(const LineBuffer* pLine)
+{
+    size_t length = lineBufferLength(pLine);
+    size_t i = pLine->gapStart;
+    while(i < length && isspace((unsigned char)lineBufferAt(pLine, i)))
+        i++;
+    while(i < length && !isspace((unsigned char)lineBufferAt(pLine, i)))
+        i++;
+
+    return i;
+}
+
+/************************************************
+ * lineBufferKill:  Cut a range next to the cursor
+ *                  into the kill buffer. The range
+ *                  must contain the cursor
+ *
+ * pLine:           Line to edit
+ *
+ * from:            Start offset of the range
+ *
+ * to:              End offset of the range
+ *
+ * return:          False if out of memory
+ ***********************************************/
+bool lineBufferKill(LineBuffer* pLine, size_t from, size_t to)
+{
+    if(!pLine || from > pLine->gapStart || to < pLine->gapStart)
+        return false;
+
+    size_t before = pLine->gapStart - from;
+    size_t after = to - pLine->gapStart;
+    if(after > pLine->capacity - pLine->gapEnd)
+        after = pLine->capacity - pLine->gapEnd;
+    if(before + after == 0)
+        return true;
+
+    if(before + after > pLine->killCapacity) {
+        char* temp = realloc(pLine->kill, before + after);
+        if(!temp) {
+            perror("realloc");
+            return false;
+        }
+        pLine->kill = temp;
+        pLine->killCapacity = before + after;
+    }
+
+    memcpy(pLine->kill, pLine->data + from, before);
+    memcpy(pLine->kill + before, pLine->data + pLine->gapEnd, after);
+    pLine->killSize = before + after;
+
+    lineBufferDelete(pLine, before, after);
+    return true;
+}
+
+bool lineBufferYank(LineBuffer* pLine)
+{
+    if(!pLine || pLine->killSize == 0)
+        return true;
+
+    return lineBufferInsert(pLine, pLine->kill, pLine->killSize);
+}
+
+/************************************************
+ * lineBufferSet:   Replace the whole line, leaving
+ *                  the cursor at the end. Used for
+ *                  history recall
+ *
+ * pLine:           Line to edit
+ *
+ * data:            New contents
+ *
+ * size:            Number of bytes in data
+ *
+ * return:          False if out of memory
+ ***********************************************/
+bool lineBufferSet(LineBuffer* pLine, const char* data, size_t size)
+{
+    lineBufferClear(pLine);
+    return lineBufferInsert(pLine, data, size);
+}
+
+void lineBufferClear(LineBuffer* pLine)
+{
+    if(pLine) {
+        pLine->gapStart = 0;
+        pLine->gapEnd = pLine->capacity;
+        pLine->textDirty = true;
+    }
+}
+
+/************************************************
+ * lineBufferString:    Get the line as one NUL
+ *                      terminated string. The copy
+ *                      is rebuilt only after edits
+ *                      and stays valid until the
+ *                      next edit
+ *
+ * pLine:               Line to read
+ *
+ * return:              The text, or NULL if out of
+ *                      memory
+ ***********************************************/
+char* lineBufferString(LineBuffer* pLine)
+{
+    if(!pLine)
+        return NULL;
+
+    size_t length = lineBufferLength(pLine);
+    if(!pLine->textDirty && pLine->text)
+        return pLine->text;
+
+    if(length + 1 > pLine->textCapacity) {
+        char* temp = realloc(pLine->text, pLine->capacity + 1);
+        if(!temp) {
+            perror("realloc");
+            return NULL;
+        }
+        pLine->text = temp;
+        pLine->textCapacity = pLine->capacity + 1;
+    }
+
+    size_t after = pLine->capacity - pLine->gapEnd;
+    memcpy(pLine->text, pLine->data, pLine->gapStart);
+    memcpy(pLine->text + pLine->gapStart, pLine->data + pLine->gapEnd, after);
+    pLine->text[length] = '\0';
+    pLine->textDirty = false;
+    return pLine->text;
+}
+
+void lineBufferDestroy(LineBuffer* pLine)
+{
+    if(!pLine)
+        return;
+
+    free(pLine->data);
+    free(pLine->text);
+    free(pLine->kill);
+    *pLine = (LineBuffer){0};
+}
+
+/************************************************
+ * reserveGap:  Make room for size more bytes at
+ *              the cursor. The buffer doubles so
+ *              inserts stay amortised O(1)
+ *
+ * pLine:       Line to grow
+ *
+ * size:        Bytes about to be inserted
+ *
+ * return:      False if out of memory
+ ***********************************************/
+static bool reserveGap(LineBuffer* pLine, size_t size)
+{
+    if(pLine->gapEnd - pLine->gapStart >= size)
+        return true;
+
+    size_t length = lineBufferLength(pLine);
+    size_t capacity = pLine->capacity ? pLine->capacity : LINE_DEFAULT_CAPACITY;
+    while(capacity - length < size)
+        capacity *= 2;
+
+    char* temp = realloc(pLine->data, capacity);
+    if(!temp) {
+        perror("realloc");
+        return false;
+    }
+
+    // Slide the text after the cursor to the new end
+    size_t after = pLine->capacity - pLine->gapEnd;
+    memmove(temp + capacity - after, temp + pLine->gapEnd, after);
+    pLine->data = temp;
+    pLine->gapEnd = capacity - after;
+    pLine->capacity = capacity;
+    return true;
+}
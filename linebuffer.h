@@ -0,0 +1,41 @@
+#ifndef LINEBUFFER_H
+#define LINEBUFFER_H
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Gap buffer: text before the cursor sits at the front of data, text after
+// it at the back, and edits at the cursor only move the gap boundaries
+typedef struct line_buffer_t {
+    char* data;
+    size_t capacity;
+    size_t gapStart;
+    size_t gapEnd;
+    char* text;
+    size_t textCapacity;
+    bool textDirty;
+    char* kill;
+    size_t killSize;
+    size_t killCapacity;
+} LineBuffer;
+
+
+LineBuffer lineBufferInit(size_t capacity);
+size_t lineBufferLength(const LineBuffer* pLine);
+size_t lineBufferCursor(const LineBuffer* pLine);
+char lineBufferAt(const LineBuffer* pLine, size_t index);
+bool lineBufferInsert(LineBuffer* pLine, const char* data, size_t size);
+size_t lineBufferDelete(LineBuffer* pLine, size_t before, size_t after);
+void lineBufferMove(LineBuffer* pLine, size_t cursor);
+size_t lineBufferCharLeft(const LineBuffer* pLine);
+size_t lineBufferCharRight(const LineBuffer* pLine);
+size_t lineBufferWordLeft(const LineBuffer* pLine);
+size_t lineBufferWordRight(const LineBuffer* pLine);
+bool lineBufferKill(LineBuffer* pLine, size_t from, size_t to);
+bool lineBufferYank(LineBuffer* pLine);
+bool lineBufferSet(LineBuffer* pLine, const char* data, size_t size);
+void lineBufferClear(LineBuffer* pLine);
+char* lineBufferString(LineBuffer* pLine);
+void lineBufferDestroy(LineBuffer* pLine);
+
+#endif
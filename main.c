@@ -1,26 +1,54 @@
 /******************************************
  *                Includes                *
  ******************************************/
+#define _GNU_SOURCE
 #include <stdint.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <signal.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <pwd.h>
+#include <spawn.h>
 #include <sys/wait.h>
 #include <sys/types.h>
 #include <sys/ioctl.h>
+#include <poll.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
 #include <termios.h>
 #include <linux/limits.h>
 #include <dirent.h>
+#include "arena.h"
 #include "vector.h"
+#include "pathcache.h"
+#include "process.h"
+#include "jobs.h"
+#include "fdcopy.h"
+#include "lexer.h"
+#include "vars.h"
+#include "dircache.h"
+#include "wildcard.h"
+#include "render.h"
+#include "linebuffer.h"
+#include "history.h"
+#include "histsearch.h"
+#include "cmdindex.h"
+#include "dirscan.h"
+#include "match.h"
+#include "prompt.h"
 
 /******************************************
  *                Defines                 *
  ******************************************/
 #define CMD_SIZE 1024
+#define HISTORY_LIMIT 1000000
+#define HISTORY_SIZE 10000
+#define BATCH_READ_SIZE (1 << 16)
 #define PROMPT_MAX _SC_LOGIN_NAME_MAX + PATH_MAX
 #define CLEAR_LINE      "\033[2K"
 #define CLEAR_SCREEN    "\033[2J\033[H"
@@ -28,500 +56,3635 @@
 #define COLOR_RED       "\033[38;5;124m"
 #define COLOR_GREEN     "\033[38;5;40m"
 #define COLOR_BLUE      "\033[38;5;27m"
+#define PASTE_ON        "\033[?2004h"
+#define PASTE_OFF       "\033[?2004l"
+#define PASTE_END       "\033[201~"
+#define KEY_SCAN        -2
+#define KEY_PROMPT      -3
+#define SCAN_WAIT_MS    50
+#define PROMPT_TIMEOUT  500
+#define MORE_TEXT       "--More-- %zu-%zu of %zu, Tab for more\n"
+
+/******************************************
+ *                 Types                  *
+ ******************************************/
+typedef int (*BuiltinFn)(Vector args, int inFd, int outFd);
+
+typedef struct builtin_t {
+    const char* name;
+    BuiltinFn fn;
+    bool pipeSafe;
+} Builtin;
 
 /******************************************
  *      Helper Function Declarations      *
  ******************************************/
-bool getInput(char* buffer, size_t size, Vector history, int pos);
-void tabComplete(char* buffer, size_t size, int* i);
+int runInteractive(void);
+int runScript(const char* fileName);
+int runStream(int fd);
+int runString(const char* data, size_t size);
+size_t runLines(const char* data, size_t size, bool final);
+void executeLine(char* input, size_t size);
+size_t materializeWord(const char* input, Span span, char* out);
+bool applyRedirections(const char* inFile, const char* outFile, bool append);
+bool pushArgument(char*** pArgv, size_t* pSize, size_t* pCapacity, char* arg);
+size_t expandGlob(const char* input, Span span, char*** pArgv, size_t* pSize, size_t* pCapacity);
+const char* expandParameter(const char* name, size_t length, void* ctx);
+bool isAssignment(const char* input, Span span);
+bool setVariable(const char* name, size_t length, const char* value, bool export);
+void reportUsage(ProcStats* stats, int numCmds, double wall, bool timed);
+bool getInput(LineBuffer* line, const History* history);
+void recallHistory(LineBuffer* line, const History* history, size_t index);
+bool searchHistory(LineBuffer* line, const History* history);
+void drawSearch(const History* history, LineBuffer* query, size_t match, bool fuzzy);
+char* historyPath(void);
+void configureHistory(History* history);
+void handleEscapeNumber(LineBuffer* line, int first);
+void drawLine(LineBuffer* line);
+bool readPaste(LineBuffer* line);
+int readEvent(void);
+int readKey(void);
+bool inputPending(void);
+void tabComplete(LineBuffer* line);
+bool inCommandPosition(const char* text, size_t cursor);
+void completeCommand(LineBuffer* line, const char* word, size_t length);
+bool scanDirectory(const char* path, const char* stub, size_t length);
+void finishScan(void);
+void showCompletions(LineBuffer* line, const StringPool* autofill, size_t stubLen);
 size_t printPrompt(void);
+void renderPrompt(void);
+void redrawPrompt(void);
+void onResize(int sig);
+void updateWidth(void);
 Vector tokenizeInput(char* input, size_t size);
-void processTokens(Vector* tokens, int numCmds);
-bool checkBuiltinCmd(Vector* tokens, int numCmds);
+int processTokens(Vector* tokens, int numCmds, ProcStats* stats, const char* command, bool background);
+JobState waitForeground(Job* job, bool resume);
+void giveTerminal(Job* job);
+pid_t launchProcess(char** argv, int inFd, int outFd, pid_t pgid);
+pid_t forkProcess(const char* path, char** argv, int inFd, int outFd, pid_t pgid);
+const Builtin* findBuiltin(Vector args);
+int runBuiltin(const Builtin* builtin, Vector args, int inFd, int outFd, ProcStats* pStats);
+pid_t forkBuiltin(const Builtin* builtin, Vector args, int inFd, int outFd, pid_t pgid);
+bool mayBlock(Vector args, bool shellStdin);
+bool sameFile(int fd, const struct stat* pStat);
+bool writeAll(int fd, const char* buffer, size_t size);
+bool expandEscapes(FILE* stream, const char* string);
+bool formatOnce(FILE* stream, const char* format, Vector args, size_t* pArg);
+int builtinCd(Vector args, int inFd, int outFd);
+int builtinExit(Vector args, int inFd, int outFd);
+int builtinExec(Vector args, int inFd, int outFd);
+int builtinEcho(Vector args, int inFd, int outFd);
+int builtinPrintf(Vector args, int inFd, int outFd);
+int builtinPwd(Vector args, int inFd, int outFd);
+int builtinTrue(Vector args, int inFd, int outFd);
+int builtinFalse(Vector args, int inFd, int outFd);
+int builtinCat(Vector args, int inFd, int outFd);
+int builtinHash(Vector args, int inFd, int outFd);
+int builtinJobs(Vector args, int inFd, int outFd);
+int builtinFg(Vector args, int inFd, int outFd);
+int builtinBg(Vector args, int inFd, int outFd);
+int builtinWait(Vector args, int inFd, int outFd);
+int builtinParallel(Vector args, int inFd, int outFd);
+int builtinExport(Vector args, int inFd, int outFd);
+int builtinUnset(Vector args, int inFd, int outFd);
+Job* startParallelTask(Vector args, size_t cmdStart, size_t cmdEnd, const char* input, int outFd);
+void flushParallelOutput(int fd, int outFd);
 void homeDirSubstitution(char** pInput, size_t size);
-bool checkRedirection(Vector tokens);
-int countPipes(Vector tokens);
+size_t homeDirPrefix(const char* input, size_t size, char* homeDir, size_t homeSize);
 void extractPath(char* input, int inputSize, char** path);
-Vector findAutofillStrings(const char* input, size_t size, const char* path);
-void findLongestCommonPrefix(Vector autofills, char* buffer, size_t size);
+StringPool findAutofillStrings(const char* input, size_t size, const char* path);
+void findLongestCommonPrefix(const StringPool* autofills, char* buffer, size_t size);
 
 struct termios old;
+struct termios raw;
+int lastStatus = 0;
+bool interactive = false;
+int fdIn = -1;
+int fdOut = -1;
+PathCache commandCache;
+JobTable jobTable;
+Arena lineArena;
+VarTable shellVars;
+DirCache dirCache;
+Render lineRender;
+char inputBuffer[BATCH_READ_SIZE];
+size_t inputPos = 0;
+size_t inputLen = 0;
+char promptText[PROMPT_MAX + 256];
+size_t promptWidth = 0;
+volatile sig_atomic_t windowResized = 1;
+StringPool pasteQueue;
+size_t pasteNext = 0;
+bool pastePartial = false;
+bool pasteLineDone = false;
+HistorySearch historyIndex;
+CommandIndex commandIndex;
+DirScan* pendingScan = NULL;
+size_t completionOffset = 0;
+Prompt prompt;
+
+// pipeSafe builtins touch no shell state and may run in-process at any
+// pipeline stage, the rest only run in-process as a command of their own
+const Builtin builtins[] = {
+    {"cd",       builtinCd,       false},
+    {"exit",     builtinExit,     false},
+    {"exec",     builtinExec,     false},
+    {"hash",     builtinHash,     false},
+    {"jobs",     builtinJobs,     false},
+    {"fg",       builtinFg,       false},
+    {"bg",       builtinBg,       false},
+    {"wait",     builtinWait,     false},
+    {"parallel", builtinParallel, false},
+    {"export",   builtinExport,   false},
+    {"unset",    builtinUnset,    false},
+    {"cat",      builtinCat,      true},
+    {"echo",     builtinEcho,     true},
+    {"printf",   builtinPrintf,   true},
+    {"pwd",      builtinPwd,      true},
+    {"true",     builtinTrue,     true},
+    {"false",    builtinFalse,    true},
+    {":",        builtinTrue,     true},
+};
 
 /******************************************
  *              Main Function             *
  ******************************************/
-int main(void)
+int main(int argc, char** argv)
 {
-    struct termios term;
-    tcgetattr(STDIN_FILENO, &old);
-    term = old;
+    commandCache = pathCacheInit(0);
+    jobTable = jobsInit(0);
+    lineArena = arenaInit(0);
+    shellVars = varsInit(0);
+    dirCache = dirCacheInit(0);
+    lineRender = renderInit();
+    pasteQueue = stringPoolInit(0);
+    historyIndex = historySearchInit(0);
+    commandIndex = commandIndexInit();
+    prompt = promptInit();
+    for(size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++)
+        commandIndexAddExtra(&commandIndex, builtins[i].name);
+    varsImport(&shellVars, environ);
+    pathCacheSetPath(&commandCache, varsGet(&shellVars, "PATH", 4));
+    jobsInstallHandler();
+    // Builtins writing to a closed pipe get EPIPE instead of killing the shell
+    signal(SIGPIPE, SIG_IGN);
+    fdIn = dup(STDIN_FILENO);
+    fdOut = dup(STDOUT_FILENO);
+
+    int status;
+    if(argc > 1 && strncmp(argv[1], "-c", sizeof("-c")) == 0) {
+        if(argc < 3) {
+            fprintf(stderr, "%s: -c requires an argument\n", argv[0]);
+            return 2;
+        }
+        status = runString(argv[2], strlen(argv[2]));
+    } else if(argc > 1) {
+        status = runScript(argv[1]);
+    } else if(!isatty(STDIN_FILENO)) {
+        status = runStream(STDIN_FILENO);
+    } else {
+        status = runInteractive();
+    }
 
-    term.c_lflag &= ~(ICANON | ECHO);
-    tcsetattr(STDIN_FILENO, TCSANOW, &term);
+    pathCacheDestroy(&commandCache);
+    jobsDestroy(&jobTable);
+    arenaDestroy(&lineArena);
+    varsDestroy(&shellVars);
+    dirCacheDestroy(&dirCache);
+    renderDestroy(&lineRender);
+    return status;
+}
+
+/******************************************
+ *      Helper Function Definitions       *
+ ******************************************/
 
-    Vector history = vectorInit(128);
+/************************************************
+ * runInteractive:  Put the terminal in raw mode,
+ *                  take ownership of it for job
+ *                  control and read commands
+ *                  from the line editor until
+ *                  EOF
+ *
+ * return:          Exit status of the shell
+ ***********************************************/
+int runInteractive(void)
+{
+    interactive = true;
+
+    // Wait until we are in the foreground before taking the terminal
+    pid_t pgid;
+    while(tcgetpgrp(STDIN_FILENO) != (pgid = getpgrp()))
+        kill(-pgid, SIGTTIN);
+
+    // Keyboard signals go to the foreground job, never the shell
+    signal(SIGINT, SIG_IGN);
+    signal(SIGQUIT, SIG_IGN);
+    signal(SIGTSTP, SIG_IGN);
+    signal(SIGTTIN, SIG_IGN);
+    signal(SIGTTOU, SIG_IGN);
+
+    // Wrapping depends on the width, it is read again before the next draw
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = onResize;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGWINCH, &sa, NULL);
+
+    if(getpid() != pgid && setpgid(0, 0) == -1)
+        perror("setpgid");
+    tcsetpgrp(STDIN_FILENO, getpgrp());
 
-    int fdIn = dup(STDIN_FILENO);
-    int fdOut = dup(STDOUT_FILENO);
+    tcgetattr(STDIN_FILENO, &old);
+    raw = old;
+
+    raw.c_lflag &= ~(ICANON | ECHO);
+    tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+
+    char* histFile = historyPath();
+    History history = historyOpen(histFile, HISTORY_LIMIT);
+    free(histFile);
+    configureHistory(&history);
+    LineBuffer line = lineBufferInit(CMD_SIZE);
+    if(!line.data) {
+        tcsetattr(STDIN_FILENO, TCSANOW, &old);
+        return 1;
+    }
 
     while(1) {
+        fflush(stdout);
+        jobsNotify(&jobTable, STDOUT_FILENO);
         size_t len = printPrompt();
         if(len == 0)
             break;
 
-        char input[CMD_SIZE] = {0};
-        bool done = getInput(input, CMD_SIZE, history, len);
+        lineBufferClear(&line);
+        bool done = getInput(&line, &history);
         if(!done)
             break;
 
-        if(strnlen(input, CMD_SIZE) != 0) {
-            if(history.size == 0 || strncmp(input, history.arr[history.size - 1], strnlen(input, CMD_SIZE)) != 0)
-                vectorInsert(&history, input, strnlen(input, CMD_SIZE));
+        char* input = lineBufferString(&line);
+        size_t inputLength = lineBufferLength(&line);
+        if(input && inputLength != 0) {
+            size_t count = historyCount(&history);
+            size_t lastLength = 0;
+            const char* last = count > 0 ? historyGet(&history, count - 1, &lastLength) : NULL;
+            if(!last || lastLength != inputLength || memcmp(input, last, inputLength) != 0)
+                historyAppend(&history, input, inputLength);
 
-            Vector tokens = tokenizeInput(input, CMD_SIZE);
+            executeLine(input, inputLength + 1);
+        }
 
-            for(size_t i = 0; i < tokens.size; i++)
-                homeDirSubstitution(&tokens.arr[i], strnlen(tokens.arr[i], CMD_SIZE));
+        // Drops the line's argv along with any completion results
+        arenaReset(&lineArena);
+    }
+    printf("\n");
 
-            int numCmds = countPipes(tokens) + 1;
-            bool redir = checkRedirection(tokens);
+    lineBufferDestroy(&line);
+    historySearchDestroy(&historyIndex);
+    commandIndexDestroy(&commandIndex);
+    promptDestroy(&prompt);
+    historyClose(&history);
+    stringPoolDestroy(&pasteQueue);
+    tcsetattr(STDIN_FILENO, TCSANOW, &old);
 
-            Vector commands[numCmds];
-            if(numCmds > 1) {
-                for(int i = 0; i < numCmds; i++) {
-                    commands[i] = vectorInit(0);
-                    if(commands[i].capacity == 0) {
-                        for(int j = 0; j < i; j++)
-                            vectorDestroy(&commands[j]);
+    return lastStatus;
+}
 
-                        vectorDestroy(&tokens);
-                        continue;
-                    }
-                }
+/************************************************
+ * runScript:   Execute every line of a script
+ *              file. The file is mapped rather
+ *              than read so large generated
+ *              scripts are never copied whole
+ *
+ * fileName:    Path of the script
+ *
+ * return:      Status of the last command
+ ***********************************************/
+int runScript(const char* fileName)
+{
+    int fd = open(fileName, O_RDONLY | O_CLOEXEC);
+    if(fd == -1) {
+        perror(fileName);
+        return 127;
+    }
 
-                int idx = 0;
-                for(size_t i = 0; i < tokens.size; i++) {
-                    if(strncmp(tokens.arr[i], "|", 2) == 0) {
-                        idx++;
-                    } else {
+    struct stat st;
+    if(fstat(fd, &st) == -1 || !S_ISREG(st.st_mode)) {
+        int status = runStream(fd);
+        close(fd);
+        return status;
+    }
 
-                        vectorInsert(&commands[idx], tokens.arr[i], strnlen(tokens.arr[i], CMD_SIZE));
-                    }
-                }
-            } else if(numCmds == 1) {
-                commands[0] = vectorInit(0);
-                for(size_t i = 0; i < tokens.size; i++)
-                    vectorInsert(&commands[0], tokens.arr[i], strnlen(tokens.arr[i], CMD_SIZE));
+    if(st.st_size == 0) {
+        close(fd);
+        return 0;
+    }
+
+    char* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED) {
+        perror("mmap");
+        return 1;
+    }
+
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+    int status = runString(data, st.st_size);
+    munmap(data, st.st_size);
+
+    return status;
+}
+
+/************************************************
+ * runStream:   Execute commands read from a
+ *              pipe or other descriptor that
+ *              can't be mapped. Nothing past
+ *              the line being run is kept, so
+ *              commands reading the same input
+ *              see the lines after it. Seekable
+ *              input is read in blocks and the
+ *              offset put back after each line,
+ *              anything else a byte at a time
+ *
+ * fd:          Descriptor to read from
+ *
+ * return:      Status of the last command
+ ***********************************************/
+int runStream(int fd)
+{
+    size_t capacity = BATCH_READ_SIZE;
+    size_t used = 0;
+    char* buffer = malloc(capacity);
+    if(!buffer) {
+        perror("malloc");
+        return 1;
+    }
+
+    bool seekable = lseek(fd, 0, SEEK_CUR) != -1;
+    while(1) {
+        if(capacity - used < BATCH_READ_SIZE / 2) { // Line longer than the buffer
+            char* temp = realloc(buffer, capacity * 2);
+            if(!temp) {
+                perror("realloc");
+                break;
+            }
+            buffer = temp;
+            capacity *= 2;
+        }
+
+        ssize_t n = read(fd, buffer + used, seekable ? capacity - used : 1);
+        if(n == -1 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            break;
+
+        char* nl = memchr(buffer + used, '\n', n);
+        used += n;
+        if(!nl)
+            continue;
+
+        // Hand back what follows the line before anything runs
+        size_t lineEnd = nl - buffer + 1;
+        if(used > lineEnd)
+            lseek(fd, (off_t)lineEnd - (off_t)used, SEEK_CUR);
+
+        runLines(buffer, lineEnd, false);
+        used = 0;
+    }
+
+    runLines(buffer, used, true);
+    free(buffer);
+
+    return lastStatus;
+}
+
+/************************************************
+ * runString:   Execute every line of a buffer
+ *
+ * data:        Commands separated by newlines,
+ *              need not be NUL terminated
+ *
+ * size:        Number of bytes in data
+ *
+ * return:      Status of the last command
+ ***********************************************/
+int runString(const char* data, size_t size)
+{
+    runLines(data, size, true);
+    return lastStatus;
+}
+
+/************************************************
+ * runLines:    Split a buffer into lines and
+ *              execute each one. Blank lines
+ *              and '#' comments are skipped
+ *
+ * data:        Buffer holding the commands
+ *
+ * size:        Number of bytes in data
+ *
+ * final:       Whether a trailing line without
+ *              a newline should be run
+ *
+ * return:      Number of bytes consumed
+ ***********************************************/
+size_t runLines(const char* data, size_t size, bool final)
+{
+    static char* line = NULL;
+    static size_t lineCap = 0;
+
+    size_t pos = 0;
+    while(pos < size) {
+        const char* nl = memchr(data + pos, '\n', size - pos);
+        if(!nl && !final)
+            break;
+
+        size_t len = nl ? (size_t)(nl - (data + pos)) : size - pos;
+        if(len + 1 > lineCap) {
+            char* temp = realloc(line, len + 1);
+            if(!temp) {
+                perror("realloc");
+                return size;
             }
+            line = temp;
+            lineCap = len + 1;
+        }
+
+        memcpy(line, data + pos, len);
+        line[len] = '\0';
+        pos += len + (nl ? 1 : 0);
+
+        size_t skip = strspn(line, " \t");
+        if(line[skip] == '\0' || line[skip] == '#')
+            continue;
+
+        jobsNotify(&jobTable, -1);
+
+        executeLine(line, len + 1);
+        arenaReset(&lineArena);
+    }
+
+    return pos;
+}
+
+/************************************************
+ * executeLine: Lex a command line, split it into
+ *              pipeline stages and run it. Words
+ *              are materialised once, straight
+ *              into the argv of their stage
+ *
+ * input:       NUL terminated command line
+ *
+ * size:        Size of the input buffer
+ ***********************************************/
+void executeLine(char* input, size_t size)
+{
+    // Reused between lines so steady state lexing doesn't allocate
+    static SpanList spans = {0, 0, NULL};
+
+    if(!lexInput(input, strnlen(input, size), &spans)) {
+        fprintf(stderr, "syntax error: unterminated quote\n");
+        lastStatus = 2;
+        return;
+    }
+
+    // A leading "time" reports usage for the rest of the line
+    size_t first = 0, last = spans.size;
+    bool timed = last > 0 && lexEquals(input, spans.spans[0], "time");
+    if(timed)
+        first++;
+
+    // A trailing "&" runs the line as a background job
+    bool background = last > first && spans.spans[last - 1].kind == TOKEN_BACKGROUND;
+    if(background)
+        last--;
+
+    // Blank lines and a bare "time" or "&" have nothing to run
+    if(first >= last)
+        return;
+
+    int numCmds = 1;
+    size_t numWords = 0, wordBytes = 0;
+    bool stageEmpty = true;
+    for(size_t i = first; i < last; i++) {
+        Span span = spans.spans[i];
+        const char* error = NULL;
+
+        if(span.kind == TOKEN_WORD) {
+            stageEmpty = false;
+        } else if(span.kind == TOKEN_PIPE) {
+            if(stageEmpty)
+                error = "|";
+            numCmds++;
+            stageEmpty = true;
+        } else if(span.kind == TOKEN_BACKGROUND) {
+            error = "&";
+        } else if(i + 1 >= last || spans.spans[i + 1].kind != TOKEN_WORD) {
+            error = "newline";
+        } else {
+            span = spans.spans[++i]; // Redirection target
+        }
+
+        if(error) {
+            fprintf(stderr, "syntax error near unexpected token '%s'\n", error);
+            lastStatus = 2;
+            return;
+        }
+
+        if(span.kind == TOKEN_PIPE)
+            continue;
+
+        numWords++;
+        if(span.flags & SPAN_DOLLAR)
+            wordBytes += lexExpand(input, span.offset, span.length, expandParameter, NULL, NULL) + 1;
+        else
+            wordBytes += span.length + 1;
+        if(span.flags & SPAN_TILDE)
+            wordBytes += PATH_MAX;
+    }
+
+    if(stageEmpty && numCmds > 1) {
+        fprintf(stderr, "syntax error near unexpected token '|'\n");
+        lastStatus = 2;
+        return;
+    }
+
+    // Everything below lives until the caller resets lineArena
+    char* words = arenaAlloc(&lineArena, wordBytes);
+    size_t argvCap = numWords + numCmds, argvSize = 0;
+    char** argv = arenaAlloc(&lineArena, argvCap * sizeof(char*));
+    if(!words || !argv) {
+        perror("arenaAlloc");
+        lastStatus = 1;
+        return;
+    }
+
+    size_t stageStart[numCmds + 1];
+    stageStart[0] = 0;
+    char* inFile = NULL;
+    char* outFile = NULL;
+    bool append = false;
+
+    char* out = words;
+    size_t argc = 0, numAssignments = 0;
+    int stage = 0;
+    bool ok = true;
+    for(size_t i = first; i < last && ok; i++) {
+        Span span = spans.spans[i];
+        if(span.kind == TOKEN_PIPE) {
+            ok = pushArgument(&argv, &argvSize, &argvCap, NULL);
+            stageStart[++stage] = argvSize;
+            argc = 0;
+            continue;
+        }
 
-            if(!checkBuiltinCmd(commands, numCmds))
-                processTokens(commands, numCmds);
+        char* word = out;
+        if(span.kind == TOKEN_IN) {
+            inFile = word;
+        } else if(span.kind != TOKEN_WORD) {
+            outFile = word;
+            append = span.kind == TOKEN_APPEND;
+        }
+        if(span.kind != TOKEN_WORD)
+            span = spans.spans[++i];
+
+        size_t len = materializeWord(input, span, out);
+        out += len;
+        *out++ = '\0';
+
+        // An unquoted expansion that comes out empty is not an argument
+        bool dropped = len == 0 && (span.flags & SPAN_DOLLAR) && !(span.flags & SPAN_QUOTED);
+        if(word == inFile || word == outFile || dropped)
+            continue;
+
+        // Unmatched patterns are passed on as they are
+        size_t matched = span.flags & SPAN_GLOB ? expandGlob(input, span, &argv, &argvSize, &argvCap) : 0;
+        if(matched == 0)
+            ok = pushArgument(&argv, &argvSize, &argvCap, word);
+        argc += matched ? matched : 1;
+        numAssignments += !matched && isAssignment(input, span);
+    }
+    ok = ok && pushArgument(&argv, &argvSize, &argvCap, NULL);
+    stageStart[numCmds] = argvSize;
+
+    if(!ok) {
+        perror("arenaAlloc");
+        lastStatus = 1;
+        return;
+    }
+
+    // Each stage is a view into argv backed by the arena
+    Vector commands[numCmds];
+    for(int i = 0; i < numCmds; i++) {
+        size_t count = stageStart[i + 1] - stageStart[i] - 1;
+        commands[i] = (Vector){count, count + 1, argv + stageStart[i], &lineArena};
+    }
+
+    // Command text shown by "jobs"
+    const char* command = NULL;
+    if(last > first) {
+        size_t commandLen = spans.spans[last - 1].offset + spans.spans[last - 1].length - spans.spans[first].offset;
+        command = arenaStrndup(&lineArena, input + spans.spans[first].offset, commandLen);
+    }
+    if(!command)
+        command = "";
+
+    struct timespec lineStart, lineEnd;
+    clock_gettime(CLOCK_MONOTONIC, &lineStart);
+
+    // Builtin output must reach the fd before any child writes to it
+    fflush(stdout);
+
+    // A line of nothing but NAME=value words sets shell variables
+    if(numCmds == 1 && argc > 0 && numAssignments == argc && !inFile && !outFile) {
+        lastStatus = 0;
+        for(size_t i = 0; i < argc; i++) {
+            const char* eq = strchr(argv[i], '=');
+            if(!setVariable(argv[i], eq - argv[i], eq + 1, false))
+                lastStatus = 1;
+        }
+        return;
+    }
+
+    bool redir = inFile || outFile;
+    if(redir && !applyRedirections(inFile, outFile, append)) {
+        lastStatus = 1;
+    } else {
+        ProcStats stats[numCmds];
+        memset(stats, 0, sizeof(stats));
+        if(numWords > 0) // Skip a line of only redirections
+            lastStatus = processTokens(commands, numCmds, stats, command, background);
+
+        fflush(stdout);
+        clock_gettime(CLOCK_MONOTONIC, &lineEnd);
+        if(!background)
+            reportUsage(stats, numCmds, processElapsed(&lineStart, &lineEnd), timed);
+    }
+
+    if(redir) {
+        dup2(fdIn, STDIN_FILENO);
+        dup2(fdOut, STDOUT_FILENO);
+    }
+}
+
+/************************************************
+ * materializeWord: Write the final text of a
+ *                  word span, with a leading
+ *                  unquoted '~' replaced by the
+ *                  home directory and variables
+ *                  expanded
+ *
+ * input:           Command line the span refers
+ *                  to
+ *
+ * span:            Word to materialise
+ *
+ * out:             Buffer with room for the
+ *                  expanded span plus PATH_MAX if
+ *                  it has SPAN_TILDE set
+ *
+ * return:          Number of bytes written, no
+ *                  NUL is added
+ ***********************************************/
+size_t materializeWord(const char* input, Span span, char* out)
+{
+    size_t consumed = 0, written = 0;
+    if(span.flags & SPAN_TILDE) {
+        consumed = homeDirPrefix(input + span.offset, span.length, out, PATH_MAX);
+        written = consumed ? strnlen(out, PATH_MAX) : 0;
+    }
+
+    LexLookup lookup = span.flags & SPAN_DOLLAR ? expandParameter : NULL;
+    return written + lexExpand(input, span.offset + consumed, span.length - consumed, lookup, NULL, out + written);
+}
+
+/************************************************
+ * pushArgument:    Append to an argv array in
+ *                  lineArena, moving it to a
+ *                  bigger one when it is full
+ *
+ * pArgv:           Array to append to
+ *
+ * pSize:           Number of entries in use
+ *
+ * pCapacity:       Number of entries allocated
+ *
+ * arg:             Entry to append, NULL for a
+ *                  stage terminator
+ *
+ * return:          False if out of memory
+ ***********************************************/
+bool pushArgument(char*** pArgv, size_t* pSize, size_t* pCapacity, char* arg)
+{
+    if(*pSize >= *pCapacity) {
+        char** temp = arenaAlloc(&lineArena, *pCapacity * 2 * sizeof(char*));
+        if(!temp)
+            return false;
+
+        memcpy(temp, *pArgv, *pSize * sizeof(char*));
+        *pArgv = temp;
+        *pCapacity *= 2;
+    }
+
+    (*pArgv)[(*pSize)++] = arg;
+    return true;
+}
+
+/************************************************
+ * expandGlob:  Replace a word containing
+ *              unquoted *, ? or [ by the sorted
+ *              paths it matches
+ *
+ * input:       Command line the span refers to
+ *
+ * span:        Word to expand
+ *
+ * pArgv:       Argv array matches are appended
+ *              to
+ *
+ * pSize:       Number of entries in use
+ *
+ * pCapacity:   Number of entries allocated
+ *
+ * return:      Number of matches added, 0 if the
+ *              pattern matched nothing
+ ***********************************************/
+size_t expandGlob(const char* input, Span span, char*** pArgv, size_t* pSize, size_t* pCapacity)
+{
+    static StringPool matches = {0};
+    if(matches.capacity == 0)
+        matches = stringPoolInit(0);
+
+    // Tilde expansion comes first and its result is never a pattern
+    char home[PATH_MAX] = {0};
+    size_t consumed = 0;
+    if(span.flags & SPAN_TILDE)
+        consumed = homeDirPrefix(input + span.offset, span.length, home, PATH_MAX);
+
+    size_t homeLen = strnlen(home, PATH_MAX);
+    size_t patternLen = homeLen * 2 + lexPattern(input, span.offset + consumed, span.length - consumed, expandParameter, NULL, NULL);
+    char* pattern = arenaAlloc(&lineArena, patternLen + 1);
+    if(!pattern)
+        return 0;
+
+    size_t n = 0;
+    for(size_t i = 0; i < homeLen; i++) {
+        if(strchr("*?[\\", home[i]))
+            pattern[n++] = '\\';
+        pattern[n++] = home[i];
+    }
+    n += lexPattern(input, span.offset + consumed, span.length - consumed, expandParameter, NULL, pattern + n);
+    pattern[n] = '\0';
+
+    if(!globHasMeta(pattern, n) || !globExpand(&dirCache, pattern, &matches))
+        return 0;
+
+    for(size_t i = 0; i < matches.size; i++) {
+        char* match = arenaStrndup(&lineArena, stringPoolGet(&matches, i), stringPoolLength(&matches, i));
+        if(!match || !pushArgument(pArgv, pSize, pCapacity, match))
+            return i;
+    }
+
+    return matches.size;
+}
+
+/************************************************
+ * expandParameter: Look up a parameter for
+ *                  lexExpand. Handles $? and $$
+ *                  as well as shell variables
+ *
+ * name:            Parameter name, not NUL
+ *                  terminated
+ *
+ * length:          Number of bytes in name
+ *
+ * ctx:             Unused
+ *
+ * return:          Value, or NULL if unset
+ ***********************************************/
+const char* expandParameter(const char* name, size_t length, void* ctx)
+{
+    (void)ctx;
+
+    static char number[16];
+    if(length == 1 && name[0] == '?') {
+        snprintf(number, sizeof(number), "%d", lastStatus);
+        return number;
+    } else if(length == 1 && name[0] == '$') {
+        snprintf(number, sizeof(number), "%d", (int)getpid());
+        return number;
+    }
+
+    return varsGet(&shellVars, name, length);
+}
+
+/************************************************
+ * isAssignment:    Check whether a word has the
+ *                  form NAME=value, with an
+ *                  unquoted name
+ *
+ * input:           Command line the span refers
+ *                  to
+ *
+ * span:            Word to check
+ *
+ * return:          Whether it is an assignment
+ ***********************************************/
+bool isAssignment(const char* input, Span span)
+{
+    const char* eq = memchr(input + span.offset, '=', span.length);
+    return eq && varsValidName(input + span.offset, eq - (input + span.offset));
+}
+
+/************************************************
+ * setVariable: Set a shell variable, keeping the
+ *              command cache in step with $PATH
+ *
+ * name:        Name, need not be NUL terminated
+ *
+ * length:      Number of bytes in name
+ *
+ * value:       New value
+ *
+ * export:      Pass the variable to children
+ *
+ * return:      Whether the variable was stored
+ ***********************************************/
+bool setVariable(const char* name, size_t length, const char* value, bool export)
+{
+    if(!varsSet(&shellVars, name, length, value, export))
+        return false;
+
+    if(length == 4 && strncmp(name, "PATH", 4) == 0)
+        pathCacheSetPath(&commandCache, value);
+
+    return true;
+}
+
+/************************************************
+ * applyRedirections:   Point the shell's stdin
+ *                      and stdout at files for
+ *                      the duration of a command
+ *                      line
+ *
+ * inFile:              File for stdin, or NULL
+ *
+ * outFile:             File for stdout, or NULL
+ *
+ * append:              Append to outFile rather
+ *                      than truncating it
+ *
+ * return:              False if a file couldn't
+ *                      be opened
+ ***********************************************/
+bool applyRedirections(const char* inFile, const char* outFile, bool append)
+{
+    if(inFile) {
+        int fd = open(inFile, O_RDONLY | O_CLOEXEC);
+        if(fd == -1) {
+            perror(inFile);
+            return false;
+        }
+        dup2(fd, STDIN_FILENO);
+        close(fd);
+    }
+
+    if(outFile) {
+        int fd = open(outFile, O_WRONLY | O_CREAT | O_CLOEXEC | (append ? O_APPEND : O_TRUNC), 0666);
+        if(fd == -1) {
+            perror(outFile);
+            return false;
+        }
+        dup2(fd, STDOUT_FILENO);
+        close(fd);
+    }
+
+    return true;
+}
+
+/************************************************
+ * reportUsage: Print resource usage for the
+ *              stages of a command line when it
+ *              was prefixed with "time", or when
+ *              it ran for longer than $REPORTTIME
+ *              seconds
+ *
+ * stats:       Stages of the command line,
+ *              builtins have no name set
+ *
+ * numCmds:     Number of entries in stats
+ *
+ * wall:        Wall time of the command line
+ *
+ * timed:       Whether "time" was given
+ ***********************************************/
+void reportUsage(ProcStats* stats, int numCmds, double wall, bool timed)
+{
+    if(!timed) {
+        const char* threshold = varsGet(&shellVars, "REPORTTIME", sizeof("REPORTTIME") - 1);
+        if(!threshold || threshold[0] == '\0')
+            return;
+
+        char* end;
+        double limit = strtod(threshold, &end);
+        if(end == threshold || wall < limit)
+            return;
+    }
+
+    // Compact the launched stages to the front
+    int count = 0;
+    for(int i = 0; i < numCmds; i++) {
+        if(stats[i].name)
+            stats[count++] = stats[i];
+    }
+
+    if(count == 0) {
+        fprintf(stderr, "%9.3fs real\n", wall);
+        return;
+    }
+
+    processReport(stderr, stats, count, wall);
+}
+
+/************************************************
+ * getInput: Parse keyboard input one character
+ * at a time. Special characters are handled in
+ * this function. The line is redrawn through
+ * lineRender once per burst of input. Lines
+ * left over from a multi-line paste are
+ * returned before the terminal is read again
+ *
+ * line:    Line being edited, grown as needed
+ *
+ * history: All previously entered commands
+ *
+ * return:  Whether the program should continue
+ *          or not. True continues and processes
+ *          the current line, false ends the
+ *          program
+ ***********************************************/
+bool getInput(LineBuffer* line, const History* history)
+{
+    if(!line)
+        return false;
+
+    if(pasteNext < pasteQueue.size) {
+        if(!lineBufferSet(line, stringPoolGet(&pasteQueue, pasteNext), stringPoolLength(&pasteQueue, pasteNext)))
+            return false;
+
+        // An unterminated tail stays on the line for editing
+        bool partial = pastePartial && pasteNext + 1 == pasteQueue.size;
+        if(++pasteNext == pasteQueue.size) {
+            stringPoolClear(&pasteQueue);
+            pasteNext = 0;
+            pastePartial = false;
+        }
+
+        if(!partial) {
+            drawLine(line);
+            renderAppend(&lineRender, "\n", 1);
+            renderFlush(&lineRender, STDOUT_FILENO);
+            return true;
+        }
+    }
+
+    renderAppend(&lineRender, PASTE_ON, sizeof(PASTE_ON) - 1);
+    drawLine(line);
+    renderFlush(&lineRender, STDOUT_FILENO);
+
+    int c;
+    size_t historyPos = historyCount(history);
+    while((c = readEvent()) != '\n') {
+        size_t cursor = lineBufferCursor(line);
+        size_t length = lineBufferLength(line);
+
+        // Any key but another Tab abandons a scan and restarts paging
+        if(c != KEY_SCAN && c != KEY_PROMPT && c != '\t') {
+            dirScanCancel(pendingScan);
+            pendingScan = NULL;
+            completionOffset = 0;
+        }
+
+        if(c == KEY_SCAN) {
+            if(dirScanPoll(pendingScan)) {
+                finishScan();
+                tabComplete(line);
+            }
+        } else if(c == KEY_PROMPT) {
+            if(promptPoll(&prompt)) {
+                // The line may have wrapped below the prompt's row
+                renderHome(&lineRender);
+                renderPrompt();
+                redrawPrompt();
+            }
+        } else if(c == -1 || (c == 0x4 && length == 0)) { // EOF
+            renderAppend(&lineRender, PASTE_OFF, sizeof(PASTE_OFF) - 1);
+            renderFlush(&lineRender, STDOUT_FILENO);
+            return false;
+        } else if(c == '\t') {
+            tabComplete(line);
+        } else if(c == 0x1b) {
+            c = readKey();
+            if(c == 'b') { // Alt-B
+                lineBufferMove(line, lineBufferWordLeft(line));
+            } else if(c == 'f') { // Alt-F
+                lineBufferMove(line, lineBufferWordRight(line));
+            } else if(c == 'd') { // Alt-D
+                lineBufferKill(line, cursor, lineBufferWordRight(line));
+            } else if(c == 'O') {
+                c = readKey();
+                if(c == 'H')
+                    lineBufferMove(line, 0);
+                else if(c == 'F')
+                    lineBufferMove(line, length);
+            } else if(c == 0x5b) {
+                c = readKey();
+                if(c == 'A') { // Up Arrow
+                    size_t previous = historyPrevious(history, historyPos);
+                    if(previous == HISTORY_NONE)
+                        continue;
+
+                    historyPos = previous;
+                    recallHistory(line, history, historyPos);
+                } else if(c == 'B') { // Down Arrow
+                    if(historyPos == historyCount(history))
+                        continue;
+
+                    historyPos = historyNext(history, historyPos);
+                    if(historyPos == historyCount(history))
+                        lineBufferClear(line);
+                    else
+                        recallHistory(line, history, historyPos);
+                } else if(c == 'C') { // Right Arrow
+                    lineBufferMove(line, lineBufferCharRight(line));
+                } else if(c == 'D') { // Left Arrow
+                    lineBufferMove(line, lineBufferCharLeft(line));
+                } else if(c == 'H') { // Home
+                    lineBufferMove(line, 0);
+                } else if(c == 'F') { // End
+                    lineBufferMove(line, length);
+                } else if(c >= '0' && c <= '9') {
+                    handleEscapeNumber(line, c);
+                }
+            }
+        } else if(c == 0x1) { // Ctrl-A
+            lineBufferMove(line, 0);
+        } else if(c == 0x5) { // Ctrl-E
+            lineBufferMove(line, length);
+        } else if(c == 0x2) { // Ctrl-B
+            lineBufferMove(line, lineBufferCharLeft(line));
+        } else if(c == 0x6) { // Ctrl-F
+            lineBufferMove(line, lineBufferCharRight(line));
+        } else if(c == 0x4) { // Ctrl-D
+            lineBufferDelete(line, 0, lineBufferCharRight(line) - cursor);
+        } else if(c == 0xb) { // Ctrl-K
+            lineBufferKill(line, cursor, length);
+        } else if(c == 0x15) { // Ctrl-U
+            lineBufferKill(line, 0, cursor);
+        } else if(c == 0x17) { // Ctrl-W
+            lineBufferKill(line, lineBufferWordLeft(line), cursor);
+        } else if(c == 0x19) { // Ctrl-Y
+            lineBufferYank(line);
+        } else if(c == 0x12) { // Ctrl-R
+            if(searchHistory(line, history))
+                break;
+        } else if(c == 0xc) { // Ctrl-L
+            renderAppend(&lineRender, CLEAR_SCREEN, sizeof(CLEAR_SCREEN) - 1);
+            redrawPrompt();
+        } else if(c == 0x7f || c == 0x8) { // Backspace
+            lineBufferDelete(line, cursor - lineBufferCharLeft(line), 0);
+        } else if(c >= 0x20) { // Normal character
+            char ch = c;
+            lineBufferInsert(line, &ch, 1);
+        }
+
+        if(pasteLineDone)
+            break;
+
+        // Typed-ahead keys are applied before anything is drawn
+        if(!inputPending()) {
+            drawLine(line);
+            renderFlush(&lineRender, STDOUT_FILENO);
+        }
+    }
+
+    dirScanCancel(pendingScan);
+    pendingScan = NULL;
+    completionOffset = 0;
+    pasteLineDone = false;
+    lineBufferMove(line, lineBufferLength(line));
+    drawLine(line);
+    renderAppend(&lineRender, PASTE_OFF "\n", sizeof(PASTE_OFF));
+    renderFlush(&lineRender, STDOUT_FILENO);
+    return true;
+}
+
+/************************************************
+ * recallHistory:   Replace the line with an entry
+ *                  from history
+ *
+ * line:            Line being edited
+ *
+ * history:         History to read
+ *
+ * index:           Entry to recall, oldest first
+ ***********************************************/
+void recallHistory(LineBuffer* line, const History* history, size_t index)
+{
+    size_t length = 0;
+    const char* entry = historyGet(history, index, &length);
+    if(entry)
+        lineBufferSet(line, entry, length);
+}
+
+/************************************************
+ * searchHistory:   Reverse incremental search
+ *                  through history. The match is
+ *                  refreshed on every keystroke.
+ *                  Ctrl-R steps to an older match,
+ *                  Ctrl-T switches between
+ *                  substring and fuzzy matching
+ *                  and Ctrl-G gives up. Any other
+ *                  control key keeps the match for
+ *                  editing
+ *
+ * line:            Line being edited, replaced by
+ *                  the accepted match
+ *
+ * history:         History to search
+ *
+ * return:          Whether Enter accepted the
+ *                  match, so it should run now
+ ***********************************************/
+bool searchHistory(LineBuffer* line, const History* history)
+{
+    LineBuffer query = lineBufferInit(0);
+    if(!query.data)
+        return false;
+
+    bool fuzzy = false;
+    bool run = false;
+    bool cancel = false;
+    size_t match = SEARCH_NONE;
+    drawSearch(history, &query, match, fuzzy);
+    renderFlush(&lineRender, STDOUT_FILENO);
+
+    int c;
+    while((c = readKey()) != -1) {
+        size_t from = historyCount(history);
+        if(c == 0x12) { // Ctrl-R
+            if(match == SEARCH_NONE)
+                continue;
+            from = match;
+        } else if(c == 0x14) { // Ctrl-T
+            fuzzy = !fuzzy;
+        } else if(c == 0x7f || c == 0x8) { // Backspace
+            lineBufferDelete(&query, lineBufferCursor(&query) - lineBufferCharLeft(&query), 0);
+        } else if(c == 0x7) { // Ctrl-G
+            cancel = true;
+            break;
+        } else if(c == '\n' || c == '\r') {
+            run = true;
+            break;
+        } else if(c == 0x1b) {
+            // Arrows and other sequences end the search, their tail is dropped
+            while(inputPending() && (c = readKey()) != -1 && !((c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z') || c == '~'));
+            break;
+        } else if(c < 0x20) {
+            break;
+        } else {
+            // A longer query can still match the current entry
+            char ch = c;
+            lineBufferInsert(&query, &ch, 1);
+            if(match != SEARCH_NONE)
+                from = match + 1;
+        }
+
+        match = historySearch(&historyIndex, history, lineBufferString(&query), lineBufferLength(&query), fuzzy, from);
+        if(!inputPending()) {
+            drawSearch(history, &query, match, fuzzy);
+            renderFlush(&lineRender, STDOUT_FILENO);
+        }
+    }
+
+    if(!cancel && match != SEARCH_NONE)
+        recallHistory(line, history, match);
+
+    lineBufferDestroy(&query);
+    return run;
+}
+
+/************************************************
+ * drawSearch:  Queue the search line in place of
+ *              the input line
+ *
+ * history:     History being searched
+ *
+ * query:       Text typed so far
+ *
+ * match:       Index of the shown match, or
+ *              SEARCH_NONE
+ *
+ * fuzzy:       Whether fuzzy matching is on
+ ***********************************************/
+void drawSearch(const History* history, LineBuffer* query, size_t match, bool fuzzy)
+{
+    updateWidth();
+
+    const char* label = fuzzy ? "(fuzzy-search)`" : "(reverse-i-search)`";
+    if(match == SEARCH_NONE && lineBufferLength(query) > 0)
+        label = fuzzy ? "(failed fuzzy-search)`" : "(failed reverse-i-search)`";
+
+    size_t matchLength = 0;
+    const char* text = match != SEARCH_NONE ? historyGet(history, match, &matchLength) : "";
+    const char* queryText = lineBufferString(query);
+    if(!text || !queryText)
+        return;
+
+    size_t labelLength = strlen(label);
+    size_t queryLength = lineBufferLength(query);
+    size_t size = labelLength + queryLength + 3 + matchLength;
+    char* out = malloc(size);
+    if(!out) {
+        perror("malloc");
+        return;
+    }
+
+    memcpy(out, label, labelLength);
+    memcpy(out + labelLength, queryText, queryLength);
+    memcpy(out + labelLength + queryLength, "': ", 3);
+    memcpy(out + labelLength + queryLength + 3, text, matchLength);
+
+    renderLine(&lineRender, out, size, labelLength + queryLength);
+    free(out);
+}
+
+/************************************************
+ * handleEscapeNumber:  Finish a CSI sequence that
+ *                      starts with a digit, such as
+ *                      Home, End, Delete, a word
+ *                      motion or a bracketed paste
+ *
+ * line:                Line being edited
+ *
+ * first:               First digit of the sequence
+ ***********************************************/
+void handleEscapeNumber(LineBuffer* line, int first)
+{
+    char params[16] = {first};
+    size_t size = 1;
+
+    int c;
+    while((c = readKey()) != -1 && ((c >= '0' && c <= '9') || c == ';')) {
+        if(size < sizeof(params) - 1)
+            params[size++] = c;
+    }
+
+    if(c == '~') {
+        if(strcmp(params, "1") == 0 || strcmp(params, "7") == 0) { // Home
+            lineBufferMove(line, 0);
+        } else if(strcmp(params, "4") == 0 || strcmp(params, "8") == 0) { // End
+            lineBufferMove(line, lineBufferLength(line));
+        } else if(strcmp(params, "3") == 0) { // Delete
+            lineBufferDelete(line, 0, lineBufferCharRight(line) - lineBufferCursor(line));
+        } else if(strcmp(params, "200") == 0) { // Paste start
+            pasteLineDone = readPaste(line);
+        }
+    } else if(strcmp(params, "1;5") == 0 || strcmp(params, "1;3") == 0) {
+        if(c == 'D') // Ctrl/Alt-Left
+            lineBufferMove(line, lineBufferWordLeft(line));
+        else if(c == 'C') // Ctrl/Alt-Right
+            lineBufferMove(line, lineBufferWordRight(line));
+    }
+}
+
+/************************************************
+ * drawLine:    Queue a redraw of the line being
+ *              edited, leaving the cursor where
+ *              the line's cursor is. While a
+ *              completion scan runs its progress
+ *              follows the text
+ *
+ * line:        Line being edited
+ ***********************************************/
+void drawLine(LineBuffer* line)
+{
+    updateWidth();
+    const char* text = lineBufferString(line);
+    if(!text)
+        return;
+
+    size_t length = lineBufferLength(line);
+    if(!pendingScan) {
+        renderLine(&lineRender, text, length, lineBufferCursor(line));
+        return;
+    }
+
+    char hint[64];
+    int hintLen = snprintf(hint, sizeof(hint), "  [scanning: %zu matches]", atomic_load(&pendingScan->matches));
+    char* shown = malloc(length + hintLen);
+    if(!shown) {
+        renderLine(&lineRender, text, length, lineBufferCursor(line));
+        return;
+    }
+
+    memcpy(shown, text, length);
+    memcpy(shown + length, hint, hintLen);
+    renderLine(&lineRender, shown, length + hintLen, lineBufferCursor(line));
+    free(shown);
+}
+
+/************************************************
+ * readPaste:   Consume a bracketed paste. Text up
+ *              to the first newline is inserted
+ *              at the cursor as one block, every
+ *              later line is queued in pasteQueue
+ *              to run as its own command
+ *
+ * line:        Line being edited
+ *
+ * return:      Whether the paste ended the
+ *              current line
+ ***********************************************/
+bool readPaste(LineBuffer* line)
+{
+    static const char end[] = PASTE_END;
+
+    bool lineDone = false;
+    char* text = NULL;
+    size_t textSize = 0;
+    size_t textCapacity = 0;
+
+    int c;
+    while((c = readKey()) != -1) {
+        char pending[sizeof(end)];
+        size_t pendingSize = 0;
+        if(c == 0x1b) {
+            // Anything short of the full terminator is pasted text
+            pending[pendingSize++] = c;
+            while(pendingSize < sizeof(end) - 1 && (c = readKey()) == end[pendingSize])
+                pending[pendingSize++] = c;
+            if(pendingSize == sizeof(end) - 1)
+                break;
+            if(c == -1)
+                break;
+            pending[pendingSize++] = c;
+        } else {
+            pending[pendingSize++] = c;
+        }
+
+        for(size_t k = 0; k < pendingSize; k++) {
+            char ch = pending[k];
+            if(ch == '\r' || ch == '\n') {
+                if(!lineDone)
+                    lineBufferInsert(line, text, textSize);
+                else if(!stringPoolInsert(&pasteQueue, text ? text : "", textSize))
+                    perror("stringPoolInsert");
+                lineDone = true;
+                textSize = 0;
+                continue;
+            }
+
+            if(textSize == textCapacity) {
+                size_t capacity = textCapacity ? textCapacity * 2 : CMD_SIZE;
+                char* temp = realloc(text, capacity);
+                if(!temp) {
+                    perror("realloc");
+                    continue;
+                }
+                text = temp;
+                textCapacity = capacity;
+            }
+            text[textSize++] = ch;
+        }
+    }
+
+    if(!lineDone) {
+        lineBufferInsert(line, text, textSize);
+    } else if(textSize > 0) {
+        if(stringPoolInsert(&pasteQueue, text, textSize))
+            pastePartial = true;
+        else
+            perror("stringPoolInsert");
+    }
+
+    free(text);
+    return lineDone;
+}
+
+/************************************************
+ * readEvent:   Get the next key for the editor,
+ *              waking early when background work
+ *              has news and no key is waiting
+ *
+ * return:      The byte, -1 on EOF or error,
+ *              KEY_SCAN when a completion scan
+ *              progressed or KEY_PROMPT when a
+ *              prompt segment is ready
+ ***********************************************/
+int readEvent(void)
+{
+    int promptEvents = promptFd(&prompt);
+    if(inputPos >= inputLen && (pendingScan || promptEvents != -1)) {
+        struct pollfd fds[3] = {{STDIN_FILENO, POLLIN, 0}};
+        nfds_t numFds = 1;
+        nfds_t scanIndex = 0;
+        nfds_t promptIndex = 0;
+        if(pendingScan) {
+            scanIndex = numFds;
+            fds[numFds++] = (struct pollfd){dirScanFd(pendingScan), POLLIN, 0};
+        }
+        if(promptEvents != -1) {
+            promptIndex = numFds;
+            fds[numFds++] = (struct pollfd){promptEvents, POLLIN, 0};
+        }
+
+        int ret;
+        do {
+            ret = poll(fds, numFds, -1);
+        } while(ret == -1 && errno == EINTR);
+
+        if(ret > 0 && fds[0].revents == 0) {
+            if(scanIndex != 0 && fds[scanIndex].revents != 0)
+                return KEY_SCAN;
+            if(promptIndex != 0 && fds[promptIndex].revents != 0)
+                return KEY_PROMPT;
+        }
+    }
+
+    return readKey();
+}
+
+/************************************************
+ * readKey: Get the next byte of terminal input,
+ *          reading everything that is available
+ *          whenever the buffer runs dry
+ *
+ * return:  The byte, or -1 on EOF or error
+ ***********************************************/
+int readKey(void)
+{
+    if(inputPos >= inputLen) {
+        ssize_t n;
+        do {
+            n = read(STDIN_FILENO, inputBuffer, sizeof(inputBuffer));
+        } while(n == -1 && errno == EINTR);
+
+        if(n <= 0)
+            return -1;
+
+        inputPos = 0;
+        inputLen = n;
+    }
+
+    return (unsigned char)inputBuffer[inputPos++];
+}
+
+bool inputPending(void)
+{
+    return inputPos < inputLen;
+}
+
+/************************************************
+ * tabComplete: Search the current directory, or
+ *              a given path, for a match to a
+ *              partially typed file/directory
+ *              ending at the cursor. The first
+ *              word of a command is completed
+ *              from $PATH and the builtins.
+ *              A directory that isn't cached is
+ *              read in the background if it takes
+ *              longer than SCAN_WAIT_MS, and the
+ *              completion finishes when it's done
+ *
+ * line:        Line being edited. The completion
+ *              is inserted at the cursor
+ ***********************************************/
+void tabComplete(LineBuffer* line)
+{
+    size_t cursor = lineBufferCursor(line);
+    if(pendingScan || cursor == 0 || isspace((unsigned char)lineBufferAt(line, cursor - 1)))
+        return;
+
+    // Only the word under the cursor is completed, the rest is left as typed
+    char* text = lineBufferString(line);
+    if(!text)
+        return;
+
+    Vector toks = tokenizeInput(text, cursor);
+    if(toks.size == 0)
+        return;
+
+    char* pathStr = toks.arr[toks.size - 1];
+    size_t pathLen = strlen(pathStr);
+    if(!strchr(pathStr, '/') && inCommandPosition(text, cursor)) {
+        completeCommand(line, pathStr, pathLen);
+        return;
+    }
+
+    char* path = calloc(PATH_MAX, sizeof(char));
+    if(!path)
+        return;
+
+    extractPath(pathStr, pathLen, &path);
+
+    char stub[PATH_MAX] = {0};
+    int j = pathLen - 1;
+    for(; j >= 0; j--) {
+        if(pathStr[j] == '/')
+            break;
+    }
+
+    strlcpy(stub, pathStr + j + 1, PATH_MAX);
+    size_t stubLen = strnlen(stub, PATH_MAX);
+    if(stubLen > 0 && !dirCacheFresh(&dirCache, path) && scanDirectory(path, stub, stubLen)) {
+        free(path);
+        return;
+    }
+
+    StringPool autofill = findAutofillStrings(stub, stubLen, path);
+
+    if(autofill.size == 1) {
+        // A fuzzy match replaces what was typed instead of extending it
+        const char* match = stringPoolGet(&autofill, 0);
+        size_t matchLen = stringPoolLength(&autofill, 0);
+        if(matchLen >= stubLen && strncmp(match, stub, stubLen) == 0) {
+            lineBufferInsert(line, match + stubLen, matchLen - stubLen);
+        } else {
+            lineBufferDelete(line, stubLen, 0);
+            lineBufferInsert(line, match, matchLen);
+        }
+    } else if(autofill.size > 1) {
+        showCompletions(line, &autofill, stubLen);
+    }
+
+    free(path);
+    stringPoolDestroy(&autofill);
+}
+
+/************************************************
+ * scanDirectory:   Read a directory on a worker
+ *                  thread, giving it SCAN_WAIT_MS
+ *                  to finish before the editor
+ *                  moves on and leaves it in
+ *                  pendingScan
+ *
+ * path:            Directory to read
+ *
+ * stub:            Name being completed
+ *
+ * length:          Length of stub
+ *
+ * return:          Whether the scan is still
+ *                  running. False once its listing
+ *                  is cached or it failed to start
+ ***********************************************/
+bool scanDirectory(const char* path, const char* stub, size_t length)
+{
+    pendingScan = dirScanStart(path, stub, length);
+    if(!pendingScan)
+        return false;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while(!dirScanPoll(pendingScan)) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long elapsed = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+        if(elapsed >= SCAN_WAIT_MS)
+            return true;
+
+        struct pollfd pfd = {dirScanFd(pendingScan), POLLIN, 0};
+        if(poll(&pfd, 1, SCAN_WAIT_MS - elapsed) == 0)
+            return true;
+    }
+
+    finishScan();
+    return false;
+}
+
+/************************************************
+ * finishScan:  Cache the listing of the finished
+ *              pendingScan, so completion and glob
+ *              expansion find it without reading
+ ***********************************************/
+void finishScan(void)
+{
+    DirListing listing;
+    if(dirScanTake(pendingScan, &listing))
+        dirCacheAdopt(&dirCache, &listing);
+
+    dirScanCancel(pendingScan);
+    pendingScan = NULL;
+}
+
+/************************************************
+ * inCommandPosition:   Check whether the word
+ *                      ending at the cursor names
+ *                      a command, meaning it starts
+ *                      the line or follows a | or &
+ *
+ * text:                Line being edited
+ *
+ * cursor:              End of the word
+ *
+ * return:              Whether it is a command
+ ***********************************************/
+bool inCommandPosition(const char* text, size_t cursor)
+{
+    SpanList spans = spanListInit(0);
+    lexInput(text, cursor, &spans);
+
+    bool command = false;
+    if(spans.size > 0 && spans.spans[spans.size - 1].kind == TOKEN_WORD) {
+        command = spans.size == 1 || spans.spans[spans.size - 2].kind == TOKEN_PIPE
+            || spans.spans[spans.size - 2].kind == TOKEN_BACKGROUND;
+    }
+
+    spanListDestroy(&spans);
+    return command;
+}
+
+/************************************************
+ * completeCommand: Complete a command name from
+ *                  the executables on $PATH and
+ *                  the builtins
+ *
+ * line:            Line being edited
+ *
+ * word:            Command typed so far
+ *
+ * length:          Length of word
+ ***********************************************/
+void completeCommand(LineBuffer* line, const char* word, size_t length)
+{
+    size_t first = 0;
+    size_t last = 0;
+    const char* pathVar = varsGet(&shellVars, "PATH", 4);
+    if(!commandIndexPrefix(&commandIndex, pathVar, word, length, &first, &last) || first == last)
+        return;
+
+    if(last - first == 1) {
+        size_t nameLen;
+        const char* name = commandIndexGet(&commandIndex, first, &nameLen);
+        lineBufferInsert(line, name + length, nameLen - length);
+        lineBufferInsert(line, " ", 1);
+        return;
+    }
+
+    StringPool autofill = stringPoolInit(last - first);
+    for(size_t i = first; i < last; i++) {
+        size_t nameLen;
+        const char* name = commandIndexGet(&commandIndex, i, &nameLen);
+        stringPoolInsert(&autofill, name, nameLen);
+    }
+
+    showCompletions(line, &autofill, length);
+    stringPoolDestroy(&autofill);
+}
+
+/************************************************
+ * showCompletions: List several matches below the
+ *                  line in columns and extend the
+ *                  word at the cursor by their
+ *                  longest common prefix, if it
+ *                  starts with the word. A list
+ *                  taller than the terminal is
+ *                  shown a page per Tab
+ *
+ * line:            Line being edited
+ *
+ * autofill:        Sorted matches
+ *
+ * stubLen:         How much of each match is
+ *                  already typed
+ ***********************************************/
+void showCompletions(LineBuffer* line, const StringPool* autofill, size_t stubLen)
+{
+    static const char spaces[] = "                                ";
+
+    size_t cursor = lineBufferCursor(line);
+    lineBufferMove(line, lineBufferLength(line));
+    drawLine(line);
+    lineBufferMove(line, cursor);
+    renderAppend(&lineRender, "\n", 1);
+
+    size_t width = 80;
+    size_t height = 24;
+    struct winsize ws;
+    if(ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0 && ws.ws_row > 0) {
+        width = ws.ws_col;
+        height = ws.ws_row;
+    }
+
+    size_t longest = 0;
+    for(size_t j = 0; j < autofill->size; j++) {
+        if(stringPoolLength(autofill, j) > longest)
+            longest = stringPoolLength(autofill, j);
+    }
+
+    // Column-major like ls, with a line kept for --More-- and the prompt
+    size_t columnWidth = longest + 2;
+    size_t columns = columnWidth < width ? width / columnWidth : 1;
+    size_t pageSize = columns * (height > 3 ? height - 2 : 1);
+    if(completionOffset >= autofill->size)
+        completionOffset = 0;
+
+    size_t first = completionOffset;
+    size_t count = autofill->size - first < pageSize ? autofill->size - first : pageSize;
+    size_t rows = (count + columns - 1) / columns;
+    for(size_t r = 0; r < rows; r++) {
+        for(size_t c = 0; c < columns && c * rows + r < count; c++) {
+            size_t j = first + c * rows + r;
+            size_t nameLen = stringPoolLength(autofill, j);
+            renderAppend(&lineRender, stringPoolGet(autofill, j), nameLen);
+            if(c + 1 < columns && (c + 1) * rows + r < count) {
+                for(size_t pad = columnWidth - nameLen; pad > 0;) {
+                    size_t n = pad < sizeof(spaces) - 1 ? pad : sizeof(spaces) - 1;
+                    renderAppend(&lineRender, spaces, n);
+                    pad -= n;
+                }
+            }
+        }
+        renderAppend(&lineRender, "\n", 1);
+    }
+
+    completionOffset = 0;
+    if(first + count < autofill->size) {
+        char more[128];
+        int moreLen = snprintf(more, sizeof(more), MORE_TEXT, first + 1, first + count, autofill->size);
+        renderAppend(&lineRender, more, moreLen);
+        completionOffset = first + count;
+    }
+
+    char lcp[FILENAME_MAX] = {0};
+    findLongestCommonPrefix(autofill, lcp, FILENAME_MAX);
+    size_t lcpLen = strnlen(lcp, FILENAME_MAX);
+    bool extends = lcpLen > stubLen && cursor >= stubLen;
+    for(size_t k = 0; extends && k < stubLen; k++)
+        extends = lineBufferAt(line, cursor - stubLen + k) == lcp[k];
+    if(extends)
+        lineBufferInsert(line, lcp + stubLen, lcpLen - stubLen);
+
+    redrawPrompt();
+}
+
+/************************************************
+ * printPrompt: Create a prompt from the cached
+ *              segments chosen by $PROMPT_SEGMENTS
+ *              and start refreshing the ones that
+ *              are computed in the background
+ *
+ * return:      Length of the prompt
+ ***********************************************/
+size_t printPrompt(void)
+{
+    const char* spec = varsGet(&shellVars, "PROMPT_SEGMENTS", 15);
+    if(!promptUpdate(&prompt, varsGet(&shellVars, "HOME", 4), spec))
+        return 0;
+
+    // Started now and drawn when ready, git never holds up the prompt
+    if(prompt.useGit) {
+        const char* timeout = varsGet(&shellVars, "PROMPT_TIMEOUT", 14);
+        int ms = timeout ? atoi(timeout) : 0;
+        promptRefresh(&prompt, pathCacheLookup(&commandCache, "git"), varsEnviron(&shellVars), ms > 0 ? ms : PROMPT_TIMEOUT);
+    }
+
+    renderPrompt();
+    redrawPrompt();
+    return promptWidth;
+}
+
+/************************************************
+ * renderPrompt:    Rebuild promptText from the
+ *                  cached segments, so redraws
+ *                  don't repeat the lookups
+ ***********************************************/
+void renderPrompt(void)
+{
+    static const char start[] = CLEAR_LINE "\033[G";
+
+    memcpy(promptText, start, sizeof(start));
+    promptWidth = promptRender(&prompt, lastStatus, jobTable.size, promptText + sizeof(start) - 1, sizeof(promptText) - sizeof(start) + 1);
+}
+
+/************************************************
+ * redrawPrompt:    Queue the prompt built by the
+ *                  last printPrompt on lineRender
+ *                  and start an empty input line
+ ***********************************************/
+void redrawPrompt(void)
+{
+    updateWidth();
+    renderAppend(&lineRender, promptText, strnlen(promptText, sizeof(promptText)));
+    renderReset(&lineRender, promptWidth);
+}
+
+void onResize(int sig)
+{
+    (void)sig;
+    windowResized = 1;
+}
+
+/************************************************
+ * updateWidth: Pass the terminal width on to
+ *              lineRender if it may have changed
+ *              since the last draw
+ ***********************************************/
+void updateWidth(void)
+{
+    if(!windowResized)
+        return;
+
+    windowResized = 0;
+    struct winsize ws;
+    if(ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0)
+        renderResize(&lineRender, ws.ws_col);
+}
+
+/************************************************
+ * historyPath: Find the history file, $HISTFILE
+ *              or ~/.shell_history
+ *
+ * return:      Allocated path, NULL if there is
+ *              nowhere to keep history
+ ***********************************************/
+char* historyPath(void)
+{
+    const char* histFile = varsGet(&shellVars, "HISTFILE", 8);
+    if(histFile && histFile[0] != '\0')
+        return strdup(histFile);
+
+    const char* homeDir = varsGet(&shellVars, "HOME", 4);
+    if(!homeDir || homeDir[0] == '\0')
+        return NULL;
+
+    char* path = NULL;
+    if(asprintf(&path, "%s/.shell_history", homeDir) == -1)
+        return NULL;
+
+    return path;
+}
+
+/************************************************
+ * configureHistory:    Apply $HISTSIZE, the number
+ *                      of lines kept visible, and
+ *                      $HISTCONTROL. erasedups
+ *                      hides older copies of a line
+ *
+ * history:             History to configure
+ ***********************************************/
+void configureHistory(History* history)
+{
+    size_t size = HISTORY_SIZE;
+    const char* histSize = varsGet(&shellVars, "HISTSIZE", 8);
+    if(histSize && histSize[0] != '\0') {
+        char* end = NULL;
+        unsigned long long value = strtoull(histSize, &end, 10);
+        if(*end == '\0' && value > 0 && histSize[0] != '-')
+            size = value;
+    }
+
+    const char* histControl = varsGet(&shellVars, "HISTCONTROL", 11);
+    bool eraseDups = histControl && strstr(histControl, "erasedups") != NULL;
+    historyConfigure(history, size, eraseDups);
+}
+
+/************************************************
+ * tokenizeInput:   Split the input buffer into
+ *                  tokens with the same rules as
+ *                  command execution. Quotes are
+ *                  removed and an unterminated
+ *                  quote runs to the end
+ *
+ * input:           Buffer containing input
+ *                  string
+ *
+ * size:            Size of input string
+ *
+ * return:          A vector containing input
+ *                  tokens, backed by lineArena
+ ***********************************************/
+Vector tokenizeInput(char* input, size_t size)
+{
+    if(!input)
+        return (Vector){0, 0, 0, NULL};
+
+    Vector tokens = vectorInitArena(0, &lineArena);
+    SpanList spans = spanListInit(0);
+    lexInput(input, strnlen(input, size), &spans);
+
+    for(size_t i = 0; i < spans.size; i++) {
+        Span span = spans.spans[i];
+        char word[span.length + 1];
+        size_t len = span.length;
+        if(span.kind == TOKEN_WORD)
+            len = lexUnquote(input, span.offset, span.length, word);
+        else
+            memcpy(word, input + span.offset, len);
+
+        vectorInsert(&tokens, word, len);
+    }
+
+    spanListDestroy(&spans);
+    return tokens;
+}
+
+/************************************************
+ * processTokens:   Run a pipeline. Every
+ *                  pipe is created up front and
+ *                  all stages are started before
+ *                  any of them are reaped, so the
+ *                  pipeline streams concurrently.
+ *                  The stages share one process
+ *                  group and are tracked as a job.
+ *                  A builtin in the last stage, or
+ *                  a pipe safe builtin anywhere,
+ *                  runs in the shell itself after
+ *                  the other stages have started.
+ *                  Any other builtin stage is
+ *                  forked
+ *
+ * tokens:          Array of vectors holding the
+ *                  tokenized user input
+ *
+ * numCmds:         Number of commands entered
+ *
+ * stats:           Array of numCmds entries which
+ *                  receives the exit status and
+ *                  resource usage of each stage
+ *
+ * command:         Command line shown by "jobs"
+ *
+ * background:      Return without waiting for the
+ *                  pipeline to finish
+ *
+ * return:          Exit status of the last stage
+ ***********************************************/
+int processTokens(Vector* tokens, int numCmds, ProcStats* stats, const char* command, bool background)
+{
+    if(numCmds <= 0)
+        return 0;
+
+    const Builtin* stageBuiltins[numCmds];
+    for(int i = 0; i < numCmds; i++)
+        stageBuiltins[i] = findBuiltin(tokens[i]);
+
+    // A lone builtin needs no job and no pipes
+    if(numCmds == 1 && stageBuiltins[0] && !background && !mayBlock(tokens[0], true))
+        return runBuiltin(stageBuiltins[0], tokens[0], STDIN_FILENO, STDOUT_FILENO, &stats[0]);
+
+    Job* job = jobsAdd(&jobTable, command, numCmds);
+    if(!job) {
+        printf("Unable to create job\n");
+        return 1;
+    }
+
+    // fds[2*i] is read by stage i+1, fds[2*i+1] is written by stage i.
+    // Close on exec keeps every child from holding the other stages' ends
+    int fds[2 * numCmds];
+    for(int i = 0; i < 2 * numCmds; i++)
+        fds[i] = -1;
+
+    for(int i = 0; i < numCmds - 1; i++) {
+        if(pipe2(fds + 2 * i, O_CLOEXEC)) {
+            perror("pipe");
+            for(int j = 0; j < 2 * i; j++)
+                close(fds[j]);
+            jobsRemove(&jobTable, job);
+            return 1;
+        }
+    }
+
+    // Background jobs never run in the shell, it would block the prompt
+    int inProcess = -1;
+    for(int i = numCmds - 1; i >= 0 && !background && inProcess == -1; i--) {
+        if(!stageBuiltins[i] || mayBlock(tokens[i], i == 0))
+            continue;
+
+        // In a pipeline, exit or cd must not act on the shell itself
+        if(stageBuiltins[i]->pipeSafe)
+            inProcess = i;
+    }
+
+    for(int i = 0; i < numCmds; i++) {
+        if(tokens[i].capacity == 0 || tokens[i].size == 0 || i == inProcess) {
+            jobsAddProcess(job, -1, i == inProcess ? tokens[i].arr[0] : NULL);
+            continue;
+        }
+
+        int inFd = i > 0 ? fds[2 * (i - 1)] : -1;
+        int outFd = i < numCmds - 1 ? fds[2 * i + 1] : -1;
+
+        // Without job control every stage stays in the shell's group
+        pid_t pgid = -1;
+        if(interactive)
+            pgid = job->pgid == -1 ? 0 : job->pgid;
+
+        pid_t pid;
+        if(stageBuiltins[i])
+            pid = forkBuiltin(stageBuiltins[i], tokens[i], inFd, outFd, pgid);
+        else
+            pid = launchProcess(tokens[i].arr, inFd, outFd, pgid);
+
+        jobsAddProcess(job, pid, tokens[i].arr[0]);
+    }
+
+    int inProcessIn = inProcess > 0 ? fds[2 * (inProcess - 1)] : STDIN_FILENO;
+    int inProcessOut = inProcess != -1 && inProcess < numCmds - 1 ? fds[2 * inProcess + 1] : STDOUT_FILENO;
+
+    // The parent must drop its copies of every pipe end, otherwise readers
+    // never see EOF once their writer exits
+    for(int i = 0; i < 2 * numCmds; i++) {
+        if(fds[i] != -1 && fds[i] != inProcessIn && fds[i] != inProcessOut)
+            close(fds[i]);
+    }
+
+    if(inProcess != -1) {
+        // The other stages may need the terminal while the builtin runs
+        giveTerminal(job);
+
+        ProcStats* proc = &job->procs[inProcess];
+        runBuiltin(stageBuiltins[inProcess], tokens[inProcess], inProcessIn, inProcessOut, proc);
+        proc->name = job->names[inProcess];
+
+        if(inProcessIn != STDIN_FILENO)
+            close(inProcessIn);
+        if(inProcessOut != STDOUT_FILENO)
+            close(inProcessOut);
+    }
+
+    if(background) {
+        if(interactive)
+            printf("[%d] %d\n", job->id, job->pgid);
+        return 0;
+    }
+
+    JobState state = waitForeground(job, false);
+    for(int i = 0; i < numCmds; i++) {
+        stats[i] = job->procs[i];
+        stats[i].name = tokens[i].size ? tokens[i].arr[0] : NULL;
+    }
+
+    int status = jobsStatus(job);
+    if(state == JOB_DONE)
+        jobsRemove(&jobTable, job);
+
+    return status;
+}
+
+/************************************************
+ * waitForeground:  Give a job the terminal and
+ *                  wait for it to finish or stop.
+ *                  The terminal settings the job
+ *                  had when it stopped are saved
+ *                  and restored on "fg"
+ *
+ * job:             Job to wait for
+ *
+ * resume:          Send SIGCONT before waiting
+ *
+ * return:          State of the job afterwards
+ ***********************************************/
+JobState waitForeground(Job* job, bool resume)
+{
+    if(!job)
+        return JOB_DONE;
+
+    bool control = interactive && job->pgid > 0;
+    giveTerminal(job);
+
+    if(resume)
+        jobsContinue(job);
+
+    JobState state = jobsWait(&jobTable, job);
+
+    if(control) {
+        tcsetpgrp(STDIN_FILENO, getpgrp());
+        if(state == JOB_STOPPED) {
+            tcgetattr(STDIN_FILENO, &job->tmodes);
+            job->hasTmodes = true;
+        }
+        tcsetattr(STDIN_FILENO, TCSADRAIN, &raw);
+    }
+
+    if(state == JOB_STOPPED) {
+        fflush(stdout);
+        writeAll(STDOUT_FILENO, "\n", 1);
+        jobsPrint(&jobTable, job, STDOUT_FILENO);
+        job->notified = true;
+    }
+
+    return state;
+}
+
+/************************************************
+ * giveTerminal:    Make a job the terminal's
+ *                  foreground process group with
+ *                  its own terminal settings.
+ *                  Does nothing without job
+ *                  control
+ *
+ * job:             Job to give the terminal to
+ ***********************************************/
+void giveTerminal(Job* job)
+{
+    if(!interactive || !job || job->pgid <= 0)
+        return;
+
+    tcsetattr(STDIN_FILENO, TCSADRAIN, job->hasTmodes ? &job->tmodes : &old);
+    tcsetpgrp(STDIN_FILENO, job->pgid);
+}
+
+/************************************************
+ * launchProcess:   Start a command with its
+ *                  stdin and stdout optionally
+ *                  replaced. posix_spawn avoids
+ *                  copying the shell's page
+ *                  tables, fork is only used if
+ *                  the spawn attributes cannot be
+ *                  set up. Bare command names are
+ *                  resolved through commandCache
+ *
+ * argv:            NULL terminated argument list
+ *
+ * inFd:            Descriptor for stdin, -1 to
+ *                  inherit the shell's
+ *
+ * outFd:           Descriptor for stdout, -1 to
+ *                  inherit the shell's
+ *
+ * pgid:            Process group to join, 0 for a
+ *                  new group, -1 to stay in the
+ *                  shell's
+ *
+ * return:          Pid of the child, -1 on error
+ ***********************************************/
+pid_t launchProcess(char** argv, int inFd, int outFd, pid_t pgid)
+{
+    if(!argv || !argv[0])
+        return -1;
+
+    // Resolved against the shell's $PATH, the process environment may be stale
+    char resolved[PATH_MAX];
+    const char* path = argv[0];
+    bool cached = false;
+    if(!strchr(argv[0], '/')) {
+        path = pathCacheLookup(&commandCache, argv[0]);
+        cached = path != NULL;
+        if(!path && pathCacheResolve(commandCache.pathVar, argv[0], resolved, PATH_MAX))
+            path = resolved;
+
+        if(!path) {
+            fprintf(stderr, "%s: %s\n", argv[0], strerror(ENOENT));
+            return -1;
+        }
+    }
+
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    if(posix_spawn_file_actions_init(&actions) != 0)
+        return forkProcess(path, argv, inFd, outFd, pgid);
+
+    if(posix_spawnattr_init(&attr) != 0) {
+        posix_spawn_file_actions_destroy(&actions);
+        return forkProcess(path, argv, inFd, outFd, pgid);
+    }
+
+    bool ok = true;
+    if(inFd != -1)
+        ok = ok && posix_spawn_file_actions_adddup2(&actions, inFd, STDIN_FILENO) == 0;
+    if(outFd != -1)
+        ok = ok && posix_spawn_file_actions_adddup2(&actions, outFd, STDOUT_FILENO) == 0;
+
+    // Children start with default dispositions and an empty mask no matter
+    // what the shell has blocked or ignored
+    sigset_t mask, defaults;
+    sigemptyset(&mask);
+    sigfillset(&defaults);
+    ok = ok && posix_spawnattr_setsigmask(&attr, &mask) == 0;
+    ok = ok && posix_spawnattr_setsigdefault(&attr, &defaults) == 0;
+
+    short flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF | POSIX_SPAWN_USEVFORK;
+    if(pgid != -1) {
+        flags |= POSIX_SPAWN_SETPGROUP;
+        ok = ok && posix_spawnattr_setpgroup(&attr, pgid) == 0;
+    }
+    ok = ok && posix_spawnattr_setflags(&attr, flags) == 0;
+
+    if(!ok) {
+        posix_spawnattr_destroy(&attr);
+        posix_spawn_file_actions_destroy(&actions);
+        return forkProcess(path, argv, inFd, outFd, pgid);
+    }
+
+    pid_t pid = -1;
+    char** envp = varsEnviron(&shellVars);
+    int err = posix_spawn(&pid, path, &actions, &attr, argv, envp);
+    if(err == ENOENT && cached) { // Cached binary was removed, look it up again
+        pathCacheRemove(&commandCache, argv[0]);
+        path = pathCacheLookup(&commandCache, argv[0]);
+        err = path ? posix_spawn(&pid, path, &actions, &attr, argv, envp) : ENOENT;
+    }
+
+    if(err != 0) {
+        fprintf(stderr, "%s: %s\n", argv[0], strerror(err));
+        pid = -1;
+    }
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    return pid;
+}
+
+/************************************************
+ * forkProcess: Fallback for launchProcess which
+ *              sets up the child by hand
+ *
+ * path:        Resolved executable
+ *
+ * argv:        NULL terminated argument list
+ *
+ * inFd:        Descriptor for stdin, -1 to
+ *              inherit the shell's
+ *
+ * outFd:       Descriptor for stdout, -1 to
+ *              inherit the shell's
+ *
+ * pgid:        Process group to join, 0 for a
+ *              new group, -1 to stay in the
+ *              shell's
+ *
+ * return:      Pid of the child, -1 on error
+ ***********************************************/
+pid_t forkProcess(const char* path, char** argv, int inFd, int outFd, pid_t pgid)
+{
+    char** envp = varsEnviron(&shellVars);
+    pid_t pid = fork();
+    if(pid == 0) { // Child
+        if(pgid != -1)
+            setpgid(0, pgid);
+
+        int sigs[] = {SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU, SIGPIPE, SIGCHLD};
+        for(size_t i = 0; i < sizeof(sigs) / sizeof(sigs[0]); i++)
+            signal(sigs[i], SIG_DFL);
+
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigprocmask(SIG_SETMASK, &mask, NULL);
+
+        if(inFd != -1)
+            dup2(inFd, STDIN_FILENO);
+        if(outFd != -1)
+            dup2(outFd, STDOUT_FILENO);
+
+        execve(path, argv, envp);
+        perror(argv[0]);
+        _exit(127);
+    } else if(pid == -1) {
+        perror("fork");
+    } else if(pgid != -1) {
+        // Also set it here so the group exists before the shell uses it
+        setpgid(pid, pgid == 0 ? pid : pgid);
+    }
+
+    return pid;
+}
+
+/************************************************
+ * findBuiltin: Look up a command in the builtin
+ *              table
+ *
+ * args:        Vector holding the command and
+ *              its arguments
+ *
+ * return:      The builtin, NULL for external
+ *              commands
+ ***********************************************/
+const Builtin* findBuiltin(Vector args)
+{
+    if(args.size == 0)
+        return NULL;
+
+    // Options are left to the real cat
+    if(strncmp(args.arr[0], "cat", sizeof("cat")) == 0) {
+        for(size_t i = 1; i < args.size; i++) {
+            if(args.arr[i][0] == '-' && args.arr[i][1] != '\0')
+                return NULL;
+        }
+    }
+
+    for(size_t i = 0; i < sizeof(builtins) / sizeof(builtins[0]); i++) {
+        if(strcmp(args.arr[0], builtins[i].name) == 0)
+            return &builtins[i];
+    }
+
+    return NULL;
+}
+
+/************************************************
+ * runBuiltin:  Run a builtin in the shell and
+ *              record it like a reaped process
+ *
+ * builtin:     Builtin to run
+ *
+ * args:        Vector holding the command and
+ *              its arguments
+ *
+ * inFd:        Stdin of the stage
+ *
+ * outFd:       Stdout of the stage
+ *
+ * pStats:      Receives the status, time and
+ *              the shell's resource usage
+ *
+ * return:      Exit status of the builtin
+ ***********************************************/
+int runBuiltin(const Builtin* builtin, Vector args, int inFd, int outFd, ProcStats* pStats)
+{
+    struct rusage before;
+    getrusage(RUSAGE_SELF, &before);
+
+    ProcStats stats;
+    processStart(&stats, -1, args.arr[0]);
+    stats.status = builtin->fn(args, inFd, outFd);
+    clock_gettime(CLOCK_MONOTONIC, &stats.end);
+    processUsageSince(&stats.usage, &before);
+
+    if(pStats)
+        *pStats = stats;
+
+    return stats.status;
+}
+
+/************************************************
+ * forkBuiltin: Run a builtin in a child so it
+ *              can stream alongside the other
+ *              stages of a pipeline
+ *
+ * builtin:     Builtin to run
+ *
+ * args:        Vector holding the command and
+ *              its arguments
+ *
+ * inFd:        Descriptor for stdin, -1 to
+ *              inherit the shell's
+ *
+ * outFd:       Descriptor for stdout, -1 to
+ *              inherit the shell's
+ *
+ * pgid:        Process group to join, 0 for a
+ *              new group, -1 to stay in the
+ *              shell's
+ *
+ * return:      Pid of the child, -1 on error
+ ***********************************************/
+pid_t forkBuiltin(const Builtin* builtin, Vector args, int inFd, int outFd, pid_t pgid)
+{
+    pid_t pid = fork();
+    if(pid == 0) { // Child
+        if(pgid != -1)
+            setpgid(0, pgid);
+
+        // SIGCHLD keeps the shell's handler, parallel reaps through it
+        int sigs[] = {SIGINT, SIGQUIT, SIGTSTP, SIGTTIN, SIGTTOU, SIGPIPE};
+        for(size_t i = 0; i < sizeof(sigs) / sizeof(sigs[0]); i++)
+            signal(sigs[i], SIG_DFL);
+
+        sigset_t mask;
+        sigemptyset(&mask);
+        sigprocmask(SIG_SETMASK, &mask, NULL);
+
+        // Nothing here execs, so close on exec can't drop the other stages'
+        // pipe ends. Holding them would keep readers from seeing EOF
+        if(inFd != -1)
+            dup2(inFd, STDIN_FILENO);
+        if(outFd != -1)
+            dup2(outFd, STDOUT_FILENO);
+        close_range(STDERR_FILENO + 1, ~0U, 0);
+
+        interactive = false;
+        _exit(builtin->fn(args, STDIN_FILENO, STDOUT_FILENO));
+    } else if(pid == -1) {
+        perror("fork");
+    } else if(pgid != -1) {
+        setpgid(pid, pgid == 0 ? pid : pgid);
+    }
+
+    return pid;
+}
+
+/************************************************
+ * writeAll:    Write a whole buffer, retrying
+ *              short writes
+ *
+ * fd:          Descriptor to write to
+ *
+ * buffer:      Data to write
+ *
+ * size:        Number of bytes in buffer
+ *
+ * return:      Whether everything was written
+ ***********************************************/
+bool writeAll(int fd, const char* buffer, size_t size)
+{
+    while(size > 0) {
+        ssize_t n = write(fd, buffer, size);
+        if(n == -1 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            return false;
+
+        buffer += n;
+        size -= n;
+    }
+
+    return true;
+}
+
+/************************************************
+ * expandEscapes:   Write a string to a stream
+ *                  with backslash escapes
+ *                  replaced, as done by "echo -e"
+ *                  and "printf"
+ *
+ * stream:          Where to write
+ *
+ * string:          String to expand
+ *
+ * return:          False if "\c" asked for all
+ *                  further output to stop
+ ***********************************************/
+bool expandEscapes(FILE* stream, const char* string)
+{
+    for(const char* p = string; *p; p++) {
+        if(*p != '\\' || p[1] == '\0') {
+            fputc(*p, stream);
+            continue;
+        }
+
+        p++;
+        switch(*p) {
+            case 'a': fputc('\a', stream); break;
+            case 'b': fputc('\b', stream); break;
+            case 'e': fputc('\033', stream); break;
+            case 'f': fputc('\f', stream); break;
+            case 'n': fputc('\n', stream); break;
+            case 'r': fputc('\r', stream); break;
+            case 't': fputc('\t', stream); break;
+            case 'v': fputc('\v', stream); break;
+            case '\\': fputc('\\', stream); break;
+            case 'c': return false;
+            case '0': case 'x': {
+                int base = *p == 'x' ? 16 : 8;
+                int maxDigits = *p == 'x' ? 2 : 3;
+                int value = 0, digits = 0;
+                while(digits < maxDigits && p[1]) {
+                    char c = p[1];
+                    int d = (c >= '0' && c <= '7') ? c - '0' :
+                            (base == 16 && c >= '8' && c <= '9') ? c - '0' :
+                            (base == 16 && c >= 'a' && c <= 'f') ? c - 'a' + 10 :
+                            (base == 16 && c >= 'A' && c <= 'F') ? c - 'A' + 10 : -1;
+                    if(d == -1)
+                        break;
+                    value = value * base + d;
+                    digits++;
+                    p++;
+                }
+                fputc(value, stream);
+                break;
+            }
+            default:
+                fputc('\\', stream);
+                fputc(*p, stream);
+        }
+    }
+
+    return true;
+}
+
+/************************************************
+ * builtinCd:   Change the working directory.
+ *              "cd" goes home, "cd -" goes back
+ *              to the previous directory
+ *
+ * args:        Vector holding the command and
+ *              its arguments
+ *
+ * inFd:        Stdin of the stage, unused
+ *
+ * outFd:       Stdout of the stage, unused
+ *
+ * return:      Exit status
+ ***********************************************/
+int builtinCd(Vector args, int inFd, int outFd)
+{
+    (void)inFd;
+    (void)outFd;
+
+    static char prevDir[PATH_MAX];
+    char temp[PATH_MAX] = {0};
+
+    if(!getcwd(temp, PATH_MAX)) {
+        perror("getcwd");
+        return 1;
+    }
+
+    const char* target;
+    if(args.size == 1) {
+        target = varsGet(&shellVars, "HOME", 4);
+        if(!target) {
+            fprintf(stderr, "cd: HOME not set\n");
+            return 1;
+        }
+    } else if(strncmp(args.arr[1], "-", sizeof("-")) == 0) {
+        if(strnlen(prevDir, PATH_MAX) == 0) {
+            fprintf(stderr, "cd: Previous Directory is not set\n");
+            return 1;
+        }
+        target = prevDir;
+    } else {
+        target = args.arr[1];
+    }
+
+    if(chdir(target) != 0) {
+        fprintf(stderr, "cd: %s is not a file or directory\n", target);
+        return 1;
+    }
+
+    strlcpy(prevDir, temp, PATH_MAX);
+    promptChdir(&prompt);
+    return 0;
+}
+
+/************************************************
+ * builtinExit: Leave the shell with the status
+ *              of the last command
+ *
+ * args:        Vector holding the command
+ *
+ * inFd:        Stdin of the stage, unused
+ *
+ * outFd:       Stdout of the stage, unused
+ *
+ * return:      Exit status if it didn't exit
+ ***********************************************/
+int builtinExit(Vector args, int inFd, int outFd)
+{
+    (void)inFd;
+    (void)outFd;
+
+    if(args.size != 1) {
+        fprintf(stderr, "exit: Command takes no arguments\n");
+        return 1;
+    }
+
+    if(interactive)
+        tcsetattr(STDIN_FILENO, TCSANOW, &old);
+    exit(lastStatus);
+}
+
+/************************************************
+ * builtinExec: Run a command in the foreground
+ *              on the stage's descriptors
+ *
+ * args:        Vector holding "exec", the
+ *              command and its arguments
+ *
+ * inFd:        Stdin of the stage
+ *
+ * outFd:       Stdout of the stage
+ *
+ * return:      Exit status of the command
+ ***********************************************/
+int builtinExec(Vector args, int inFd, int outFd)
+{
+    if(args.size < 2) {
+        fprintf(stderr, "exec: Missing command\n");
+        return 1;
+    }
+
+    Job* job = jobsAdd(&jobTable, args.arr[1], 1);
+    if(!job) {
+        fprintf(stderr, "Unable to create job\n");
+        return 1;
+    }
+
+    pid_t pid = launchProcess(args.arr + 1, inFd == STDIN_FILENO ? -1 : inFd,
+                              outFd == STDOUT_FILENO ? -1 : outFd, interactive ? 0 : -1);
+    jobsAddProcess(job, pid, args.arr[1]);
+
+    JobState state = waitForeground(job, false);
+    int status = state == JOB_STOPPED ? 128 + SIGTSTP : jobsStatus(job);
+    if(state == JOB_DONE)
+        jobsRemove(&jobTable, job);
+
+    return status;
+}
+
+/************************************************
+ * builtinEcho: Write the arguments separated by
+ *              spaces in a single write
+ *
+ *              -n  no trailing newline
+ *              -e  expand backslash escapes
+ *              -E  don't expand (default)
+ *
+ * args:        Vector holding the command and
+ *              its arguments
+ *
+ * inFd:        Stdin of the stage, unused
+ *
+ * outFd:       Stdout of the stage
+ *
+ * return:      Exit status
+ ***********************************************/
+int builtinEcho(Vector args, int inFd, int outFd)
+{
+    (void)inFd;
+
+    bool newline = true, escapes = false;
+    size_t i = 1;
+    for(; i < args.size && args.arr[i][0] == '-' && args.arr[i][1] != '\0'; i++) {
+        // Only words made entirely of option letters are options
+        if(strspn(args.arr[i] + 1, "neE") != strlen(args.arr[i] + 1))
+            break;
+
+        for(char* c = args.arr[i] + 1; *c; c++) {
+            if(*c == 'n')
+                newline = false;
+            else if(*c == 'e')
+                escapes = true;
+            else
+                escapes = false;
+        }
+    }
+
+    char* buffer = NULL;
+    size_t size = 0;
+    FILE* stream = open_memstream(&buffer, &size);
+    if(!stream) {
+        perror("echo");
+        return 1;
+    }
+
+    bool more = true;
+    for(size_t j = i; j < args.size && more; j++) {
+        if(j > i)
+            fputc(' ', stream);
+
+        if(escapes)
+            more = expandEscapes(stream, args.arr[j]);
+        else
+            fputs(args.arr[j], stream);
+    }
+
+    if(newline && more)
+        fputc('\n', stream);
+    fclose(stream);
+
+    bool ok = writeAll(outFd, buffer, size);
+    free(buffer);
+    return ok ? 0 : 1;
+}
+
+/************************************************
+ * builtinPrintf:   Format the arguments like
+ *                  printf(1). The format is
+ *                  reused while arguments remain
+ *
+ * args:            Vector holding the command,
+ *                  the format and its arguments
+ *
+ * inFd:            Stdin of the stage, unused
+ *
+ * outFd:           Stdout of the stage
+ *
+ * return:          Exit status
+ ***********************************************/
+int builtinPrintf(Vector args, int inFd, int outFd)
+{
+    (void)inFd;
+
+    if(args.size < 2) {
+        fprintf(stderr, "printf: usage: printf format [arguments]\n");
+        return 2;
+    }
+
+    char* buffer = NULL;
+    size_t size = 0;
+    FILE* stream = open_memstream(&buffer, &size);
+    if(!stream) {
+        perror("printf");
+        return 1;
+    }
+
+    size_t arg = 2;
+    bool more = true;
+    do {
+        size_t before = arg;
+        more = formatOnce(stream, args.arr[1], args, &arg);
+        if(arg == before)
+            break;
+    } while(more && arg < args.size);
+    fclose(stream);
+
+    bool ok = writeAll(outFd, buffer, size);
+    free(buffer);
+    return ok ? 0 : 1;
+}
+
+/************************************************
+ * formatOnce:  Expand a printf format a single
+ *              time. Missing arguments are
+ *              treated as empty strings or zero
+ *
+ * stream:      Where to write
+ *
+ * format:      printf style format
+ *
+ * args:        Vector holding the arguments
+ *
+ * pArg:        Index of the next argument,
+ *              advanced as they are used
+ *
+ * return:      False if "\c" stopped the output
+ ***********************************************/
+bool formatOnce(FILE* stream, const char* format, Vector args, size_t* pArg)
+{
+    for(const char* p = format; *p; p++) {
+        if(*p == '\\') {
+            char escape[5] = {0};
+            size_t len = 1;
+            escape[0] = '\\';
+            // Copy just this escape so expandEscapes sees it alone
+            if(p[1] == '0' || p[1] == 'x') {
+                escape[len++] = *++p;
+                size_t max = escape[1] == 'x' ? 2 : 3;
+                for(size_t d = 0; d < max && p[1] && strchr("0123456789abcdefABCDEF", p[1]); d++) {
+                    if(len < sizeof(escape) - 1)
+                        escape[len++] = *++p;
+                }
+            } else if(p[1]) {
+                escape[len++] = *++p;
+            }
+
+            if(!expandEscapes(stream, escape))
+                return false;
+            continue;
+        }
+
+        if(*p != '%') {
+            fputc(*p, stream);
+            continue;
+        }
+
+        if(p[1] == '%') {
+            fputc('%', stream);
+            p++;
+            continue;
+        }
+
+        // Collect flags, width and precision into a spec for the C printf
+        char spec[32] = "%";
+        size_t len = 1;
+        p++;
+        while(*p && strchr("-+ #0123456789.", *p) && len < sizeof(spec) - 4)
+            spec[len++] = *p++;
+
+        if(*p == '\0')
+            break;
+
+        const char* value = *pArg < args.size ? args.arr[(*pArg)++] : "";
+        char conv = *p;
+        switch(conv) {
+            case 'd': case 'i': {
+                spec[len++] = 'l';
+                spec[len++] = 'l';
+                spec[len++] = conv;
+                long long n = value[0] == '\'' ? (unsigned char)value[1] : strtoll(value, NULL, 0);
+                fprintf(stream, spec, n);
+                break;
+            }
+            case 'u': case 'o': case 'x': case 'X': {
+                spec[len++] = 'l';
+                spec[len++] = 'l';
+                spec[len++] = conv;
+                unsigned long long n = value[0] == '\'' ? (unsigned char)value[1] : strtoull(value, NULL, 0);
+                fprintf(stream, spec, n);
+                break;
+            }
+            case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+                spec[len++] = conv;
+                fprintf(stream, spec, strtod(value, NULL));
+                break;
+            case 'c':
+                spec[len++] = 'c';
+                fprintf(stream, spec, value[0]);
+                break;
+            case 's':
+                spec[len++] = 's';
+                fprintf(stream, spec, value);
+                break;
+            case 'b':
+                if(!expandEscapes(stream, value))
+                    return false;
+                break;
+            default:
+                (*pArg)--;
+                fputs(spec, stream);
+                fputc(conv, stream);
+        }
+    }
+
+    return true;
+}
+
+/************************************************
+ * builtinPwd:  Print the working directory
+ *
+ * args:        Vector holding the command
+ *
+ * inFd:        Stdin of the stage, unused
+ *
+ * outFd:       Stdout of the stage
+ *
+ * return:      Exit status
+ ***********************************************/
+int builtinPwd(Vector args, int inFd, int outFd)
+{
+    (void)args;
+    (void)inFd;
+
+    char cwd[PATH_MAX + 1];
+    if(!getcwd(cwd, PATH_MAX)) {
+        perror("pwd");
+        return 1;
+    }
+
+    size_t len = strlen(cwd);
+    cwd[len++] = '\n';
+    return writeAll(outFd, cwd, len) ? 0 : 1;
+}
+
+int builtinTrue(Vector args, int inFd, int outFd)
+{
+    (void)args;
+    (void)inFd;
+    (void)outFd;
+    return 0;
+}
+
+int builtinFalse(Vector args, int inFd, int outFd)
+{
+    (void)args;
+    (void)inFd;
+    (void)outFd;
+    return 1;
+}
+
+/************************************************
+ * builtinHash: List, clear or seed the command
+ *              path cache
+ *
+ *              hash            list entries
+ *              hash -r         forget all
+ *              hash -d name    forget one
+ *              hash -p path name
+ *                              set explicitly
+ *              hash name...    look up and add
+ *
+ * args:        Vector holding the command and
+ *              its arguments
+ *
+ * inFd:        Stdin of the stage, unused
+ *
+ * outFd:       Stdout of the stage
+ *
+ * return:      Exit status
+ ***********************************************/
+int builtinHash(Vector args, int inFd, int outFd)
+{
+    (void)inFd;
+
+    if(args.size == 1) {
+        for(size_t i = 0; i < commandCache.capacity; i++) {
+            if(commandCache.names[i])
+                dprintf(outFd, "%s\t%s\n", commandCache.names[i], commandCache.paths[i]);
+        }
+        return 0;
+    }
+
+    int status = 0;
+    if(strncmp(args.arr[1], "-r", sizeof("-r")) == 0) {
+        pathCacheClear(&commandCache);
+    } else if(strncmp(args.arr[1], "-d", sizeof("-d")) == 0) {
+        for(size_t i = 2; i < args.size; i++) {
+            if(!pathCacheRemove(&commandCache, args.arr[i])) {
+                fprintf(stderr, "hash: %s: not found\n", args.arr[i]);
+                status = 1;
+            }
+        }
+    } else if(strncmp(args.arr[1], "-p", sizeof("-p")) == 0) {
+        if(args.size != 4 || args.arr[2][0] != '/') {
+            fprintf(stderr, "hash: usage: hash -p /absolute/path name\n");
+            return 1;
+        }
+        // Look up first so a later $PATH check doesn't drop the entry
+        pathCacheLookup(&commandCache, args.arr[3]);
+        pathCacheInsert(&commandCache, args.arr[3], args.arr[2]);
+    } else {
+        for(size_t i = 1; i < args.size; i++) {
+            if(strchr(args.arr[i], '/'))
+                continue;
+
+            if(!pathCacheLookup(&commandCache, args.arr[i])) {
+                fprintf(stderr, "hash: %s: not found\n", args.arr[i]);
+                status = 1;
+            }
+        }
+    }
+
+    return status;
+}
+
+/************************************************
+ * builtinJobs: List background and stopped jobs.
+ *              Finished jobs are listed once and
+ *              then forgotten
+ *
+ *              jobs            list jobs
+ *              jobs -p         list group ids
+ *
+ * args:        Vector holding the command and
+ *              its arguments
+ *
+ * inFd:        Stdin of the stage, unused
+ *
+ * outFd:       Stdout of the stage
+ *
+ * return:      Exit status
+ ***********************************************/
+int builtinJobs(Vector args, int inFd, int outFd)
+{
+    (void)inFd;
+
+    jobsUpdate(&jobTable);
+
+    bool pidsOnly = args.size > 1 && strncmp(args.arr[1], "-p", sizeof("-p")) == 0;
+    for(size_t i = 0; i < jobTable.size; i++) {
+        Job* job = jobTable.jobs[i];
+        if(pidsOnly)
+            dprintf(outFd, "%d\n", job->pgid);
+        else
+            jobsPrint(&jobTable, job, outFd);
+        job->notified = true;
+    }
+
+    jobsNotify(&jobTable, -1);
+    return 0;
+}
+
+/************************************************
+ * builtinFg:   Move a job into the foreground,
+ *              continuing it if it was stopped
+ *
+ * args:        Vector holding the command and
+ *              an optional job spec
+ *
+ * inFd:        Stdin of the stage, unused
+ *
+ * outFd:       Stdout of the stage
+ *
+ * return:      Exit status of the job
+ ***********************************************/
+int builtinFg(Vector args, int inFd, int outFd)
+{
+    (void)inFd;
+
+    jobsUpdate(&jobTable);
+
+    Job* job = jobsFind(&jobTable, args.size > 1 ? args.arr[1] : NULL);
+    if(!job || job->state == JOB_DONE) {
+        fprintf(stderr, "fg: %s: no such job\n", args.size > 1 ? args.arr[1] : "current");
+        return 1;
+    }
+
+    dprintf(outFd, "%s\n", job->command);
+
+    JobState state = waitForeground(job, true);
+    int status = state == JOB_STOPPED ? 128 + SIGTSTP : jobsStatus(job);
+    if(state == JOB_DONE)
+        jobsRemove(&jobTable, job);
+
+    return status;
+}
 
-            if(redir || numCmds > 1) {
-                dup2(fdIn, STDIN_FILENO);
-                dup2(fdOut, STDOUT_FILENO);
-            }
+/************************************************
+ * builtinBg:   Continue a stopped job in the
+ *              background
+ *
+ * args:        Vector holding the command and
+ *              an optional job spec
+ *
+ * inFd:        Stdin of the stage, unused
+ *
+ * outFd:       Stdout of the stage
+ *
+ * return:      Exit status
+ ***********************************************/
+int builtinBg(Vector args, int inFd, int outFd)
+{
+    (void)inFd;
 
-            for(int i = 0; i < numCmds; i++)
-                vectorDestroy(&commands[i]);
+    jobsUpdate(&jobTable);
 
-            vectorDestroy(&tokens);
-        }
+    Job* job = jobsFind(&jobTable, args.size > 1 ? args.arr[1] : NULL);
+    if(!job || job->state == JOB_DONE) {
+        fprintf(stderr, "bg: %s: no such job\n", args.size > 1 ? args.arr[1] : "current");
+        return 1;
     }
-    printf("\n");
 
-    vectorDestroy(&history);
-    tcsetattr(STDIN_FILENO, TCSANOW, &old);
+    if(job->state == JOB_STOPPED && !jobsContinue(job)) {
+        perror("bg");
+        return 1;
+    }
 
+    dprintf(outFd, "[%d] %s &\n", job->id, job->command);
     return 0;
 }
 
-/******************************************
- *      Helper Function Definitions       *
- ******************************************/
-
 /************************************************
- * getInput: Parse keyboard input one character
- * at a time. Special characters are handled in
- * this function
+ * builtinWait: Wait for background jobs to
+ *              finish. With no arguments every
+ *              job is waited for
  *
- * buffer:  Input buffer which holds the
- *          characters to be displayed
+ * args:        Vector holding the command and
+ *              optional job specs or pids
  *
- * size:    Size of buffer
+ * inFd:        Stdin of the stage, unused
  *
- * history: A vector of all previously entered
- *          commands
+ * outFd:       Stdout of the stage, unused
  *
- * pos:     Current column in the terminal
- *
- * return:  Whether the program should continue
- *          or not. True continues and processes
- *          the current buffer, false ends the
- *          program
+ * return:      Status of the last job waited for
  ***********************************************/
-bool getInput(char* buffer, size_t size, Vector history, int pos)
+int builtinWait(Vector args, int inFd, int outFd)
 {
-    if(!buffer || size == 0)
-        return false;
+    (void)inFd;
+    (void)outFd;
+
+    if(args.size == 1) {
+        while(jobTable.size > 0) {
+            // Stopped jobs would never finish, wait stops at them
+            Job* job = NULL;
+            for(size_t i = 0; i < jobTable.size && !job; i++) {
+                if(jobTable.jobs[i]->state == JOB_RUNNING)
+                    job = jobTable.jobs[i];
+            }
+            if(!job)
+                break;
 
-    char c;
-    int i = 0;
-    size_t historyPos = 0;
-    while((c = getc(stdin)) != '\n') {
-        if(c == 0x4) { // EOF
-            return false;
-        } else if(c == '\t') {
-            tabComplete(buffer, size, &i);
-        } else if(c == 0x1b) {
-            c = getc(stdin);
-            if(c == 0x5b) {
-                c = getc(stdin);
-                if(c == 'A') { // Up Arrow
-                    if(historyPos + 1 > history.size)
-                        continue;
+            jobsWait(&jobTable, job);
+        }
+        jobsNotify(&jobTable, -1);
+        return 0;
+    }
 
-                    printPrompt();
-                    historyPos += 1;
-                    snprintf(buffer, size, "%s", history.arr[history.size - historyPos]);
-                    i = strnlen(buffer, size);
-                } else if(c == 'B') { // Down Arrow
-                    if(historyPos == 0) {
-                        continue;
-                    } else if(historyPos - 1 == 0) {
-                        printPrompt();
-                        historyPos -= 1;
-                        memset(buffer, 0, size);
-                        i = 0;
-                    } else {
-                        printPrompt();
-                        historyPos -= 1;
-                        snprintf(buffer, size, "%s", history.arr[history.size - historyPos]);
-                        i = strnlen(buffer, size);
-                    }
+    int status = 0;
+    for(size_t i = 1; i < args.size; i++) {
+        Job* job = NULL;
+        if(args.arr[i][0] == '%') {
+            job = jobsFind(&jobTable, args.arr[i]);
+        } else {
+            pid_t pid = atoi(args.arr[i]);
+            for(size_t j = 0; j < jobTable.size && !job; j++) {
+                for(size_t k = 0; k < jobTable.jobs[j]->numProcs; k++) {
+                    if(jobTable.jobs[j]->procs[k].pid == pid)
+                        job = jobTable.jobs[j];
                 }
             }
-        } else if(c == 0xc) { // Ctrl-L
-            printf(CLEAR_SCREEN);
-            printPrompt();
-        } else if(c == 0x7f || c == 0x8) { // Backspace
-            if(i > 0) {
-                buffer[--i] = ' ';
-                printf("\r\033[%dC%s", pos, buffer);
-                buffer[i] = '\0';
-            }
-        } else { // Normal character
-            buffer[i++] = c;
         }
 
-        printf("\r\033[%dC%s", pos, buffer);
+        if(!job) {
+            fprintf(stderr, "wait: %s: no such job\n", args.arr[i]);
+            status = 127;
+            continue;
+        }
+
+        if(jobsWait(&jobTable, job) == JOB_DONE) {
+            status = jobsStatus(job);
+            jobsRemove(&jobTable, job);
+        } else {
+            status = 128 + SIGTSTP;
+        }
     }
 
-    printf("\n");
-    return true;
+    return status;
 }
 
 /************************************************
- * tabComplete: Search the current directory, or
- *              a given path, for a match to a
- *              partially typed file/directory
+ * builtinParallel: Run a command once per input
+ *                  with at most N running at a
+ *                  time. A new task starts as
+ *                  soon as any task exits.
+ *                  Inputs follow ":::" or are
+ *                  read one per line from stdin.
+ *                  "{}" in the command is replaced
+ *                  by the input, otherwise the
+ *                  input is appended
+ *
+ *                  parallel [-j N] [-g|-u] cmd...
+ *                           [::: inputs...]
  *
- * buffer:      Input buffer which holds
- *              characters to be displayed
+ *                  -j N    tasks to run at once,
+ *                          defaults to the number
+ *                          of online CPUs
+ *                  -g      print each task's
+ *                          output in one piece
+ *                          once it exits (default)
+ *                  -u      let output interleave
  *
- * size:        Size of buffer
+ * args:            Vector holding the command and
+ *                  its arguments
  *
- * i:           Current column in the terminal
+ * inFd:            Stdin of the stage, inputs are
+ *                  read from it without ":::"
+ *
+ * outFd:           Stdout of the stage
+ *
+ * return:          Number of failed tasks
  ***********************************************/
-void tabComplete(char* buffer, size_t size, int* i)
+int builtinParallel(Vector args, int inFd, int outFd)
 {
-    if(!i)
-        return;
-
-    char copy[size];
-    strlcpy(copy, buffer, size);
-    Vector toks = tokenizeInput(copy, *i);
-    if(toks.size == 0)
-        return;
-
-    char* path = calloc(PATH_MAX, sizeof(char));
-    if(!path) {
-        vectorDestroy(&toks);
-        return;
-    }
-
-    char* pathStr = toks.arr[toks.size - 1];
-    extractPath(pathStr, strnlen(pathStr, CMD_SIZE), &path);
-
-    char stub[PATH_MAX] = {0};
-    int j = strnlen(pathStr, CMD_SIZE) - 1;
-    for(; j >= 0; j--) {
-        if(pathStr[j] == '/')
+    long maxJobs = sysconf(_SC_NPROCESSORS_ONLN);
+    bool group = true;
+
+    size_t i = 1;
+    for(; i < args.size && args.arr[i][0] == '-'; i++) {
+        if(strncmp(args.arr[i], "-j", sizeof("-j")) == 0 && i + 1 < args.size) {
+            maxJobs = atol(args.arr[++i]);
+        } else if(strncmp(args.arr[i], "-j", 2) == 0) {
+            maxJobs = atol(args.arr[i] + 2);
+        } else if(strncmp(args.arr[i], "-g", sizeof("-g")) == 0) {
+            group = true;
+        } else if(strncmp(args.arr[i], "-u", sizeof("-u")) == 0) {
+            group = false;
+        } else if(strncmp(args.arr[i], "--", sizeof("--")) == 0) {
+            i++;
             break;
+        } else {
+            break;
+        }
     }
 
-    strlcpy(stub, pathStr + j + 1, PATH_MAX);
-    Vector autofill = findAutofillStrings(stub, strnlen(stub, PATH_MAX), path);
+    size_t cmdStart = i, cmdEnd = i;
+    while(cmdEnd < args.size && strncmp(args.arr[cmdEnd], ":::", sizeof(":::")) != 0)
+        cmdEnd++;
 
-    if(autofill.size == 1) {
-        memset(buffer, 0, *i);
+    if(cmdStart == cmdEnd || maxJobs <= 0) {
+        fprintf(stderr, "parallel: usage: parallel [-j N] [-g|-u] command... [::: inputs...]\n");
+        return 2;
+    }
 
-        for(size_t j = 0; j < toks.size - 1; j++) {
-            strlcat(buffer, toks.arr[j], size);
-            strlcat(buffer, " ", size);
+    StringPool inputs = stringPoolInit(0);
+    if(cmdEnd < args.size) {
+        for(size_t j = cmdEnd + 1; j < args.size; j++)
+            stringPoolInsert(&inputs, args.arr[j], strlen(args.arr[j]));
+    } else {
+        // Lines of any length, a partial line is carried into the next block
+        char block[BATCH_READ_SIZE];
+        char* line = NULL;
+        size_t lineLen = 0, lineCapacity = 0;
+        ssize_t n;
+        while((n = read(inFd, block, sizeof(block))) > 0 || (n == -1 && errno == EINTR)) {
+            ssize_t start = 0;
+            for(ssize_t j = 0; j <= n; j++) {
+                if(j < n && block[j] != '\n')
+                    continue;
+
+                size_t size = j - start;
+                if(lineLen + size > lineCapacity) {
+                    size_t capacity = lineCapacity ? lineCapacity : CMD_SIZE;
+                    while(capacity < lineLen + size)
+                        capacity *= 2;
+                    char* grown = realloc(line, capacity);
+                    if(!grown) {
+                        perror("parallel");
+                        free(line);
+                        stringPoolDestroy(&inputs);
+                        return 1;
+                    }
+                    line = grown;
+                    lineCapacity = capacity;
+                }
+                if(size > 0)
+                    memcpy(line + lineLen, block + start, size);
+                lineLen += size;
+                start = j + 1;
+
+                if(j < n) {
+                    stringPoolInsert(&inputs, line ? line : "", lineLen);
+                    lineLen = 0;
+                }
+            }
         }
+        if(lineLen > 0)
+            stringPoolInsert(&inputs, line, lineLen);
+        free(line);
+    }
 
-        if(strncmp(path, "./", 3) == 0) {
-            if(strstr(toks.arr[toks.size-1], "./") == toks.arr[toks.size-1]) {
-                strlcat(buffer, path, size); // Only add "./" to the buffer if the user typed it
+    // More slots than inputs would sit idle
+    if((size_t)maxJobs > inputs.size)
+        maxJobs = inputs.size;
+
+    Job** tasks = calloc(maxJobs ? maxJobs : 1, sizeof(Job*));
+    int* outputs = malloc((maxJobs ? maxJobs : 1) * sizeof(int));
+    if(!tasks || !outputs) {
+        perror("parallel");
+        free(tasks);
+        free(outputs);
+        stringPoolDestroy(&inputs);
+        return 1;
+    }
+    for(long j = 0; j < maxJobs; j++)
+        outputs[j] = -1;
+
+    // Once a task dies from Ctrl-C the rest are not started
+    bool interrupted = false;
+    size_t next = 0, failed = 0;
+    long running = 0;
+    while((next < inputs.size && !interrupted) || running > 0) {
+        for(long j = 0; j < maxJobs && next < inputs.size && !interrupted; j++) {
+            if(tasks[j])
+                continue;
+
+            // Grouped output is collected in memory and printed in one piece
+            outputs[j] = group ? memfd_create("parallel", MFD_CLOEXEC) : -1;
+            int taskOut = outputs[j] != -1 ? outputs[j] : (outFd == STDOUT_FILENO ? -1 : outFd);
+            tasks[j] = startParallelTask(args, cmdStart, cmdEnd, stringPoolGet(&inputs, next++), taskOut);
+            if(tasks[j]) {
+                running++;
+            } else {
+                failed++;
+                if(outputs[j] != -1)
+                    close(outputs[j]);
+                outputs[j] = -1;
             }
-        } else {
-            strlcat(buffer, path, size);
         }
 
-        strlcat(buffer, autofill.arr[0], size);
-        *i = strnlen(buffer, size);
-    } else if(autofill.size > 1) {
-        printf("\n");
-        for(size_t j = 0; j < autofill.size; j++)
-            printf("%s ", autofill.arr[j]);
+        if(running == 0)
+            continue;
 
-        memset(buffer, 0, *i);
-        for(size_t j = 0; j < toks.size - 1; j++) {
-            strlcat(buffer, toks.arr[j], size);
-            strlcat(buffer, " ", size);
-        }
+        jobsWaitChange(&jobTable);
 
-        if(strncmp(path, "./", 3) == 0) {
-            if(strstr(toks.arr[toks.size-1], "./") == toks.arr[toks.size-1]) {
-                strlcat(buffer, path, size); // Only add "./" to the buffer if the user typed it
+        for(long j = 0; j < maxJobs; j++) {
+            if(!tasks[j] || tasks[j]->state != JOB_DONE)
+                continue;
+
+            if(outputs[j] != -1) {
+                flushParallelOutput(outputs[j], outFd);
+                close(outputs[j]);
+                outputs[j] = -1;
             }
-        } else {
-            strlcat(buffer, path, size);
-        }
 
-        char lcp[FILENAME_MAX] = {0};
-        findLongestCommonPrefix(autofill, lcp, FILENAME_MAX);
-        strlcat(buffer, lcp, size);
-        *i = strnlen(buffer, size);
+            int status = jobsStatus(tasks[j]);
+            if(status != 0)
+                failed++;
+            if(status == 128 + SIGINT)
+                interrupted = true;
 
-        printf("\n");
-        printPrompt();
+            jobsRemove(&jobTable, tasks[j]);
+            tasks[j] = NULL;
+            running--;
+        }
     }
 
-    free(path);
-    vectorDestroy(&toks);
-    vectorDestroy(&autofill);
+    free(tasks);
+    free(outputs);
+    stringPoolDestroy(&inputs);
+
+    // Like GNU parallel, the status is the number of failed tasks
+    return failed > 100 ? 101 : (int)failed;
 }
 
 /************************************************
- * printPrompt: Create a prompt from the username
- *              and path to current working
- *              directory
+ * builtinExport:   Mark variables for passing to
+ *                  children, optionally setting
+ *                  them first. With no arguments
+ *                  the exported variables are
+ *                  listed
  *
- * return:      Length of the prompt
+ *                  export NAME[=value]...
+ *
+ * args:            Vector holding the command and
+ *                  its arguments
+ *
+ * inFd:            Stdin of the stage, unused
+ *
+ * outFd:           Stdout of the stage
+ *
+ * return:          Exit status
  ***********************************************/
-size_t printPrompt(void)
+int builtinExport(Vector args, int inFd, int outFd)
 {
-    char user[_SC_LOGIN_NAME_MAX] = {0};
-    int ret = getlogin_r(user, _SC_LOGIN_NAME_MAX);
-    if(ret != 0) {
-        perror("getlogin_r");
-        return 0;
-    }
-    strcat(user, ":");
+    (void)inFd;
 
-    char cwd[PATH_MAX] = {0};
-    char* result = getcwd(cwd, PATH_MAX);
-    if(!result) {
-        perror("getcwd");
+    if(args.size == 1) {
+        for(char** env = varsEnviron(&shellVars); *env; env++)
+            dprintf(outFd, "export %s\n", *env);
         return 0;
     }
-    strcat(cwd, "$ ");
 
-    char* homeDir = getenv("HOME");
-    if(homeDir) {
-        if(strstr(cwd, homeDir) == cwd) {
-            char temp[PATH_MAX] = {0};
-            strlcpy(temp, "~", PATH_MAX);
-            strlcat(temp, cwd + strnlen(homeDir, PATH_MAX), PATH_MAX);
-            strlcpy(cwd, temp, PATH_MAX);
+    int status = 0;
+    for(size_t i = 1; i < args.size; i++) {
+        const char* eq = strchr(args.arr[i], '=');
+        size_t length = eq ? (size_t)(eq - args.arr[i]) : strlen(args.arr[i]);
+        if(!varsValidName(args.arr[i], length)) {
+            fprintf(stderr, "export: '%s': not a valid identifier\n", args.arr[i]);
+            status = 1;
+            continue;
         }
+
+        // Exporting an unset name is allowed and does nothing
+        if(eq && !setVariable(args.arr[i], length, eq + 1, true))
+            status = 1;
+        else if(!eq)
+            varsExport(&shellVars, args.arr[i], length);
     }
 
-    printf(CLEAR_LINE);
-    printf("\033[G");
-    printf(COLOR_BLUE "%s", user);
-    printf(COLOR_GREEN "%s", cwd);
-    printf(CLEAR_COLOR);
+    return status;
+}
+
+/************************************************
+ * builtinUnset:    Remove shell variables
+ *
+ * args:            Vector holding the command and
+ *                  the names to remove
+ *
+ * inFd:            Stdin of the stage, unused
+ *
+ * outFd:           Stdout of the stage, unused
+ *
+ * return:          Exit status
+ ***********************************************/
+int builtinUnset(Vector args, int inFd, int outFd)
+{
+    (void)inFd;
+    (void)outFd;
+
+    int status = 0;
+    for(size_t i = 1; i < args.size; i++) {
+        size_t length = strlen(args.arr[i]);
+        if(!varsValidName(args.arr[i], length)) {
+            fprintf(stderr, "unset: '%s': not a valid identifier\n", args.arr[i]);
+            status = 1;
+            continue;
+        }
+
+        varsUnset(&shellVars, args.arr[i], length);
+        if(strncmp(args.arr[i], "PATH", sizeof("PATH")) == 0)
+            pathCacheSetPath(&commandCache, NULL);
+    }
 
-    return strnlen(user, _SC_LOGIN_NAME_MAX) + strnlen(cwd, PATH_MAX);
+    return status;
 }
 
 /************************************************
- * tokenizeInput:   Split the input buffer into
- *                  tokens on spaces
+ * startParallelTask:   Launch one task of a
+ *                      parallel run in the
+ *                      background
  *
- * input:           Buffer containing input
- *                  string
+ * args:                Arguments of the parallel
+ *                      builtin
  *
- * size:            Size of input string
+ * cmdStart:            Index of the command
  *
- * return:          A vector containing input
- *                  tokens
+ * cmdEnd:              Index one past the end of
+ *                      the command template
+ *
+ * input:               Input for this task
+ *
+ * outFd:               Descriptor for stdout, -1
+ *                      to inherit the shell's
+ *
+ * return:              Job tracking the task,
+ *                      NULL if it failed to start
  ***********************************************/
-Vector tokenizeInput(char* input, size_t size)
+Job* startParallelTask(Vector args, size_t cmdStart, size_t cmdEnd, const char* input, int outFd)
 {
-    if(!input)
-        return (Vector){0, 0, 0};
+    size_t argc = cmdEnd - cmdStart;
+    char* argv[argc + 2];
+    bool substituted = false;
+    size_t inputLen = strlen(input);
+
+    for(size_t i = 0; i < argc; i++) {
+        const char* tmpl = args.arr[cmdStart + i];
+
+        size_t count = 0;
+        for(const char* p = strstr(tmpl, "{}"); p; p = strstr(p + 2, "{}"))
+            count++;
+
+        argv[i] = malloc(strlen(tmpl) + count * inputLen + 1);
+        if(!argv[i]) {
+            for(size_t j = 0; j < i; j++)
+                free(argv[j]);
+            return NULL;
+        }
 
-    Vector tokens = vectorInit(0);
+        char* out = argv[i];
+        const char* p = tmpl;
+        const char* match;
+        while((match = strstr(p, "{}"))) {
+            memcpy(out, p, match - p);
+            out += match - p;
+            memcpy(out, input, inputLen);
+            out += inputLen;
+            p = match + 2;
+        }
+        strcpy(out, p);
 
-    char* tok = strtok(input, " \n");
-    while(tok) {
-        vectorInsert(&tokens, tok, strnlen(tok, size));
-        tok = strtok(NULL, " \n");
+        if(count > 0)
+            substituted = true;
     }
 
-    return tokens;
+    argv[argc] = substituted ? NULL : strdup(input);
+    argv[argc + 1] = NULL;
+
+    Job* job = jobsAdd(&jobTable, argv[0], 1);
+    if(job) {
+        pid_t pid = launchProcess(argv, -1, outFd, -1);
+        jobsAddProcess(job, pid, argv[0]);
+        if(pid == -1) {
+            jobsRemove(&jobTable, job);
+            job = NULL;
+        }
+    }
+
+    for(size_t i = 0; i < argc + 1; i++)
+        free(argv[i]);
+
+    return job;
 }
 
 /************************************************
- * processTokens:   Process tokens which are not
- *                  built-in shell commands
+ * flushParallelOutput: Copy a finished task's
+ *                      collected output to stdout
+ *                      in the kernel, falling back
+ *                      to read/write for outputs
+ *                      sendfile rejects
  *
- * tokens:          Array of vectors holding the
- *                  tokenized user input
+ * fd:                  memfd holding the output
  *
- * numCmds:         Number of commands entered
+ * outFd:               Stdout of the stage
  ***********************************************/
-void processTokens(Vector* tokens, int numCmds)
+void flushParallelOutput(int fd, int outFd)
 {
-    if(numCmds == 0)
-        return;
-
-    for(int i = 0; i < numCmds; i++) {
-        if(tokens[i].capacity == 0)
+    off_t size = lseek(fd, 0, SEEK_END);
+    off_t offset = 0;
+    while(offset < size) {
+        ssize_t n = sendfile(outFd, fd, &offset, size - offset);
+        if(n == -1 && errno == EINTR)
             continue;
+        if(n <= 0)
+            break;
+    }
 
-        char* cmd = tokens[i].arr[0];
+    char block[BATCH_READ_SIZE];
+    while(offset < size) {
+        ssize_t n = pread(fd, block, sizeof(block), offset);
+        if(n <= 0 || !writeAll(outFd, block, n))
+            break;
+        offset += n;
+    }
+}
 
-        int fds[2] = {0};
-        if(pipe(fds)) {
-            perror("pipe");
-            return;
+/************************************************
+ * mayBlock:    Check whether a builtin stage
+ *              could wait on input that never
+ *              ends. The shell ignores SIGINT,
+ *              so cat, and parallel without
+ *              ":::", only run in-process when
+ *              they read regular files or the
+ *              pipe of an earlier stage
+ *
+ * args:        Vector holding the command and
+ *              its arguments
+ *
+ * shellStdin:  Whether the stage reads the
+ *              shell's stdin
+ *
+ * return:      Whether it must run in a child
+ ***********************************************/
+bool mayBlock(Vector args, bool shellStdin)
+{
+    bool cat = strncmp(args.arr[0], "cat", sizeof("cat")) == 0;
+    bool parallel = strncmp(args.arr[0], "parallel", sizeof("parallel")) == 0;
+    if(!cat && !parallel)
+        return false;
+
+    struct stat st;
+    bool stdinSafe = !shellStdin || (fstat(STDIN_FILENO, &st) == 0 && S_ISREG(st.st_mode));
+    if(parallel) {
+        for(size_t i = 1; i < args.size; i++) {
+            if(strncmp(args.arr[i], ":::", sizeof(":::")) == 0)
+                return false;
         }
+        return !stdinSafe;
+    }
+    if(args.size == 1)
+        return !stdinSafe;
 
-        pid_t id = fork();
-        if(id == 0) { // Child
-            if(numCmds > 1 && i < numCmds - 1) {
-                dup2(fds[1], STDOUT_FILENO);
-                close(fds[0]);
-            }
-            if(execvp(cmd, tokens[i].arr)) {
-                perror(cmd);
-                exit(1);
-            }
-        } else { // Parent
-            if(numCmds > 1) {
-                dup2(fds[0], STDIN_FILENO);
-                close(fds[1]);
-            }
-            waitpid(id, NULL, 0);
+    for(size_t i = 1; i < args.size; i++) {
+        if(strncmp(args.arr[i], "-", sizeof("-")) == 0) {
+            if(!stdinSafe)
+                return true;
+        }
+        else if(stat(args.arr[i], &st) == 0 && !S_ISREG(st.st_mode)) {
+            return true;
         }
     }
+
+    return false;
 }
 
 /************************************************
- * checkBuiltinCmd: Check the user commands for
- *                  builtin shell commands
+ * sameFile:    Check whether a descriptor refers
+ *              to an already stat'd file
  *
- * tokens:          Array of vectors holding the
- *                  tokenized user input
+ * fd:          Descriptor to check
  *
- * numCmds:         Number of commands entered
+ * pStat:       Status of the other file
  *
- * return:          Is the current command a
- *                  shell builtin command
+ * return:      Whether both are the same file
  ***********************************************/
-bool checkBuiltinCmd(Vector* tokens, int numCmds)
+bool sameFile(int fd, const struct stat* pStat)
 {
-    if(!tokens || numCmds == 0)
-        return false;
+    struct stat st;
+    return fstat(fd, &st) == 0 && st.st_dev == pStat->st_dev && st.st_ino == pStat->st_ino;
+}
 
-    bool status;
-    for(int i = 0; i < numCmds; i++) {
-        status = false;
-        if(strncmp(tokens[i].arr[0], "cd", sizeof("cd")) == 0) {
-            static char prevDir[PATH_MAX];
-            char temp[PATH_MAX] = {0};
-
-            if(tokens[i].size == 1) {
-                if(!getcwd(temp, PATH_MAX)) {
-                    perror("getcwd");
-                    return false;
-                }
-                char* homeDir = getenv("HOME");
-                if(chdir(homeDir) != 0)
-                    strlcpy(prevDir, temp, PATH_MAX);
-            } else if(strncmp(tokens[i].arr[1], "-", sizeof("-")) == 0) {
-                if(strnlen(prevDir, PATH_MAX) == 0) {
-                    printf("cd: Previous Directory is not set\n");
-                } else {
-                    strlcpy(temp, prevDir, PATH_MAX);
-                    getcwd(prevDir, PATH_MAX);
-                    chdir(temp);
-                }
-            } else {
-                if(!getcwd(temp, PATH_MAX)) {
-                    perror("getcwd");
-                    return false;
-                } else if(chdir(tokens[i].arr[1]) == 0) {
-                    strlcpy(prevDir, temp, PATH_MAX);
-                } else {
-                    printf("cd: %s is not a file or directory\n", tokens[i].arr[1]);
-                }
-            }
-            status = true;
-        } else if(strncmp(tokens[i].arr[0], "exit", sizeof("exit")) == 0) {
-            if(tokens[i].size != 1) {
-                printf("exit: Command takes no arguments\n");
-                return false;
-            }
+/************************************************
+ * builtinCat:  Concatenate files without forking.
+ *              Data is moved with copy_file_range
+ *              or splice where the descriptors
+ *              allow it
+ *
+ * args:        Vector holding the command and the
+ *              files, "-" or no files reads inFd
+ *
+ * inFd:        Stdin of the stage
+ *
+ * outFd:       Stdout of the stage
+ *
+ * return:      Exit status
+ ***********************************************/
+int builtinCat(Vector args, int inFd, int outFd)
+{
+    // Appending a file to itself would never reach its end
+    struct stat outStat;
+    bool outRegular = fstat(outFd, &outStat) == 0 && S_ISREG(outStat.st_mode);
+
+    if(args.size == 1) {
+        if(outRegular && sameFile(inFd, &outStat)) {
+            fprintf(stderr, "cat: -: input file is output file\n");
+            return 1;
+        }
+        if(fdCopy(inFd, outFd) == -1 && errno != EPIPE) {
+            perror("cat");
+            return 1;
+        }
+        return 0;
+    }
 
-            tcsetattr(STDIN_FILENO, TCSANOW, &old);
-            exit(0);
-        } else if(strncmp(tokens[i].arr[0], "exec", sizeof("exec")) == 0) {
-            int wstatus = 0;
-            int fds[2] = {0};
-            if(numCmds != 1) {
-                if(pipe(fds)) {
-                    perror("pipe");
-                    return false;
-                }
-            }
+    int status = 0;
+    for(size_t i = 1; i < args.size; i++) {
+        bool useStdin = strncmp(args.arr[i], "-", sizeof("-")) == 0;
+        int fd = useStdin ? inFd : open(args.arr[i], O_RDONLY | O_CLOEXEC);
+        if(fd == -1) {
+            fprintf(stderr, "cat: %s: %s\n", args.arr[i], strerror(errno));
+            status = 1;
+            continue;
+        }
 
-            pid_t pid = fork();
-            switch(pid) {
-                case -1:
-                    close(fds[0]);
-                    close(fds[1]);
-                    break;
-                case 0:
-                    if(numCmds > 1 && i != numCmds - 1) {
-                        dup2(fds[1], STDOUT_FILENO);
-                        close(fds[0]);
-                    }
-                    execvp(tokens[i].arr[1], tokens[i].arr + 1);
-                    break;
-                default:
-                    if(numCmds > 1) {
-                        dup2(fds[0], STDIN_FILENO);
-                        close(fds[1]);
-                    }
-                    waitpid(pid, &wstatus, 0);
-                    status = true;
-            }
+        if(outRegular && sameFile(fd, &outStat)) {
+            fprintf(stderr, "cat: %s: input file is output file\n", args.arr[i]);
+            if(!useStdin)
+                close(fd);
+            status = 1;
+            continue;
+        }
+
+        ssize_t copied = fdCopy(fd, outFd);
+        int err = errno;
+        if(!useStdin)
+            close(fd);
+
+        if(copied == -1) {
+            if(err == EPIPE) // Reader went away, stop like a killed cat would
+                return 1;
+            fprintf(stderr, "cat: %s: %s\n", args.arr[i], strerror(err));
+            status = 1;
         }
     }
 
@@ -548,127 +3711,69 @@ void homeDirSubstitution(char** pInput, size_t size)
     char* input = *pInput;
     char homeDir[PATH_MAX] = {0};
 
-    if(input[0] == '~') {
-        char uname[_SC_LOGIN_NAME_MAX] = {0};
-        size_t j = 1;
-        while(input[j] != '/' && j < strnlen(input, CMD_SIZE)) {
-            uname[j-1] = input[j];
-            j++;
-        }
-
-        if(strnlen(uname, _SC_LOGIN_NAME_MAX) != 0) {
-            snprintf(homeDir, PATH_MAX, "/home/%s/", uname);
-        } else {
-            strlcpy(homeDir, getenv("HOME"), PATH_MAX);
-
-            if(strnlen(homeDir, PATH_MAX) == 0) {
-                struct passwd* user = getpwuid(getuid());
-                strlcpy(homeDir, user->pw_dir, PATH_MAX);
-            }
-        }
+    size_t j = homeDirPrefix(input, strnlen(input, size), homeDir, PATH_MAX);
+    if(j == 0)
+        return;
 
-        size_t strSize = strnlen(homeDir, PATH_MAX) + strnlen(input + j, CMD_SIZE) + 1;
-        char* str = calloc(strSize, sizeof(char));
-        if(!str)
-            return;
+    size_t strSize = strnlen(homeDir, PATH_MAX) + strnlen(input + j, CMD_SIZE) + 1;
+    char* str = calloc(strSize, sizeof(char));
+    if(!str)
+        return;
 
-        strlcpy(str, homeDir, strSize);
-        strlcat(str, input + j, strSize);
+    strlcpy(str, homeDir, strSize);
+    strlcat(str, input + j, strSize);
 
-        free(input);
-        *pInput = str;
-    }
+    free(input);
+    *pInput = str;
 }
 
 /************************************************
- * checkRedirection:    Search the input tokens
- *                      for input or output
- *                      redirection, '<' or '>'
+ * homeDirPrefix:   Resolve a leading "~" or
+ *                  "~user" to a home directory
  *
- * tokens:              Vector of input tokens
+ * input:           String to check
  *
- * return:              Reports if any
- *                      redirection happened
- ***********************************************/
-bool checkRedirection(Vector tokens)
-{
-    if(tokens.size == 0)
-        return false;
-
-    bool inputRedir = false, outputRedir = false;
-    char inputFile[FILENAME_MAX] = {0};
-    char outputFile[FILENAME_MAX] = {0};
-
-    for(size_t i = 0; i < tokens.size; i++) {
-        if(!inputRedir && strncmp(tokens.arr[i], "<", 2) == 0) { // Inut Redirection
-            if(i + 1 < tokens.size) {
-                strncpy(inputFile, tokens.arr[i+1], FILENAME_MAX);
-                free(tokens.arr[i]);
-                free(tokens.arr[i+1]);
-
-                size_t j = i + 2;
-                for(; j < tokens.size; j++)
-                    tokens.arr[j-2] = tokens.arr[j];
-
-                tokens.arr[j-1] = NULL;
-                tokens.arr[j-2] = NULL;
-                tokens.size -= 2;
-                inputRedir = true;
-            }
-        } else if(!outputRedir && strncmp(tokens.arr[i], ">", 2) == 0) { // Output Redirection
-            if(i + 1 < tokens.size) {
-                strncpy(outputFile, tokens.arr[i+1], FILENAME_MAX);
-                free(tokens.arr[i]);
-                free(tokens.arr[i+1]);
-
-                size_t j = i + 2;
-                for(; j < tokens.size; j++)
-                    tokens.arr[j-2] = tokens.arr[j];
-
-                tokens.arr[j-1] = NULL;
-                tokens.arr[j-2] = NULL;
-                tokens.size -= 2;
-
-                outputRedir = true;
-            }
-        }
-    }
-
-    if(inputRedir) {
-        int fd = open(inputFile, O_RDONLY, 0666);
-        if(fd)
-            dup2(fd, STDIN_FILENO);
-    }
-
-    if(outputRedir) {
-        int fd = open(outputFile, O_RDWR | O_CREAT, 0666);
-        if(fd)
-            dup2(fd, STDOUT_FILENO);
-    }
-
-    return inputRedir || outputRedir;
-}
-
-/************************************************
- * countPipes:  Counts the number of pipes in the
- *              input tokens
+ * size:            Number of bytes in input
+ *
+ * homeDir:         Receives the home directory
  *
- * tokens:      Vector of input tokens
+ * homeSize:        Size of homeDir
  *
- * return:      Number of pipes in input
+ * return:          Number of bytes of input that
+ *                  were replaced, 0 if input has
+ *                  no plain "~" prefix
  ***********************************************/
-int countPipes(Vector tokens)
+size_t homeDirPrefix(const char* input, size_t size, char* homeDir, size_t homeSize)
 {
-    if(tokens.size == 0)
+    if(!input || size == 0 || input[0] != '~')
         return 0;
 
-    int numPipes = 0;
-    for(size_t i = 0; i < tokens.size; i++) {
-        if(strncmp(tokens.arr[i], "|", 2) == 0)
-            numPipes++;
+    char uname[_SC_LOGIN_NAME_MAX] = {0};
+    size_t j = 1;
+    while(j < size && input[j] != '/') {
+        // A quoted user name is not expanded
+        if(strchr("'\"\\$", input[j]) || j > _SC_LOGIN_NAME_MAX - 1)
+            return 0;
+
+        uname[j-1] = input[j];
+        j++;
+    }
+
+    if(strnlen(uname, _SC_LOGIN_NAME_MAX) != 0) {
+        snprintf(homeDir, homeSize, "/home/%s", uname);
+    } else {
+        const char* home = varsGet(&shellVars, "HOME", 4);
+        if(home && home[0] != '\0') {
+            strlcpy(homeDir, home, homeSize);
+        } else {
+            struct passwd* user = getpwuid(getuid());
+            if(!user)
+                return 0;
+            strlcpy(homeDir, user->pw_dir, homeSize);
+        }
     }
 
-    return numPipes;
+    return j;
 }
 
 /************************************************
@@ -709,9 +3814,12 @@ void extractPath(char* input, int inputSize, char** path)
 }
 
 /************************************************
- * findAutofillStrings: Create a vector of files
- *                      and directories which
- *                      start with input
+ * findAutofillStrings: Create a sorted pool of
+ *                      files and directories which
+ *                      start with input. If none
+ *                      do, the names containing its
+ *                      characters in order are
+ *                      ranked instead, best first
  *
  * input:               String to find matches
  *                      for
@@ -721,58 +3829,51 @@ void extractPath(char* input, int inputSize, char** path)
  * path:                Path to search for
  *                      matches
  *
- * return:              Vector of all matches
+ * return:              Pool of all matches
  ***********************************************/
-Vector findAutofillStrings(const char* input, size_t size, const char* path)
+StringPool findAutofillStrings(const char* input, size_t size, const char* path)
 {
-    DIR* dirp = opendir(path);
-    if(!dirp || size == 0)
-        return (Vector){0, 0, 0};
+    if(size == 0)
+        return (StringPool){0};
 
-    Vector autofills = vectorInit(0);
+    // Shares listings with glob expansion, so repeated tabs don't re-read
+    DirListing* listing = dirCacheGet(&dirCache, path);
+    if(!listing)
+        return (StringPool){0};
+
+    StringPool autofills = stringPoolInit(0);
     if(autofills.capacity == 0) {
-        closedir(dirp);
+        dirCacheRelease(listing);
         return autofills;
     }
 
-    struct dirent* dent;
-    while((dent = readdir(dirp))) {
-        if(size > strnlen(dent->d_name, NAME_MAX))
-            continue;
-
-        bool isMatch = true;
-        for(size_t i = 0; i < size; i++) {
-            if(input[i] != dent->d_name[i]) {
-                isMatch = false;
-                break;
-            }
-        }
-
-        if(isMatch) {
-            // 256 is the size of d_name buffer
-            size_t len = strnlen(dent->d_name, 256) + 2;
-            char str[len];
-            struct stat st = {0};
-
-            if(dent->d_type == DT_LNK) {
-                char temp[PATH_MAX] = {0};
-                strlcpy(temp, path, PATH_MAX);
-                strlcat(temp, dent->d_name, PATH_MAX);
-
-                stat(temp, &st);
-            }
-
-            if(dent->d_type == DT_DIR || (st.st_mode & S_IFDIR)) {
-                strlcpy(str, dent->d_name, len);
-                strlcat(str, "/", len);
-                vectorInsert(&autofills, str, len);
-            } else {
-                vectorInsert(&autofills, dent->d_name, strnlen(dent->d_name, NAME_MAX));
-            }
+    // Matches come out of the sorted order already sorted
+    size_t first = 0;
+    size_t last = 0;
+    uint32_t* ranked = NULL;
+    dirListingPrefix(listing, input, size, &first, &last);
+    if(first == last && dirListingFuzzy(listing, input, size, &ranked, &last))
+        first = 0;
+
+    for(size_t j = first; j < last; j++) {
+        size_t i = ranked ? ranked[j] : listing->sorted[j];
+        const char* name = stringPoolGet(&listing->names, i);
+        size_t nameLen = stringPoolLength(&listing->names, i);
+
+        char entryPath[PATH_MAX];
+        snprintf(entryPath, sizeof(entryPath), "%s%s", path, name);
+        if(dirListingIsDir(listing, i, entryPath)) {
+            char str[nameLen + 2];
+            memcpy(str, name, nameLen);
+            str[nameLen] = '/';
+            stringPoolInsert(&autofills, str, nameLen + 1);
+        } else {
+            stringPoolInsert(&autofills, name, nameLen);
         }
     }
 
-    closedir(dirp);
+    free(ranked);
+    dirCacheRelease(listing);
     return autofills;
 }
 
@@ -785,30 +3886,18 @@ Vector findAutofillStrings(const char* input, size_t size, const char* path)
  *
  * size:                    Size of buffer
  *********************************************************/
-void findLongestCommonPrefix(Vector autofills, char* buffer, size_t size)
+void findLongestCommonPrefix(const StringPool* autofills, char* buffer, size_t size)
 {
-    if(!buffer)
+    if(!buffer || !autofills || autofills->size == 0)
         return;
 
-    size_t count;
-    size_t min = INT32_MAX;
-    for(size_t i = 0; i < autofills.size; i++) {
-        size_t iSize = strnlen(autofills.arr[i], PATH_MAX);
-        if(iSize < min)
-            min = iSize;
-    }
-
-    size_t i = 0;
-    for(; i < min; i++) {
-        char c = autofills.arr[0][i];
-        for(size_t j = 1; j < autofills.size; j++) {
-            if(autofills.arr[j][i] != c) {
-                goto findLongestCommonPrefixEnd;
-            }
-        }
+    // Each comparison only needs to cover what is still common to all
+    const char* first = stringPoolGet(autofills, 0);
+    size_t count = stringPoolLength(autofills, 0);
+    for(size_t j = 1; j < autofills->size && count > 0; j++) {
+        size_t length = stringPoolLength(autofills, j);
+        count = matchCommonPrefix(first, stringPoolGet(autofills, j), count < length ? count : length);
     }
 
-findLongestCommonPrefixEnd:
-    count = size < i ? size : i;
-    strncpy(buffer, autofills.arr[0], count);
+    strncpy(buffer, first, size < count ? size : count);
 }
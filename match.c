@@ -0,0 +1,228 @@
+#include <string.h>
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#include "match.h"
+
+#define SCORE_MATCH         16
+#define SCORE_BOUNDARY      10
+#define SCORE_CONSECUTIVE   12
+#define SCORE_CASE          1
+#define GAP_MAX             8
+
+typedef size_t (*FindFunc)(const char* text, size_t from, size_t length, unsigned char c);
+
+static size_t findScalar(const char* text, size_t from, size_t length, unsigned char c);
+static size_t findFirst(const char* text, size_t from, size_t length, unsigned char c);
+
+// Resolved to the widest kernel the CPU has on first use
+static FindFunc findFolded = findFirst;
+
+static inline unsigned char fold(unsigned char c)
+{
+    return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+static inline unsigned char unfold(unsigned char c)
+{
+    return c >= 'a' && c <= 'z' ? c - ('a' - 'A') : c;
+}
+
+static inline bool isBoundary(unsigned char previous, unsigned char c)
+{
+    return previous == '/' || previous == '-' || previous == '_' || previous == '.' || previous == ' '
+        || (previous >= 'a' && previous <= 'z' && c >= 'A' && c <= 'Z');
+}
+
+/************************************************
+ * matchScore:  Rank how well a query matches a
+ *              name when its characters only need
+ *              to appear in order, ignoring case.
+ *              Matches at word starts and runs of
+ *              consecutive characters score higher,
+ *              gaps cost a little
+ *
+ * text:        Candidate to score
+ *
+ * length:      Length of text
+ *
+ * query:       Characters typed
+ *
+ * queryLength: Length of query
+ *
+ * return:      The score, higher is better, or
+ *              MATCH_NONE if text doesn't contain
+ *              the query
+ ***********************************************/
+int32_t matchScore(const char* text, size_t length, const char* query, size_t queryLength)
+{
+    int32_t score = 0;
+    size_t next = 0;
+    for(size_t k = 0; k < queryLength; k++) {
+        size_t pos = findFolded(text, next, length, fold(query[k]));
+        if(pos == length)
+            return MATCH_NONE;
+
+        size_t gap = pos - next;
+        score += SCORE_MATCH;
+        if(pos == 0 || isBoundary(text[pos - 1], text[pos]))
+            score += SCORE_BOUNDARY;
+        if(k > 0 && gap == 0)
+            score += SCORE_CONSECUTIVE;
+        else
+            score -= gap < GAP_MAX ? gap : GAP_MAX;
+        if(text[pos] == query[k])
+            score += SCORE_CASE;
+
+        next = pos + 1;
+    }
+
+    return score;
+}
+
+/************************************************
+ * matchSubsequence:    Check whether a query's
+ *                      characters appear in text
+ *                      in order, ignoring case
+ *
+ * text:                Text to search
+ *
+ * length:              Length of text
+ *
+ * query:               Characters to find
+ *
+ * queryLength:         Length of query
+ *
+ * return:              Whether all were found
+ ***********************************************/
+bool matchSubsequence(const char* text, size_t length, const char* query, size_t queryLength)
+{
+    size_t next = 0;
+    for(size_t k = 0; k < queryLength; k++) {
+        size_t pos = findFolded(text, next, length, fold(query[k]));
+        if(pos == length)
+            return false;
+        next = pos + 1;
+    }
+
+    return true;
+}
+
+/************************************************
+ * matchCommonPrefix:   Count the leading bytes
+ *                      two strings share, comparing
+ *                      a word at a time
+ *
+ * a:                   First string
+ *
+ * b:                   Second string
+ *
+ * length:              Bytes readable in both
+ *
+ * return:              Length of the common prefix
+ ***********************************************/
+size_t matchCommonPrefix(const char* a, const char* b, size_t length)
+{
+    size_t i = 0;
+    for(; i + sizeof(uint64_t) <= length; i += sizeof(uint64_t)) {
+        uint64_t x;
+        uint64_t y;
+        memcpy(&x, a + i, sizeof(x));
+        memcpy(&y, b + i, sizeof(y));
+        if(x != y) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            return i + (__builtin_ctzll(x ^ y) >> 3);
+#else
+            return i + (__builtin_clzll(x ^ y) >> 3);
+#endif
+        }
+    }
+
+    while(i < length && a[i] == b[i])
+        i++;
+
+    return i;
+}
+
+/************************************************
+ * findScalar:  Find the next byte that folds to c
+ *
+ * text:        Text to search
+ *
+ * from:        Where to start
+ *
+ * length:      Length of text
+ *
+ * c:           Lower case byte to find
+ *
+ * return:      Its position, or length if there
+ *              is none
+ ***********************************************/
+static size_t findScalar(const char* text, size_t from, size_t length, unsigned char c)
+{
+    for(size_t i = from; i < length; i++) {
+        if(fold(text[i]) == c)
+            return i;
+    }
+
+    return length;
+}
+
+#if defined(__SSE2__)
+// Compare 16 bytes against both cases of c at once
+static size_t findSse2(const char* text, size_t from, size_t length, unsigned char c)
+{
+    size_t i = from;
+    if(length - from >= 16) {
+        __m128i lower = _mm_set1_epi8((char)c);
+        __m128i upper = _mm_set1_epi8((char)unfold(c));
+        for(; i + 16 <= length; i += 16) {
+            __m128i bytes = _mm_loadu_si128((const __m128i*)(text + i));
+            __m128i hits = _mm_or_si128(_mm_cmpeq_epi8(bytes, lower), _mm_cmpeq_epi8(bytes, upper));
+            unsigned mask = _mm_movemask_epi8(hits);
+            if(mask)
+                return i + __builtin_ctz(mask);
+        }
+    }
+
+    return findScalar(text, i, length, c);
+}
+
+// Finishes its own tail, since handing a dirty upper half to the legacy
+// SSE kernel costs more than the whole search of a short name
+__attribute__((target("avx2")))
+static size_t findAvx2(const char* text, size_t from, size_t length, unsigned char c)
+{
+    size_t i = from;
+    if(length - from >= 32) {
+        __m256i lower = _mm256_set1_epi8((char)c);
+        __m256i upper = _mm256_set1_epi8((char)unfold(c));
+        for(; i + 32 <= length; i += 32) {
+            __m256i bytes = _mm256_loadu_si256((const __m256i*)(text + i));
+            __m256i hits = _mm256_or_si256(_mm256_cmpeq_epi8(bytes, lower), _mm256_cmpeq_epi8(bytes, upper));
+            unsigned mask = _mm256_movemask_epi8(hits);
+            if(mask)
+                return i + __builtin_ctz(mask);
+        }
+    }
+
+    for(; i < length; i++) {
+        if(fold(text[i]) == c)
+            return i;
+    }
+
+    return length;
+}
+#endif
+
+static size_t findFirst(const char* text, size_t from, size_t length, unsigned char c)
+{
+#if defined(__SSE2__)
+    __builtin_cpu_init();
+    findFolded = __builtin_cpu_supports("avx2") ? findAvx2 : findSse2;
+#else
+    findFolded = findScalar;
+#endif
+
+    return findFolded(text, from, length, c);
+}
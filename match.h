@@ -0,0 +1,14 @@
+#ifndef MATCH_H
+#define MATCH_H
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#define MATCH_NONE INT32_MIN
+
+
+int32_t matchScore(const char* text, size_t length, const char* query, size_t queryLength);
+bool matchSubsequence(const char* text, size_t length, const char* query, size_t queryLength);
+size_t matchCommonPrefix(const char* a, const char* b, size_t length);
+
+#endif
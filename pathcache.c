@@ -0,0 +1,268 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <linux/limits.h>
+#include "pathcache.h"
+
+static size_t findSlot(const PathCache* pCache, const char* name);
+static bool resizeTable(PathCache* pCache);
+
+PathCache pathCacheInit(size_t capacity)
+{
+    // Capacity must be a power of two so probing can mask instead of divide
+    size_t cap = 16;
+    while(cap < capacity)
+        cap *= 2;
+
+    PathCache cache = {0, cap, NULL, NULL, NULL};
+    cache.names = calloc(cap, sizeof(char*));
+    cache.paths = calloc(cap, sizeof(char*));
+    if(!cache.names || !cache.paths) {
+        free(cache.names);
+        free(cache.paths);
+        return (PathCache){0, 0, NULL, NULL, NULL};
+    }
+
+    return cache;
+}
+
+/************************************************
+ * pathCacheLookup: Find the absolute path of a
+ *                  command, walking the cache's
+ *                  $PATH only on a miss
+ *
+ * pCache:          Cache to search
+ *
+ * name:            Command name without a '/'
+ *
+ * return:          Resolved path owned by the
+ *                  cache, or NULL if not found
+ ***********************************************/
+const char* pathCacheLookup(PathCache* pCache, const char* name)
+{
+    if(!pCache || !name || pCache->capacity == 0)
+        return NULL;
+
+    size_t slot = findSlot(pCache, name);
+    if(pCache->names[slot])
+        return pCache->paths[slot];
+
+    char path[PATH_MAX] = {0};
+    if(!pathCacheResolve(pCache->pathVar, name, path, PATH_MAX))
+        return NULL;
+
+    // Relative $PATH entries depend on the cwd so they are never cached
+    if(path[0] != '/' || !pathCacheInsert(pCache, name, path))
+        return NULL;
+
+    return pCache->paths[findSlot(pCache, name)];
+}
+
+bool pathCacheInsert(PathCache* pCache, const char* name, const char* path)
+{
+    if(!pCache || !name || !path || pCache->capacity == 0)
+        return false;
+
+    // Keep the load factor under 3/4
+    if((pCache->size + 1) * 4 > pCache->capacity * 3)
+        if(!resizeTable(pCache))
+            return false;
+
+    char* pathCopy = strdup(path);
+    if(!pathCopy)
+        return false;
+
+    size_t slot = findSlot(pCache, name);
+    if(pCache->names[slot]) {
+        free(pCache->paths[slot]);
+        pCache->paths[slot] = pathCopy;
+        return true;
+    }
+
+    pCache->names[slot] = strdup(name);
+    if(!pCache->names[slot]) {
+        free(pathCopy);
+        return false;
+    }
+
+    pCache->paths[slot] = pathCopy;
+    pCache->size++;
+    return true;
+}
+
+bool pathCacheRemove(PathCache* pCache, const char* name)
+{
+    if(!pCache || !name || pCache->capacity == 0)
+        return false;
+
+    size_t mask = pCache->capacity - 1;
+    size_t slot = findSlot(pCache, name);
+    if(!pCache->names[slot])
+        return false;
+
+    free(pCache->names[slot]);
+    free(pCache->paths[slot]);
+    pCache->names[slot] = NULL;
+    pCache->paths[slot] = NULL;
+    pCache->size--;
+
+    // Shift later members of the probe run back so lookups never stop early
+    size_t hole = slot;
+    for(size_t i = (slot + 1) & mask; pCache->names[i]; i = (i + 1) & mask) {
+        size_t home = pathCacheHash(pCache->names[i]) & mask;
+        if(((i - home) & mask) >= ((i - hole) & mask)) {
+            pCache->names[hole] = pCache->names[i];
+            pCache->paths[hole] = pCache->paths[i];
+            pCache->names[i] = NULL;
+            pCache->paths[i] = NULL;
+            hole = i;
+        }
+    }
+
+    return true;
+}
+
+void pathCacheClear(PathCache* pCache)
+{
+    if(!pCache)
+        return;
+
+    for(size_t i = 0; i < pCache->capacity; i++) {
+        free(pCache->names[i]);
+        free(pCache->paths[i]);
+        pCache->names[i] = NULL;
+        pCache->paths[i] = NULL;
+    }
+    pCache->size = 0;
+}
+
+void pathCacheDestroy(PathCache* pCache)
+{
+    if(pCache) {
+        pathCacheClear(pCache);
+        free(pCache->names);
+        free(pCache->paths);
+        free(pCache->pathVar);
+    }
+}
+
+/************************************************
+ * pathCacheSetPath:    Tell the cache which $PATH
+ *                      to search. The whole table
+ *                      is dropped if it differs
+ *                      from the one it was filled
+ *                      from
+ *
+ * pCache:              Cache to update
+ *
+ * pathVar:             New value of $PATH, NULL
+ *                      if it is unset
+ ***********************************************/
+void pathCacheSetPath(PathCache* pCache, const char* pathVar)
+{
+    if(!pCache)
+        return;
+
+    if(pCache->pathVar == pathVar || (pCache->pathVar && pathVar && strcmp(pCache->pathVar, pathVar) == 0))
+        return;
+
+    pathCacheClear(pCache);
+    free(pCache->pathVar);
+    pCache->pathVar = pathVar ? strdup(pathVar) : NULL;
+}
+
+/************************************************
+ * pathCacheResolve:    Walk $PATH looking for an
+ *                      executable regular file
+ *
+ * pathVar:             Value of $PATH, NULL for
+ *                      the default
+ *
+ * name:                Command name
+ *
+ * buffer:              Receives the full path
+ *
+ * size:                Size of buffer
+ *
+ * return:              Whether a match was found
+ ***********************************************/
+bool pathCacheResolve(const char* pathVar, const char* name, char* buffer, size_t size)
+{
+    if(!name || !buffer || name[0] == '\0')
+        return false;
+
+    if(!pathVar)
+        pathVar = "/usr/local/bin:/usr/bin:/bin";
+
+    const char* dir = pathVar;
+    while(true) {
+        const char* end = strchr(dir, ':');
+        size_t dirLen = end ? (size_t)(end - dir) : strlen(dir);
+
+        // An empty entry means the current directory
+        int len;
+        if(dirLen == 0)
+            len = snprintf(buffer, size, "%s", name);
+        else
+            len = snprintf(buffer, size, "%.*s/%s", (int)dirLen, dir, name);
+
+        struct stat st;
+        if(len > 0 && (size_t)len < size && stat(buffer, &st) == 0 &&
+           S_ISREG(st.st_mode) && access(buffer, X_OK) == 0)
+            return true;
+
+        if(!end)
+            break;
+        dir = end + 1;
+    }
+
+    buffer[0] = '\0';
+    return false;
+}
+
+uint64_t pathCacheHash(const char* string)
+{
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for(; *string; string++) {
+        hash ^= (unsigned char)*string;
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+static size_t findSlot(const PathCache* pCache, const char* name)
+{
+    size_t mask = pCache->capacity - 1;
+    size_t slot = pathCacheHash(name) & mask;
+    while(pCache->names[slot] && strcmp(pCache->names[slot], name) != 0)
+        slot = (slot + 1) & mask;
+
+    return slot;
+}
+
+static bool resizeTable(PathCache* pCache)
+{
+    PathCache bigger = pathCacheInit(pCache->capacity * 2);
+    if(bigger.capacity == 0)
+        return false;
+
+    for(size_t i = 0; i < pCache->capacity; i++) {
+        if(!pCache->names[i])
+            continue;
+
+        size_t slot = findSlot(&bigger, pCache->names[i]);
+        bigger.names[slot] = pCache->names[i];
+        bigger.paths[slot] = pCache->paths[i];
+        bigger.size++;
+    }
+
+    free(pCache->names);
+    free(pCache->paths);
+    pCache->names = bigger.names;
+    pCache->paths = bigger.paths;
+    pCache->capacity = bigger.capacity;
+    return true;
+}
@@ -0,0 +1,26 @@
+#ifndef PATHCACHE_H
+#define PATHCACHE_H
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct pathcache_t {
+    size_t size;
+    size_t capacity;
+    char** names;
+    char** paths;
+    char* pathVar;
+} PathCache;
+
+
+PathCache pathCacheInit(size_t capacity);
+const char* pathCacheLookup(PathCache* pCache, const char* name);
+bool pathCacheInsert(PathCache* pCache, const char* name, const char* path);
+bool pathCacheRemove(PathCache* pCache, const char* name);
+void pathCacheClear(PathCache* pCache);
+void pathCacheDestroy(PathCache* pCache);
+void pathCacheSetPath(PathCache* pCache, const char* pathVar);
+bool pathCacheResolve(const char* pathVar, const char* name, char* buffer, size_t size);
+uint64_t pathCacheHash(const char* string);
+
+#endif
@@ -0,0 +1,148 @@
+#include <string.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+#include "process.h"
+
+static double timevalSeconds(struct timeval tv);
+
+/************************************************
+ * processStart:    Record a newly launched
+ *                  child
+ *
+ * pStats:          Entry to fill in
+ *
+ * pid:             Pid of the child, -1 if it
+ *                  failed to start
+ *
+ * name:            Command name used in reports
+ ***********************************************/
+void processStart(ProcStats* pStats, pid_t pid, const char* name)
+{
+    if(!pStats)
+        return;
+
+    memset(pStats, 0, sizeof(ProcStats));
+    pStats->pid = pid;
+    pStats->name = name;
+    clock_gettime(CLOCK_MONOTONIC, &pStats->start);
+
+    if(pid == -1) { // Never started, nothing to reap
+        pStats->status = 127;
+        pStats->done = true;
+        pStats->end = pStats->start;
+    }
+}
+
+/************************************************
+ * processStatus:   Convert a wait status into a
+ *                  shell exit status. Children
+ *                  killed by a signal are
+ *                  reported on stderr
+ *
+ * wstatus:         Status from wait4
+ *
+ * name:            Command name used in the
+ *                  report
+ *
+ * return:          Exit code, or 128 + signal
+ ***********************************************/
+int processStatus(int wstatus, const char* name)
+{
+    if(WIFEXITED(wstatus))
+        return WEXITSTATUS(wstatus);
+
+    if(WIFSIGNALED(wstatus)) {
+        int sig = WTERMSIG(wstatus);
+        // Broken pipes and interrupts are expected in pipelines
+        if(sig != SIGPIPE && sig != SIGINT)
+            fprintf(stderr, "%s: %s%s\n", name ? name : "", strsignal(sig), WCOREDUMP(wstatus) ? " (core dumped)" : "");
+        return 128 + sig;
+    }
+
+    return 1;
+}
+
+/************************************************
+ * processUsageSince:   Resource usage of the
+ *                      shell itself since an
+ *                      earlier getrusage call,
+ *                      used for builtins run
+ *                      in-process
+ *
+ * pUsage:              Receives the difference
+ *
+ * pBefore:             Earlier RUSAGE_SELF sample
+ ***********************************************/
+void processUsageSince(struct rusage* pUsage, const struct rusage* pBefore)
+{
+    if(!pUsage || !pBefore)
+        return;
+
+    struct rusage now;
+    getrusage(RUSAGE_SELF, &now);
+
+    memset(pUsage, 0, sizeof(struct rusage));
+    timersub(&now.ru_utime, &pBefore->ru_utime, &pUsage->ru_utime);
+    timersub(&now.ru_stime, &pBefore->ru_stime, &pUsage->ru_stime);
+    pUsage->ru_maxrss = now.ru_maxrss;
+    pUsage->ru_nvcsw = now.ru_nvcsw - pBefore->ru_nvcsw;
+    pUsage->ru_nivcsw = now.ru_nivcsw - pBefore->ru_nivcsw;
+}
+
+double processElapsed(const struct timespec* start, const struct timespec* end)
+{
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/************************************************
+ * processReport:   Print wall time, CPU time,
+ *                  peak RSS and context switches
+ *                  for each process, followed by
+ *                  a total line
+ *
+ * stream:          Where to write the report
+ *
+ * stats:           Reaped processes
+ *
+ * count:           Number of entries in stats
+ *
+ * wall:            Wall time of the whole
+ *                  command line in seconds
+ ***********************************************/
+void processReport(FILE* stream, const ProcStats* stats, size_t count, double wall)
+{
+    if(!stream)
+        return;
+
+    double userTotal = 0, sysTotal = 0;
+    long rssMax = 0, vcswTotal = 0, ivcswTotal = 0;
+
+    fprintf(stream, "%10s %10s %10s %10s %8s %8s  %s\n", "real", "user", "sys", "maxrss", "vcsw", "ivcsw", "command");
+    for(size_t i = 0; i < count; i++) {
+        const ProcStats* p = &stats[i];
+        double user = timevalSeconds(p->usage.ru_utime);
+        double sys = timevalSeconds(p->usage.ru_stime);
+
+        fprintf(stream, "%9.3fs %9.3fs %9.3fs %8ldKB %8ld %8ld  %s\n",
+                processElapsed(&p->start, &p->end), user, sys, p->usage.ru_maxrss,
+                p->usage.ru_nvcsw, p->usage.ru_nivcsw, p->name ? p->name : "");
+
+        userTotal += user;
+        sysTotal += sys;
+        vcswTotal += p->usage.ru_nvcsw;
+        ivcswTotal += p->usage.ru_nivcsw;
+        if(p->usage.ru_maxrss > rssMax)
+            rssMax = p->usage.ru_maxrss;
+    }
+
+    if(count != 1) {
+        fprintf(stream, "%9.3fs %9.3fs %9.3fs %8ldKB %8ld %8ld  %s\n",
+                wall, userTotal, sysTotal, rssMax, vcswTotal, ivcswTotal, "total");
+    }
+}
+
+static double timevalSeconds(struct timeval tv)
+{
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
@@ -0,0 +1,28 @@
+#ifndef PROCESS_H
+#define PROCESS_H
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/resource.h>
+
+typedef struct procstats_t {
+    pid_t pid;
+    int status;
+    bool done;
+    bool stopped;
+    const char* name;
+    struct timespec start;
+    struct timespec end;
+    struct rusage usage;
+} ProcStats;
+
+
+void processStart(ProcStats* pStats, pid_t pid, const char* name);
+int processStatus(int wstatus, const char* name);
+void processUsageSince(struct rusage* pUsage, const struct rusage* pBefore);
+double processElapsed(const struct timespec* start, const struct timespec* end);
+void processReport(FILE* stream, const ProcStats* stats, size_t count, double wall);
+
+#endif
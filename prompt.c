@@ -0,0 +1,646 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <spawn.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "prompt.h"
+#include "render.h"
+
+#define PROMPT_DEFAULT_SPEC "user cwd"
+#define PROMPT_SLICE_MS     50
+#define GIT_OUTPUT_MAX      4096
+
+#define PROMPT_CLEAR_COLOR  "\033[39m"
+#define PROMPT_RED          "\033[38;5;124m"
+#define PROMPT_GREEN        "\033[38;5;40m"
+#define PROMPT_BLUE         "\033[38;5;27m"
+#define PROMPT_PURPLE       "\033[38;5;135m"
+#define PROMPT_YELLOW       "\033[38;5;178m"
+
+static void parseSpec(Prompt* pPrompt, const char* spec);
+static void abbreviateCwd(Prompt* pPrompt);
+static void cancelJob(Prompt* pPrompt);
+static char** copyEnviron(char** envp);
+static void* gitWorker(void* arg);
+static bool findBranch(const char* cwd, char* branch, size_t size);
+static pid_t spawnGit(const PromptJob* pJob, int outFd);
+static bool runGit(PromptJob* pJob, bool* pDirty, long* pAhead, long* pBehind);
+static void releaseJob(PromptJob* pJob);
+static size_t append(char* out, size_t size, size_t used, const char* text);
+
+Prompt promptInit(void)
+{
+    Prompt prompt = {0};
+    parseSpec(&prompt, NULL);
+    return prompt;
+}
+
+/************************************************
+ * promptUpdate:    Bring the cached segments up to
+ *                  date. The user is looked up
+ *                  once, the directory after a cd,
+ *                  and the rest only when $HOME or
+ *                  $PROMPT_SEGMENTS change
+ *
+ * pPrompt:         Prompt to update
+ *
+ * home:            Value of $HOME, may be NULL
+ *
+ * spec:            Value of $PROMPT_SEGMENTS, a
+ *                  list of user, cwd, git, status
+ *                  and jobs. NULL for "user cwd"
+ *
+ * return:          False if the user or directory
+ *                  can't be found
+ ***********************************************/
+bool promptUpdate(Prompt* pPrompt, const char* home, const char* spec)
+{
+    if(!pPrompt)
+        return false;
+
+    if(pPrompt->user[0] == '\0') {
+        int ret = getlogin_r(pPrompt->user, sizeof(pPrompt->user));
+        if(ret != 0) {
+            errno = ret;
+            perror("getlogin_r");
+            pPrompt->user[0] = '\0';
+            return false;
+        }
+    }
+
+    bool homeChanged = (home == NULL) != (pPrompt->home == NULL) || (home && strcmp(home, pPrompt->home) != 0);
+    if(homeChanged) {
+        free(pPrompt->home);
+        pPrompt->home = home ? strdup(home) : NULL;
+    }
+
+    if(!pPrompt->cwdValid) {
+        if(!getcwd(pPrompt->cwd, sizeof(pPrompt->cwd))) {
+            perror("getcwd");
+            return false;
+        }
+        pPrompt->cwdValid = true;
+        homeChanged = true;
+    }
+
+    if(homeChanged)
+        abbreviateCwd(pPrompt);
+
+    if((spec == NULL) != (pPrompt->spec == NULL) || (spec && strcmp(spec, pPrompt->spec) != 0)) {
+        free(pPrompt->spec);
+        pPrompt->spec = spec ? strdup(spec) : NULL;
+        parseSpec(pPrompt, spec);
+    }
+
+    return true;
+}
+
+/************************************************
+ * promptChdir: Note that the working directory
+ *              changed, so the next update reads
+ *              it again
+ *
+ * pPrompt:     Prompt to invalidate
+ ***********************************************/
+void promptChdir(Prompt* pPrompt)
+{
+    if(pPrompt)
+        pPrompt->cwdValid = false;
+}
+
+/************************************************
+ * promptRefresh:   Start working out the git
+ *                  segment for the current
+ *                  directory in the background.
+ *                  The last answer for this
+ *                  directory is shown until it is
+ *                  done, one for another directory
+ *                  is dropped
+ *
+ * pPrompt:         Updated prompt
+ *
+ * gitPath:         Path of the git executable, NULL
+ *                  to show the branch only
+ *
+ * envp:            Environment for git, copied
+ *
+ * timeout:         Milliseconds git may run before
+ *                  it is killed
+ *
+ * return:          False if the worker couldn't
+ *                  be started
+ ***********************************************/
+bool promptRefresh(Prompt* pPrompt, const char* gitPath, char** envp, int timeout)
+{
+    if(!pPrompt || !pPrompt->useGit || !pPrompt->cwdValid)
+        return false;
+
+    promptPoll(pPrompt);
+    if(!pPrompt->gitCwd || strcmp(pPrompt->gitCwd, pPrompt->cwd) != 0) {
+        free(pPrompt->gitCwd);
+        pPrompt->gitCwd = strdup(pPrompt->cwd);
+        pPrompt->git[0] = '\0';
+        cancelJob(pPrompt);
+    }
+
+    // A job already running for this directory will answer soon enough
+    if(pPrompt->job)
+        return true;
+
+    PromptJob* job = calloc(1, sizeof(PromptJob));
+    if(!job) {
+        perror("calloc");
+        return false;
+    }
+
+    int fds[2] = {-1, -1};
+    job->cwd = strdup(pPrompt->cwd);
+    job->gitPath = gitPath ? strdup(gitPath) : NULL;
+    job->envp = gitPath ? copyEnviron(envp) : NULL;
+    job->timeout = timeout;
+    bool ok = job->cwd && (!gitPath || (job->gitPath && job->envp)) && pipe2(fds, O_CLOEXEC | O_NONBLOCK) == 0;
+    job->fd = fds[0];
+    job->notifyFd = fds[1];
+    atomic_init(&job->refs, 2);
+
+    if(ok) {
+        sigset_t all;
+        sigset_t old;
+        sigfillset(&all);
+        pthread_sigmask(SIG_SETMASK, &all, &old);
+
+        pthread_t thread;
+        pthread_attr_t attr;
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        int ret = pthread_create(&thread, &attr, gitWorker, job);
+        pthread_attr_destroy(&attr);
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+        if(ret != 0) {
+            errno = ret;
+            ok = false;
+        }
+    }
+
+    if(!ok) {
+        perror("promptRefresh");
+        atomic_store(&job->refs, 1);
+        releaseJob(job);
+        return false;
+    }
+
+    pPrompt->job = job;
+    return true;
+}
+
+int promptFd(const Prompt* pPrompt)
+{
+    return pPrompt && pPrompt->job ? pPrompt->job->fd : -1;
+}
+
+/************************************************
+ * promptPoll:  Collect the git segment if its
+ *              worker has finished
+ *
+ * pPrompt:     Prompt with a job running
+ *
+ * return:      Whether the segment changed and
+ *              the prompt should be drawn again
+ ***********************************************/
+bool promptPoll(Prompt* pPrompt)
+{
+    if(!pPrompt || !pPrompt->job)
+        return false;
+
+    char buffer[16];
+    while(read(pPrompt->job->fd, buffer, sizeof(buffer)) > 0);
+    if(!atomic_load(&pPrompt->job->done))
+        return false;
+
+    bool changed = strcmp(pPrompt->git, pPrompt->job->text) != 0;
+    strlcpy(pPrompt->git, pPrompt->job->text, sizeof(pPrompt->git));
+    releaseJob(pPrompt->job);
+    pPrompt->job = NULL;
+    return changed;
+}
+
+/************************************************
+ * promptRender:    Write the prompt from the
+ *                  cached segments
+ *
+ * pPrompt:         Updated prompt
+ *
+ * status:          Exit status of the last command
+ *
+ * jobs:            Number of jobs in the table
+ *
+ * out:             Buffer for the prompt, colours
+ *                  included
+ *
+ * size:            Size of out
+ *
+ * return:          Width of the prompt on screen
+ ***********************************************/
+size_t promptRender(const Prompt* pPrompt, int status, size_t jobs, char* out, size_t size)
+{
+    if(!pPrompt || !out || size == 0)
+        return 0;
+
+    size_t used = 0;
+    size_t width = 0;
+    out[0] = '\0';
+    for(size_t i = 0; i < pPrompt->numSegments; i++) {
+        char text[PROMPT_GIT_MAX + 32];
+        const char* color = NULL;
+        text[0] = '\0';
+
+        switch(pPrompt->segments[i]) {
+        case SEGMENT_USER:
+            used = append(out, size, used, PROMPT_BLUE);
+            used = append(out, size, used, pPrompt->user);
+            used = append(out, size, used, ":");
+            width += renderWidth(pPrompt->user, strlen(pPrompt->user)) + 1;
+            break;
+        case SEGMENT_CWD:
+            used = append(out, size, used, PROMPT_GREEN);
+            used = append(out, size, used, pPrompt->display);
+            width += renderWidth(pPrompt->display, strlen(pPrompt->display));
+            break;
+        case SEGMENT_GIT:
+            color = PROMPT_PURPLE;
+            if(pPrompt->git[0] != '\0')
+                snprintf(text, sizeof(text), " %s", pPrompt->git);
+            break;
+        case SEGMENT_STATUS:
+            color = PROMPT_RED;
+            if(status != 0)
+                snprintf(text, sizeof(text), " [%d]", status);
+            break;
+        case SEGMENT_JOBS:
+            color = PROMPT_YELLOW;
+            if(jobs > 0)
+                snprintf(text, sizeof(text), " &%zu", jobs);
+            break;
+        }
+
+        if(color && text[0] != '\0') {
+            used = append(out, size, used, color);
+            used = append(out, size, used, text);
+            width += renderWidth(text, strlen(text));
+        }
+    }
+
+    append(out, size, used, PROMPT_GREEN "$ " PROMPT_CLEAR_COLOR);
+    return width + 2;
+}
+
+void promptDestroy(Prompt* pPrompt)
+{
+    if(!pPrompt)
+        return;
+
+    cancelJob(pPrompt);
+    free(pPrompt->home);
+    free(pPrompt->spec);
+    free(pPrompt->gitCwd);
+    *pPrompt = (Prompt){0};
+}
+
+static void parseSpec(Prompt* pPrompt, const char* spec)
+{
+    static const char* names[] = {"user", "cwd", "git", "status", "jobs"};
+
+    if(!spec)
+        spec = PROMPT_DEFAULT_SPEC;
+
+    pPrompt->numSegments = 0;
+    pPrompt->useGit = false;
+    while(*spec && pPrompt->numSegments < PROMPT_MAX_SEGMENTS) {
+        size_t length = strcspn(spec, " ,:");
+        for(size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+            if(length == strlen(names[i]) && strncmp(spec, names[i], length) == 0) {
+                pPrompt->segments[pPrompt->numSegments++] = (PromptSegment)i;
+                pPrompt->useGit |= i == SEGMENT_GIT;
+                break;
+            }
+        }
+
+        spec += length;
+        spec += strspn(spec, " ,:");
+    }
+}
+
+static void abbreviateCwd(Prompt* pPrompt)
+{
+    const char* home = pPrompt->home;
+    size_t homeLen = home ? strlen(home) : 0;
+    if(homeLen > 0 && strncmp(pPrompt->cwd, home, homeLen) == 0
+       && (pPrompt->cwd[homeLen] == '/' || pPrompt->cwd[homeLen] == '\0'))
+        snprintf(pPrompt->display, sizeof(pPrompt->display), "~%s", pPrompt->cwd + homeLen);
+    else
+        strlcpy(pPrompt->display, pPrompt->cwd, sizeof(pPrompt->display));
+}
+
+static void cancelJob(Prompt* pPrompt)
+{
+    if(!pPrompt->job)
+        return;
+
+    atomic_store(&pPrompt->job->cancel, true);
+    releaseJob(pPrompt->job);
+    pPrompt->job = NULL;
+}
+
+// One allocation holding both the array and the strings
+static char** copyEnviron(char** envp)
+{
+    size_t count = 0;
+    size_t bytes = 0;
+    for(; envp && envp[count]; count++)
+        bytes += strlen(envp[count]) + 1;
+
+    char** copy = malloc((count + 1) * sizeof(char*) + bytes);
+    if(!copy)
+        return NULL;
+
+    char* strings = (char*)(copy + count + 1);
+    for(size_t i = 0; i < count; i++) {
+        size_t length = strlen(envp[i]) + 1;
+        memcpy(strings, envp[i], length);
+        copy[i] = strings;
+        strings += length;
+    }
+    copy[count] = NULL;
+    return copy;
+}
+
+static void* gitWorker(void* arg)
+{
+    PromptJob* job = arg;
+    char branch[PROMPT_GIT_MAX / 2];
+    if(findBranch(job->cwd, branch, sizeof(branch))) {
+        bool dirty = false;
+        long ahead = 0;
+        long behind = 0;
+        if(!job->gitPath) {
+            snprintf(job->text, sizeof(job->text), "(%s)", branch);
+        } else if(runGit(job, &dirty, &ahead, &behind)) {
+            int n = snprintf(job->text, sizeof(job->text), "(%s%s", branch, dirty ? "*" : "");
+            if(ahead > 0 && n < (int)sizeof(job->text))
+                n += snprintf(job->text + n, sizeof(job->text) - n, " +%ld", ahead);
+            if(behind > 0 && n < (int)sizeof(job->text))
+                n += snprintf(job->text + n, sizeof(job->text) - n, " -%ld", behind);
+            if(n < (int)sizeof(job->text))
+                snprintf(job->text + n, sizeof(job->text) - n, ")");
+        } else {
+            // Too slow to ask, the branch alone is still worth showing
+            snprintf(job->text, sizeof(job->text), "(%s ?)", branch);
+        }
+    }
+
+    atomic_store(&job->done, true);
+    ssize_t ret = write(job->notifyFd, "", 1);
+    (void)ret;
+    releaseJob(job);
+    return NULL;
+}
+
+/************************************************
+ * findBranch:  Find the repository holding a
+ *              directory and read its branch
+ *              straight from HEAD, without
+ *              running git
+ *
+ * cwd:         Directory to start from
+ *
+ * branch:      Receives the branch, or a short
+ *              hash when HEAD is detached
+ *
+ * size:        Size of branch
+ *
+ * return:      False if cwd isn't in a repository
+ ***********************************************/
+static bool findBranch(const char* cwd, char* branch, size_t size)
+{
+    char dir[PATH_MAX];
+    char path[PATH_MAX + 16];
+    strlcpy(dir, cwd, sizeof(dir));
+
+    struct stat st;
+    while(true) {
+        snprintf(path, sizeof(path), "%s/.git", strcmp(dir, "/") == 0 ? "" : dir);
+        if(stat(path, &st) == 0)
+            break;
+
+        char* slash = strrchr(dir, '/');
+        if(!slash || slash == dir) {
+            if(strcmp(dir, "/") == 0)
+                return false;
+            strlcpy(dir, "/", sizeof(dir));
+        } else {
+            *slash = '\0';
+        }
+    }
+
+    // Worktrees and submodules have a file pointing at the real git dir
+    char line[PATH_MAX];
+    if(!S_ISDIR(st.st_mode)) {
+        FILE* file = fopen(path, "re");
+        if(!file)
+            return false;
+        bool ok = fgets(line, sizeof(line), file) && strncmp(line, "gitdir: ", 8) == 0;
+        fclose(file);
+        if(!ok)
+            return false;
+
+        // A git dir whose path doesn't fit can't be read either
+        line[strcspn(line, "\n")] = '\0';
+        int n;
+        if(line[8] == '/')
+            n = snprintf(path, sizeof(path), "%s", line + 8);
+        else
+            n = snprintf(path, sizeof(path), "%s/%s", dir, line + 8);
+        if(n < 0 || (size_t)n >= sizeof(path))
+            return false;
+    }
+
+    if(strlen(path) + sizeof("/HEAD") > sizeof(path))
+        return false;
+    strlcat(path, "/HEAD", sizeof(path));
+    FILE* file = fopen(path, "re");
+    if(!file)
+        return false;
+    bool ok = fgets(line, sizeof(line), file) != NULL;
+    fclose(file);
+    if(!ok)
+        return false;
+
+    line[strcspn(line, "\n")] = '\0';
+    if(strncmp(line, "ref: refs/heads/", 16) == 0)
+        strlcpy(branch, line + 16, size);
+    else
+        snprintf(branch, size, "%.7s", line);
+    return true;
+}
+
+/************************************************
+ * spawnGit:    Start git status for a job. The
+ *              shell's job table only reaps its
+ *              own pids, so this thread alone
+ *              waits for or kills the child
+ *
+ * pJob:        Job to run git for
+ *
+ * outFd:       Where git's output goes
+ *
+ * return:      The child's pid, -1 on error
+ ***********************************************/
+static pid_t spawnGit(const PromptJob* pJob, int outFd)
+{
+    // -C instead of a chdir, the worker shares the shell's directory
+    char* argv[] = {"git", "-C", pJob->cwd, "--no-optional-locks", "status", "--porcelain=v2",
+                    "--branch", "--untracked-files=no", NULL};
+
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    if(posix_spawn_file_actions_init(&actions) != 0)
+        return -1;
+    if(posix_spawnattr_init(&attr) != 0) {
+        posix_spawn_file_actions_destroy(&actions);
+        return -1;
+    }
+
+    bool ok = posix_spawn_file_actions_addopen(&actions, STDIN_FILENO, "/dev/null", O_RDONLY, 0) == 0;
+    ok = ok && posix_spawn_file_actions_adddup2(&actions, outFd, STDOUT_FILENO) == 0;
+    ok = ok && posix_spawn_file_actions_addopen(&actions, STDERR_FILENO, "/dev/null", O_WRONLY, 0) == 0;
+
+    // The shell ignores and blocks signals git should get as normal
+    sigset_t mask, defaults;
+    sigemptyset(&mask);
+    sigfillset(&defaults);
+    ok = ok && posix_spawnattr_setsigmask(&attr, &mask) == 0;
+    ok = ok && posix_spawnattr_setsigdefault(&attr, &defaults) == 0;
+    ok = ok && posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF) == 0;
+
+    pid_t pid = -1;
+    if(ok && posix_spawn(&pid, pJob->gitPath, &actions, &attr, argv, pJob->envp) != 0)
+        pid = -1;
+
+    posix_spawnattr_destroy(&attr);
+    posix_spawn_file_actions_destroy(&actions);
+    return pid;
+}
+
+/************************************************
+ * runGit:      Ask git whether the work tree is
+ *              dirty and how far it is from its
+ *              upstream, giving up after the
+ *              job's timeout or when cancelled
+ *
+ * pJob:        Job to run git for
+ *
+ * pDirty:      Set if anything tracked changed
+ *
+ * pAhead:      Commits ahead of upstream
+ *
+ * pBehind:     Commits behind upstream
+ *
+ * return:      False if git failed or took too
+ *              long
+ ***********************************************/
+static bool runGit(PromptJob* pJob, bool* pDirty, long* pAhead, long* pBehind)
+{
+    int fds[2];
+    if(pipe2(fds, O_CLOEXEC) == -1)
+        return false;
+
+    pid_t pid = spawnGit(pJob, fds[1]);
+    close(fds[1]);
+    if(pid == -1) {
+        close(fds[0]);
+        return false;
+    }
+
+    char output[GIT_OUTPUT_MAX];
+    size_t used = 0;
+    bool finished = false;
+    bool full = false;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while(!atomic_load(&pJob->cancel)) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long elapsed = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+        if(elapsed >= pJob->timeout)
+            break;
+
+        // Short slices so a cancel doesn't wait out the timeout
+        long wait = pJob->timeout - elapsed;
+        struct pollfd pfd = {fds[0], POLLIN, 0};
+        if(poll(&pfd, 1, wait < PROMPT_SLICE_MS ? wait : PROMPT_SLICE_MS) <= 0)
+            continue;
+
+        ssize_t n = read(fds[0], output + used, sizeof(output) - 1 - used);
+        if(n <= 0) {
+            finished = n == 0;
+            break;
+        }
+
+        // The headers come first, a full buffer already shows a change
+        used += n;
+        if(used == sizeof(output) - 1) {
+            finished = full = true;
+            break;
+        }
+    }
+
+    close(fds[0]);
+    kill(pid, SIGKILL);
+    int wstatus;
+    while(waitpid(pid, &wstatus, 0) == -1 && errno == EINTR);
+    if(!finished || (!full && !(WIFEXITED(wstatus) && WEXITSTATUS(wstatus) == 0)))
+        return false;
+
+    output[used] = '\0';
+    for(char* line = output; line && *line; line = strchr(line, '\n') ? strchr(line, '\n') + 1 : NULL) {
+        if(strncmp(line, "# branch.ab ", 12) == 0)
+            sscanf(line + 12, "+%ld -%ld", pAhead, pBehind);
+        else if(line[0] == '1' || line[0] == '2' || line[0] == 'u')
+            *pDirty = true;
+    }
+
+    return used > 0;
+}
+
+static void releaseJob(PromptJob* pJob)
+{
+    if(atomic_fetch_sub(&pJob->refs, 1) != 1)
+        return;
+
+    if(pJob->fd != -1)
+        close(pJob->fd);
+    if(pJob->notifyFd != -1)
+        close(pJob->notifyFd);
+    free(pJob->cwd);
+    free(pJob->gitPath);
+    free(pJob->envp);
+    free(pJob);
+}
+
+static size_t append(char* out, size_t size, size_t used, const char* text)
+{
+    if(used + 1 >= size)
+        return used;
+
+    size_t length = strlcpy(out + used, text, size - used);
+    return used + length < size ? used + length : size - 1;
+}
@@ -0,0 +1,64 @@
+#ifndef PROMPT_H
+#define PROMPT_H
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <linux/limits.h>
+
+#define PROMPT_USER_MAX     256
+#define PROMPT_GIT_MAX      128
+#define PROMPT_MAX_SEGMENTS 8
+
+typedef enum prompt_segment_t {
+    SEGMENT_USER,
+    SEGMENT_CWD,
+    SEGMENT_GIT,
+    SEGMENT_STATUS,
+    SEGMENT_JOBS
+} PromptSegment;
+
+// The git segment being worked out for one directory on a worker thread.
+// Like a DirScan, whichever side lets go last frees it
+typedef struct prompt_job_t {
+    char* cwd;
+    char* gitPath;
+    char** envp;
+    int fd;
+    int notifyFd;
+    int timeout;
+    atomic_bool cancel;
+    atomic_bool done;
+    atomic_int refs;
+    char text[PROMPT_GIT_MAX];
+} PromptJob;
+
+// Prompt segments kept between prompts. User, directory and $HOME only
+// change on cd or when the variables do, git status is refreshed in the
+// background and the last answer is shown until a new one arrives
+typedef struct prompt_t {
+    char user[PROMPT_USER_MAX];
+    char cwd[PATH_MAX];
+    char display[PATH_MAX];
+    bool cwdValid;
+    char* home;
+    char* spec;
+    PromptSegment segments[PROMPT_MAX_SEGMENTS];
+    size_t numSegments;
+    bool useGit;
+    char* gitCwd;
+    char git[PROMPT_GIT_MAX];
+    PromptJob* job;
+} Prompt;
+
+
+Prompt promptInit(void);
+bool promptUpdate(Prompt* pPrompt, const char* home, const char* spec);
+void promptChdir(Prompt* pPrompt);
+bool promptRefresh(Prompt* pPrompt, const char* gitPath, char** envp, int timeout);
+int promptFd(const Prompt* pPrompt);
+bool promptPoll(Prompt* pPrompt);
+size_t promptRender(const Prompt* pPrompt, int status, size_t jobs, char* out, size_t size);
+void promptDestroy(Prompt* pPrompt);
+
+#endif
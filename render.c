@@ -0,0 +1,269 @@
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "render.h"
+
+static bool reserve(char** pBuffer, size_t* pCapacity, size_t needed);
+static bool moveCursor(Render* pRender, size_t from, size_t to);
+static size_t position(const Render* pRender, const char* text, size_t offset);
+
+Render renderInit(void)
+{
+    return (Render){NULL, 0, 0, NULL, 0, 0, 0, 0, 0};
+}
+
+/************************************************
+ * renderAppend:    Queue raw output, such as a
+ *                  prompt or a completion list.
+ *                  Call renderReset once the
+ *                  cursor is back at the start of
+ *                  an empty input line
+ *
+ * pRender:         Renderer to queue on
+ *
+ * data:            Bytes to write
+ *
+ * size:            Number of bytes in data
+ *
+ * return:          False if out of memory
+ ***********************************************/
+bool renderAppend(Render* pRender, const char* data, size_t size)
+{
+    if(!pRender || !data)
+        return false;
+
+    if(!reserve(&pRender->out, &pRender->outCapacity, pRender->outSize + size))
+        return false;
+
+    memcpy(pRender->out + pRender->outSize, data, size);
+    pRender->outSize += size;
+    return true;
+}
+
+/************************************************
+ * renderReset: Start an empty input line after a
+ *              prompt already queued or written
+ *
+ * pRender:     Renderer to reset
+ *
+ * margin:      Width of the prompt on screen
+ ***********************************************/
+void renderReset(Render* pRender, size_t margin)
+{
+    if(!pRender)
+        return;
+
+    pRender->shownSize = 0;
+    pRender->shownCursor = 0;
+    pRender->margin = margin;
+
+    // A prompt filling its last row leaves the wrap pending
+    if(pRender->columns > 0 && margin > 0 && margin % pRender->columns == 0)
+        renderAppend(pRender, "\r\n", 2);
+}
+
+/************************************************
+ * renderResize:    Set the terminal width lines
+ *                  wrap at, 0 if it is unknown
+ *
+ * pRender:         Renderer to update
+ *
+ * columns:         Columns on the terminal
+ ***********************************************/
+void renderResize(Render* pRender, size_t columns)
+{
+    if(pRender)
+        pRender->columns = columns;
+}
+
+/************************************************
+ * renderHome:  Queue a move to the first column
+ *              of the row the prompt starts on
+ *              and clear everything below, so a
+ *              prompt can be drawn again over a
+ *              line that wrapped
+ *
+ * pRender:     Renderer tracking the screen
+ ***********************************************/
+void renderHome(Render* pRender)
+{
+    if(!pRender)
+        return;
+
+    size_t at = position(pRender, pRender->shown, pRender->shownCursor);
+    size_t row = pRender->columns > 0 ? at / pRender->columns : 0;
+    char seq[32];
+    int len = row > 0 ? snprintf(seq, sizeof(seq), "\033[%zuA", row) : 0;
+    renderAppend(pRender, seq, len);
+    renderAppend(pRender, "\r\033[J", 4);
+}
+
+/************************************************
+ * renderWidth: Count the columns text takes on
+ *              screen, one per UTF-8 character
+ *
+ * text:        Text to measure
+ *
+ * size:        Number of bytes in text
+ *
+ * return:      Its width
+ ***********************************************/
+size_t renderWidth(const char* text, size_t size)
+{
+    size_t width = 0;
+    for(size_t i = 0; i < size; i++) {
+        if(((unsigned char)text[i] & 0xc0) != 0x80)
+            width++;
+    }
+
+    return width;
+}
+
+/************************************************
+ * renderLine:  Queue the escape sequences that
+ *              turn the line on screen into the
+ *              given one. Only text after the
+ *              first difference is written.
+ *              Offsets are turned into rows and
+ *              columns, so lines wider than the
+ *              terminal wrap correctly
+ *
+ * pRender:     Renderer tracking the screen
+ *
+ * text:        Line to show, without the prompt
+ *
+ * size:        Number of bytes in text
+ *
+ * cursor:      Offset in text to leave the
+ *              cursor at
+ *
+ * return:      False if out of memory
+ ***********************************************/
+bool renderLine(Render* pRender, const char* text, size_t size, size_t cursor)
+{
+    if(!pRender || (!text && size > 0))
+        return false;
+
+    size_t common = 0;
+    while(common < size && common < pRender->shownSize && text[common] == pRender->shown[common])
+        common++;
+
+    bool ok = true;
+    size_t at = position(pRender, pRender->shown, pRender->shownCursor);
+    if(common < size || common < pRender->shownSize) {
+        size_t end = position(pRender, text, size);
+        ok = moveCursor(pRender, at, position(pRender, text, common));
+        ok = ok && renderAppend(pRender, text + common, size - common);
+
+        // Step onto the next row ourselves, the terminal holds back the
+        // wrap until another character arrives
+        if(pRender->columns > 0 && end > 0 && end % pRender->columns == 0)
+            ok = ok && renderAppend(pRender, "\r\n", 2);
+        if(common < pRender->shownSize)
+            ok = ok && renderAppend(pRender, "\033[J", 3);
+        at = end;
+    }
+
+    size_t to = position(pRender, text, cursor);
+    ok = ok && moveCursor(pRender, at, to);
+    pRender->shownCursor = cursor;
+
+    if(!reserve(&pRender->shown, &pRender->shownCapacity, size))
+        return false;
+    if(size > 0)
+        memcpy(pRender->shown, text, size);
+    pRender->shownSize = size;
+
+    return ok;
+}
+
+/************************************************
+ * renderFlush: Write everything queued with a
+ *              single write, retrying only if it
+ *              comes up short
+ *
+ * pRender:     Renderer to flush
+ *
+ * fd:          Terminal to write to
+ *
+ * return:      Whether everything was written
+ ***********************************************/
+bool renderFlush(Render* pRender, int fd)
+{
+    if(!pRender)
+        return false;
+
+    // Anything printed through stdio has to land first
+    fflush(stdout);
+
+    size_t done = 0;
+    while(done < pRender->outSize) {
+        ssize_t n = write(fd, pRender->out + done, pRender->outSize - done);
+        if(n == -1 && errno == EINTR)
+            continue;
+        if(n <= 0)
+            break;
+        done += n;
+    }
+
+    bool ok = done == pRender->outSize;
+    pRender->outSize = 0;
+    return ok;
+}
+
+void renderDestroy(Render* pRender)
+{
+    if(pRender) {
+        free(pRender->out);
+        free(pRender->shown);
+        *pRender = renderInit();
+    }
+}
+
+static bool reserve(char** pBuffer, size_t* pCapacity, size_t needed)
+{
+    if(needed <= *pCapacity)
+        return true;
+
+    size_t capacity = *pCapacity ? *pCapacity : 256;
+    while(capacity < needed)
+        capacity *= 2;
+
+    char* temp = realloc(*pBuffer, capacity);
+    if(!temp)
+        return false;
+
+    *pBuffer = temp;
+    *pCapacity = capacity;
+    return true;
+}
+
+// Screen position of an offset in text, counted in columns from the start
+// of the prompt's first row
+static size_t position(const Render* pRender, const char* text, size_t offset)
+{
+    return pRender->margin + renderWidth(text, offset);
+}
+
+static bool moveCursor(Render* pRender, size_t from, size_t to)
+{
+    if(from == to)
+        return true;
+
+    size_t columns = pRender->columns > 0 ? pRender->columns : SIZE_MAX;
+    size_t fromRow = from / columns, fromColumn = from % columns;
+    size_t toRow = to / columns, toColumn = to % columns;
+
+    // Left and right stop at the screen edge, so rows are changed first
+    char seq[64];
+    int len = 0;
+    if(fromRow != toRow)
+        len += snprintf(seq, sizeof(seq), "\033[%zu%c", fromRow > toRow ? fromRow - toRow : toRow - fromRow, fromRow > toRow ? 'A' : 'B');
+    if(toColumn == 0 && fromColumn != 0)
+        len += snprintf(seq + len, sizeof(seq) - len, "\r");
+    else if(fromColumn != toColumn)
+        len += snprintf(seq + len, sizeof(seq) - len, "\033[%zu%c", fromColumn > toColumn ? fromColumn - toColumn : toColumn - fromColumn, fromColumn > toColumn ? 'D' : 'C');
+
+    return renderAppend(pRender, seq, len);
+}
@@ -0,0 +1,30 @@
+#ifndef RENDER_H
+#define RENDER_H
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct render_t {
+    char* out;
+    size_t outSize;
+    size_t outCapacity;
+    char* shown;
+    size_t shownSize;
+    size_t shownCapacity;
+    size_t shownCursor;
+    size_t columns;
+    size_t margin;
+} Render;
+
+
+Render renderInit(void);
+bool renderAppend(Render* pRender, const char* data, size_t size);
+void renderReset(Render* pRender, size_t margin);
+void renderResize(Render* pRender, size_t columns);
+void renderHome(Render* pRender);
+size_t renderWidth(const char* text, size_t size);
+bool renderLine(Render* pRender, const char* text, size_t size, size_t cursor);
+bool renderFlush(Render* pRender, int fd);
+void renderDestroy(Render* pRender);
+
+#endif
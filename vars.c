@@ -0,0 +1,301 @@
+#include <string.h>
+#include "vars.h"
+
+static uint64_t hashName(const char* name, size_t length);
+static size_t findSlot(const VarTable* pTable, const char* name, size_t length);
+static bool resizeTable(VarTable* pTable);
+
+VarTable varsInit(size_t capacity)
+{
+    // Capacity must be a power of two so probing can mask instead of divide
+    size_t cap = 64;
+    while(cap < capacity)
+        cap *= 2;
+
+    VarTable table = {0, cap, NULL, NULL, NULL, NULL, 0, true};
+    table.entries = calloc(cap, sizeof(char*));
+    table.nameLengths = calloc(cap, sizeof(uint32_t));
+    table.exported = calloc(cap, sizeof(bool));
+    if(!table.entries || !table.nameLengths || !table.exported) {
+        free(table.entries);
+        free(table.nameLengths);
+        free(table.exported);
+        return (VarTable){0, 0, NULL, NULL, NULL, NULL, 0, false};
+    }
+
+    return table;
+}
+
+/************************************************
+ * varsImport:  Add every "NAME=value" string of
+ *              an environment as an exported
+ *              variable
+ *
+ * pTable:      Table to fill
+ *
+ * env:         NULL terminated environment
+ *
+ * return:      Whether every entry was added
+ ***********************************************/
+bool varsImport(VarTable* pTable, char** env)
+{
+    if(!pTable || !env)
+        return false;
+
+    bool ok = true;
+    for(; *env; env++) {
+        const char* eq = strchr(*env, '=');
+        if(eq && eq != *env)
+            ok &= varsSet(pTable, *env, eq - *env, eq + 1, true);
+    }
+
+    return ok;
+}
+
+/************************************************
+ * varsGet:     Look up a variable
+ *
+ * pTable:      Table to search
+ *
+ * name:        Name, need not be NUL terminated
+ *
+ * length:      Number of bytes in name
+ *
+ * return:      Value owned by the table, NULL if
+ *              the variable is unset
+ ***********************************************/
+const char* varsGet(const VarTable* pTable, const char* name, size_t length)
+{
+    if(!pTable || !name || pTable->capacity == 0)
+        return NULL;
+
+    size_t slot = findSlot(pTable, name, length);
+    if(!pTable->entries[slot])
+        return NULL;
+
+    return pTable->entries[slot] + length + 1;
+}
+
+/************************************************
+ * varsSet:     Create or replace a variable. A
+ *              variable stays exported once it
+ *              has been exported
+ *
+ * pTable:      Table to modify
+ *
+ * name:        Name, need not be NUL terminated
+ *
+ * length:      Number of bytes in name
+ *
+ * value:       New value
+ *
+ * export:      Pass the variable to children
+ *
+ * return:      Whether the variable was stored
+ ***********************************************/
+bool varsSet(VarTable* pTable, const char* name, size_t length, const char* value, bool export)
+{
+    if(!pTable || !name || !value || length == 0 || pTable->capacity == 0)
+        return false;
+
+    // Keep the load factor under 3/4
+    if((pTable->size + 1) * 4 > pTable->capacity * 3)
+        if(!resizeTable(pTable))
+            return false;
+
+    // Stored as "NAME=value" so the environment can point straight at it
+    size_t valueLen = strlen(value);
+    char* entry = malloc(length + valueLen + 2);
+    if(!entry)
+        return false;
+
+    memcpy(entry, name, length);
+    entry[length] = '=';
+    memcpy(entry + length + 1, value, valueLen + 1);
+
+    size_t slot = findSlot(pTable, name, length);
+    if(pTable->entries[slot]) {
+        free(pTable->entries[slot]);
+    } else {
+        pTable->nameLengths[slot] = length;
+        pTable->size++;
+    }
+
+    pTable->entries[slot] = entry;
+    pTable->exported[slot] |= export;
+    if(pTable->exported[slot])
+        pTable->envpDirty = true;
+
+    return true;
+}
+
+bool varsExport(VarTable* pTable, const char* name, size_t length)
+{
+    if(!pTable || !name || pTable->capacity == 0)
+        return false;
+
+    size_t slot = findSlot(pTable, name, length);
+    if(!pTable->entries[slot])
+        return false;
+
+    if(!pTable->exported[slot]) {
+        pTable->exported[slot] = true;
+        pTable->envpDirty = true;
+    }
+
+    return true;
+}
+
+bool varsUnset(VarTable* pTable, const char* name, size_t length)
+{
+    if(!pTable || !name || pTable->capacity == 0)
+        return false;
+
+    size_t mask = pTable->capacity - 1;
+    size_t slot = findSlot(pTable, name, length);
+    if(!pTable->entries[slot])
+        return false;
+
+    if(pTable->exported[slot])
+        pTable->envpDirty = true;
+
+    free(pTable->entries[slot]);
+    pTable->entries[slot] = NULL;
+    pTable->exported[slot] = false;
+    pTable->size--;
+
+    // Shift later members of the probe run back so lookups never stop early
+    size_t hole = slot;
+    for(size_t i = (slot + 1) & mask; pTable->entries[i]; i = (i + 1) & mask) {
+        size_t home = hashName(pTable->entries[i], pTable->nameLengths[i]) & mask;
+        if(((i - home) & mask) >= ((i - hole) & mask)) {
+            pTable->entries[hole] = pTable->entries[i];
+            pTable->nameLengths[hole] = pTable->nameLengths[i];
+            pTable->exported[hole] = pTable->exported[i];
+            pTable->entries[i] = NULL;
+            pTable->exported[i] = false;
+            hole = i;
+        }
+    }
+
+    return true;
+}
+
+bool varsValidName(const char* name, size_t length)
+{
+    if(!name || length == 0 || (name[0] >= '0' && name[0] <= '9'))
+        return false;
+
+    for(size_t i = 0; i < length; i++) {
+        char c = name[i];
+        if(!(c == '_' || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')))
+            return false;
+    }
+
+    return true;
+}
+
+/************************************************
+ * varsEnviron: Get the environment for a child.
+ *              The array is only rebuilt after
+ *              an exported variable changed, and
+ *              it points at the table's entries
+ *              rather than copying them
+ *
+ * pTable:      Table to export
+ *
+ * return:      NULL terminated "NAME=value"
+ *              array owned by the table, valid
+ *              until the table is next modified
+ ***********************************************/
+char** varsEnviron(VarTable* pTable)
+{
+    static char* empty[] = {NULL};
+    if(!pTable || pTable->capacity == 0)
+        return empty;
+
+    if(!pTable->envpDirty && pTable->envp)
+        return pTable->envp;
+
+    if(pTable->size + 1 > pTable->envpCapacity) {
+        char** temp = realloc(pTable->envp, (pTable->size + 1) * sizeof(char*));
+        if(!temp)
+            return pTable->envp ? pTable->envp : empty;
+
+        pTable->envp = temp;
+        pTable->envpCapacity = pTable->size + 1;
+    }
+
+    size_t n = 0;
+    for(size_t i = 0; i < pTable->capacity; i++) {
+        if(pTable->entries[i] && pTable->exported[i])
+            pTable->envp[n++] = pTable->entries[i];
+    }
+    pTable->envp[n] = NULL;
+
+    pTable->envpDirty = false;
+    return pTable->envp;
+}
+
+void varsDestroy(VarTable* pTable)
+{
+    if(pTable) {
+        for(size_t i = 0; i < pTable->capacity; i++)
+            free(pTable->entries[i]);
+        free(pTable->entries);
+        free(pTable->nameLengths);
+        free(pTable->exported);
+        free(pTable->envp);
+    }
+}
+
+static uint64_t hashName(const char* name, size_t length)
+{
+    // FNV-1a
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for(size_t i = 0; i < length; i++) {
+        hash ^= (unsigned char)name[i];
+        hash *= 0x100000001b3ULL;
+    }
+
+    return hash;
+}
+
+static size_t findSlot(const VarTable* pTable, const char* name, size_t length)
+{
+    size_t mask = pTable->capacity - 1;
+    size_t slot = hashName(name, length) & mask;
+    while(pTable->entries[slot] && (pTable->nameLengths[slot] != length ||
+          memcmp(pTable->entries[slot], name, length) != 0))
+        slot = (slot + 1) & mask;
+
+    return slot;
+}
+
+static bool resizeTable(VarTable* pTable)
+{
+    VarTable bigger = varsInit(pTable->capacity * 2);
+    if(bigger.capacity == 0)
+        return false;
+
+    for(size_t i = 0; i < pTable->capacity; i++) {
+        if(!pTable->entries[i])
+            continue;
+
+        size_t slot = findSlot(&bigger, pTable->entries[i], pTable->nameLengths[i]);
+        bigger.entries[slot] = pTable->entries[i];
+        bigger.nameLengths[slot] = pTable->nameLengths[i];
+        bigger.exported[slot] = pTable->exported[i];
+        bigger.size++;
+    }
+
+    free(pTable->entries);
+    free(pTable->nameLengths);
+    free(pTable->exported);
+    pTable->entries = bigger.entries;
+    pTable->nameLengths = bigger.nameLengths;
+    pTable->exported = bigger.exported;
+    pTable->capacity = bigger.capacity;
+    pTable->envpDirty = true;
+    return true;
+}
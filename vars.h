@@ -0,0 +1,29 @@
+#ifndef VARS_H
+#define VARS_H
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct vartable_t {
+    size_t size;
+    size_t capacity;
+    char** entries;
+    uint32_t* nameLengths;
+    bool* exported;
+    char** envp;
+    size_t envpCapacity;
+    bool envpDirty;
+} VarTable;
+
+
+VarTable varsInit(size_t capacity);
+bool varsImport(VarTable* pTable, char** env);
+const char* varsGet(const VarTable* pTable, const char* name, size_t length);
+bool varsSet(VarTable* pTable, const char* name, size_t length, const char* value, bool export);
+bool varsExport(VarTable* pTable, const char* name, size_t length);
+bool varsUnset(VarTable* pTable, const char* name, size_t length);
+bool varsValidName(const char* name, size_t length);
+char** varsEnviron(VarTable* pTable);
+void varsDestroy(VarTable* pTable);
+
+#endif
@@ -2,6 +2,12 @@
 #include "vector.h"
 
 bool resizeArray(Vector* pVector);
+static uint32_t hashString(const char* string, size_t size);
+static bool growPool(StringPool* pPool, size_t bytes);
+static bool rehashPool(StringPool* pPool, size_t slotCapacity);
+static size_t findSlotOf(const StringPool* pPool, size_t index);
+static void removeSlot(StringPool* pPool, size_t slot);
+static void compactPool(StringPool* pPool);
 
 Vector vectorInit(size_t capacity)
 {
@@ -9,7 +15,7 @@ Vector vectorInit(size_t capacity)
     if(capacity == 0)
         capacity = 8;
 
-    Vector vect = {0, capacity, NULL};
+    Vector vect = {0, capacity, NULL, NULL};
     vect.arr = calloc(vect.capacity, sizeof(char*));
     if(!vect.arr) {
         vect.capacity = 0;
@@ -19,6 +25,38 @@ Vector vectorInit(size_t capacity)
     return vect;
 }
 
+/************************************************
+ * vectorInitArena: Create a vector whose array
+ *                  and strings live in an arena.
+ *                  Nothing is freed individually,
+ *                  vectorDestroy is optional and
+ *                  the memory goes away when the
+ *                  arena is reset
+ *
+ * capacity:        Initial capacity, 0 for the
+ *                  default
+ *
+ * pArena:          Arena backing the vector, NULL
+ *                  for the heap
+ *
+ * return:          The new vector
+ ***********************************************/
+Vector vectorInitArena(size_t capacity, Arena* pArena)
+{
+    if(!pArena)
+        return vectorInit(capacity);
+
+    if(capacity == 0)
+        capacity = 8;
+
+    Vector vect = {0, capacity, NULL, pArena};
+    vect.arr = arenaAlloc(pArena, vect.capacity * sizeof(char*));
+    if(!vect.arr)
+        vect.capacity = 0;
+
+    return vect;
+}
+
 bool vectorInsert(Vector* pVector, char* string, size_t size)
 {
     if(!pVector || !string)
@@ -28,7 +66,10 @@ bool vectorInsert(Vector* pVector, char* string, size_t size)
         if(!resizeArray(pVector))
             return false;
 
-    pVector->arr[pVector->size] = calloc(size + 1, sizeof(char));
+    if(pVector->arena)
+        pVector->arr[pVector->size] = arenaAlloc(pVector->arena, size + 1);
+    else
+        pVector->arr[pVector->size] = calloc(size + 1, sizeof(char));
     if(!pVector->arr[pVector->size])
         return false;
 
@@ -48,23 +89,24 @@ bool vectorRemove(Vector* pVector, char* string, size_t size)
 
     for(size_t i = 0; i < pVector->size; i++) {
         if(strncmp(pVector->arr[i], string, size) == 0) {
-            free(pVector->arr[i]);
+            if(!pVector->arena)
+                free(pVector->arr[i]);
 
             for(size_t j = i; j < pVector->size - 1; j++)
                 pVector->arr[j] = pVector->arr[j+1];
 
+            pVector->size--;
             pVector->arr[pVector->size] = NULL;
-            break;
+            return true;
         }
     }
 
-    pVector->size--;
-    return true;
+    return false;
 }
 
 void vectorDestroy(Vector* pVector)
 {
-    if(pVector) {
+    if(pVector && !pVector->arena) {
         for(size_t i = 0; i < pVector->size; i++)
             free(pVector->arr[i]);
         free(pVector->arr);
@@ -76,15 +118,398 @@ bool resizeArray(Vector* pVector)
     if(!pVector)
         return false;
 
-    char** temp = calloc(pVector->capacity * 2, sizeof(char*));
+    // The old array stays in the arena until it is reset
+    char** temp;
+    if(pVector->arena)
+        temp = arenaAlloc(pVector->arena, pVector->capacity * 2 * sizeof(char*));
+    else
+        temp = calloc(pVector->capacity * 2, sizeof(char*));
     if(!temp)
         return false;
 
     for(size_t i = 0; i < pVector->size; i++)
         temp[i] = pVector->arr[i];
 
-    free(pVector->arr);
+    if(!pVector->arena)
+        free(pVector->arr);
     pVector->arr = temp;
     pVector->capacity *= 2;
     return true;
 }
+
+/************************************************
+ * stringPoolInit:  Create a pool of strings held
+ *                  back to back in one buffer.
+ *                  Each entry costs its bytes
+ *                  plus a NUL, an offset, a length,
+ *                  a hash and two index slots
+ *
+ * capacity:        Initial number of entries, 0
+ *                  for the default
+ *
+ * return:          The new pool, capacity 0 on
+ *                  failure
+ ***********************************************/
+StringPool stringPoolInit(size_t capacity)
+{
+    StringPool pool = {0};
+    if(capacity == 0)
+        capacity = 8;
+
+    pool.offsets = malloc(capacity * sizeof(size_t));
+    pool.lengths = malloc(capacity * sizeof(uint32_t));
+    pool.hashes = malloc(capacity * sizeof(uint32_t));
+    if(!pool.offsets || !pool.lengths || !pool.hashes || !rehashPool(&pool, 16)) {
+        stringPoolDestroy(&pool);
+        return (StringPool){0};
+    }
+
+    pool.capacity = capacity;
+    return pool;
+}
+
+/************************************************
+ * stringPoolInsert:    Append a copy of a string
+ *
+ * pPool:               Pool to add to
+ *
+ * string:              String to copy, need not
+ *                      be NUL terminated
+ *
+ * size:                Number of bytes to copy
+ *
+ * return:              Whether it was added
+ ***********************************************/
+bool stringPoolInsert(StringPool* pPool, const char* string, size_t size)
+{
+    if(!pPool || !string || pPool->capacity == 0 || size >= UINT32_MAX)
+        return false;
+
+    if(pPool->size >= pPool->capacity) {
+        size_t cap = pPool->capacity * 2;
+        size_t* offsets = realloc(pPool->offsets, cap * sizeof(size_t));
+        if(offsets)
+            pPool->offsets = offsets;
+        uint32_t* lengths = realloc(pPool->lengths, cap * sizeof(uint32_t));
+        if(lengths)
+            pPool->lengths = lengths;
+        uint32_t* hashes = realloc(pPool->hashes, cap * sizeof(uint32_t));
+        if(hashes)
+            pPool->hashes = hashes;
+
+        if(!offsets || !lengths || !hashes)
+            return false;
+        pPool->capacity = cap;
+    }
+
+    // Keep the index at most half full
+    if((pPool->size + 1) * 2 > pPool->slotCapacity && !rehashPool(pPool, pPool->slotCapacity * 2))
+        return false;
+
+    if(!growPool(pPool, size + 1))
+        return false;
+
+    size_t index = pPool->size++;
+    pPool->offsets[index] = pPool->used;
+    pPool->lengths[index] = size;
+    pPool->hashes[index] = hashString(string, size);
+
+    memcpy(pPool->data + pPool->used, string, size);
+    pPool->data[pPool->used + size] = '\0';
+    pPool->used += size + 1;
+
+    size_t mask = pPool->slotCapacity - 1;
+    size_t slot = pPool->hashes[index] & mask;
+    while(pPool->slots[slot])
+        slot = (slot + 1) & mask;
+    pPool->slots[slot] = index + 1;
+
+    return true;
+}
+
+/************************************************
+ * stringPoolGet:   Get an entry. The pointer is
+ *                  only valid until the pool is
+ *                  next modified
+ *
+ * pPool:           Pool to read
+ *
+ * index:           Entry to get
+ *
+ * return:          NUL terminated string, NULL if
+ *                  index is out of range
+ ***********************************************/
+const char* stringPoolGet(const StringPool* pPool, size_t index)
+{
+    if(!pPool || index >= pPool->size)
+        return NULL;
+
+    return pPool->data + pPool->offsets[index];
+}
+
+size_t stringPoolLength(const StringPool* pPool, size_t index)
+{
+    if(!pPool || index >= pPool->size)
+        return 0;
+
+    return pPool->lengths[index];
+}
+
+/************************************************
+ * stringPoolFind:  Look up an entry by value
+ *                  through the hash index
+ *
+ * pPool:           Pool to search
+ *
+ * string:          String to find
+ *
+ * size:            Number of bytes in string
+ *
+ * pIndex:          Receives the index of the
+ *                  match, may be NULL
+ *
+ * return:          Whether a match was found
+ ***********************************************/
+bool stringPoolFind(const StringPool* pPool, const char* string, size_t size, size_t* pIndex)
+{
+    if(!pPool || !string || pPool->size == 0)
+        return false;
+
+    uint32_t hash = hashString(string, size);
+    size_t mask = pPool->slotCapacity - 1;
+    for(size_t slot = hash & mask; pPool->slots[slot]; slot = (slot + 1) & mask) {
+        size_t index = pPool->slots[slot] - 1;
+        if(pPool->hashes[index] == hash && pPool->lengths[index] == size &&
+           memcmp(pPool->data + pPool->offsets[index], string, size) == 0) {
+            if(pIndex)
+                *pIndex = index;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/************************************************
+ * stringPoolSwapRemove:    Remove an entry in
+ *                          constant time by moving
+ *                          the last entry into its
+ *                          place
+ *
+ * pPool:                   Pool to remove from
+ *
+ * index:                   Entry to remove
+ *
+ * return:                  Whether index was valid
+ ***********************************************/
+bool stringPoolSwapRemove(StringPool* pPool, size_t index)
+{
+    if(!pPool || index >= pPool->size)
+        return false;
+
+    removeSlot(pPool, findSlotOf(pPool, index));
+    pPool->dead += pPool->lengths[index] + 1;
+
+    size_t last = pPool->size - 1;
+    if(index != last) {
+        pPool->slots[findSlotOf(pPool, last)] = index + 1;
+        pPool->offsets[index] = pPool->offsets[last];
+        pPool->lengths[index] = pPool->lengths[last];
+        pPool->hashes[index] = pPool->hashes[last];
+    }
+
+    pPool->size--;
+    compactPool(pPool);
+    return true;
+}
+
+/************************************************
+ * stringPoolStableRemove:  Remove an entry while
+ *                          keeping the order of
+ *                          the rest. Linear in the
+ *                          size of the pool
+ *
+ * pPool:                   Pool to remove from
+ *
+ * index:                   Entry to remove
+ *
+ * return:                  Whether index was valid
+ ***********************************************/
+bool stringPoolStableRemove(StringPool* pPool, size_t index)
+{
+    if(!pPool || index >= pPool->size)
+        return false;
+
+    removeSlot(pPool, findSlotOf(pPool, index));
+    pPool->dead += pPool->lengths[index] + 1;
+
+    size_t tail = pPool->size - index - 1;
+    memmove(pPool->offsets + index, pPool->offsets + index + 1, tail * sizeof(size_t));
+    memmove(pPool->lengths + index, pPool->lengths + index + 1, tail * sizeof(uint32_t));
+    memmove(pPool->hashes + index, pPool->hashes + index + 1, tail * sizeof(uint32_t));
+
+    for(size_t i = 0; i < pPool->slotCapacity; i++) {
+        if(pPool->slots[i] > index + 1)
+            pPool->slots[i]--;
+    }
+
+    pPool->size--;
+    compactPool(pPool);
+    return true;
+}
+
+/************************************************
+ * stringPoolArgv:  Build a NULL terminated array
+ *                  pointing at the pooled strings,
+ *                  nothing is copied. The array is
+ *                  owned by the pool and is only
+ *                  valid until it is next modified
+ *
+ * pPool:           Pool to export
+ *
+ * return:          The array, NULL on failure
+ ***********************************************/
+char** stringPoolArgv(StringPool* pPool)
+{
+    if(!pPool)
+        return NULL;
+
+    if(pPool->size + 1 > pPool->argvCapacity) {
+        char** temp = realloc(pPool->argv, (pPool->size + 1) * sizeof(char*));
+        if(!temp)
+            return NULL;
+
+        pPool->argv = temp;
+        pPool->argvCapacity = pPool->size + 1;
+    }
+
+    for(size_t i = 0; i < pPool->size; i++)
+        pPool->argv[i] = pPool->data + pPool->offsets[i];
+    pPool->argv[pPool->size] = NULL;
+
+    return pPool->argv;
+}
+
+void stringPoolClear(StringPool* pPool)
+{
+    if(!pPool || !pPool->slots)
+        return;
+
+    memset(pPool->slots, 0, pPool->slotCapacity * sizeof(uint32_t));
+    pPool->size = 0;
+    pPool->used = 0;
+    pPool->dead = 0;
+}
+
+void stringPoolDestroy(StringPool* pPool)
+{
+    if(pPool) {
+        free(pPool->offsets);
+        free(pPool->lengths);
+        free(pPool->hashes);
+        free(pPool->data);
+        free(pPool->slots);
+        free(pPool->argv);
+        *pPool = (StringPool){0};
+    }
+}
+
+static uint32_t hashString(const char* string, size_t size)
+{
+    // FNV-1a
+    uint32_t hash = 2166136261u;
+    for(size_t i = 0; i < size; i++) {
+        hash ^= (unsigned char)string[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+static bool growPool(StringPool* pPool, size_t bytes)
+{
+    if(pPool->used + bytes <= pPool->dataCapacity)
+        return true;
+
+    size_t cap = pPool->dataCapacity ? pPool->dataCapacity : 256;
+    while(cap < pPool->used + bytes)
+        cap *= 2;
+
+    char* temp = realloc(pPool->data, cap);
+    if(!temp)
+        return false;
+
+    pPool->data = temp;
+    pPool->dataCapacity = cap;
+    return true;
+}
+
+static bool rehashPool(StringPool* pPool, size_t slotCapacity)
+{
+    uint32_t* slots = calloc(slotCapacity, sizeof(uint32_t));
+    if(!slots)
+        return false;
+
+    size_t mask = slotCapacity - 1;
+    for(size_t i = 0; i < pPool->size; i++) {
+        size_t slot = pPool->hashes[i] & mask;
+        while(slots[slot])
+            slot = (slot + 1) & mask;
+        slots[slot] = i + 1;
+    }
+
+    free(pPool->slots);
+    pPool->slots = slots;
+    pPool->slotCapacity = slotCapacity;
+    return true;
+}
+
+static size_t findSlotOf(const StringPool* pPool, size_t index)
+{
+    size_t mask = pPool->slotCapacity - 1;
+    size_t slot = pPool->hashes[index] & mask;
+    while(pPool->slots[slot] != index + 1)
+        slot = (slot + 1) & mask;
+
+    return slot;
+}
+
+static void removeSlot(StringPool* pPool, size_t slot)
+{
+    // Backward shift deletion keeps probe chains intact without tombstones
+    size_t mask = pPool->slotCapacity - 1;
+    size_t hole = slot;
+    for(size_t j = (slot + 1) & mask; pPool->slots[j]; j = (j + 1) & mask) {
+        size_t home = pPool->hashes[pPool->slots[j] - 1] & mask;
+        if(((j - home) & mask) >= ((j - hole) & mask)) {
+            pPool->slots[hole] = pPool->slots[j];
+            hole = j;
+        }
+    }
+
+    pPool->slots[hole] = 0;
+}
+
+static void compactPool(StringPool* pPool)
+{
+    // Rewrite the buffer once removed strings make up most of it
+    if(pPool->dead < 4096 || pPool->dead * 2 < pPool->used)
+        return;
+
+    char* data = malloc(pPool->used - pPool->dead);
+    if(!data)
+        return;
+
+    size_t used = 0;
+    for(size_t i = 0; i < pPool->size; i++) {
+        memcpy(data + used, pPool->data + pPool->offsets[i], pPool->lengths[i] + 1);
+        pPool->offsets[i] = used;
+        used += pPool->lengths[i] + 1;
+    }
+
+    free(pPool->data);
+    pPool->data = data;
+    pPool->used = used;
+    pPool->dataCapacity = used;
+    pPool->dead = 0;
+}
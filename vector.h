@@ -3,17 +3,47 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include "arena.h"
 
 typedef struct vector_t {
     size_t size;
     size_t capacity;
     char** arr;
+    Arena* arena;
 } Vector;
 
+typedef struct string_pool_t {
+    size_t size;
+    size_t capacity;
+    size_t* offsets;
+    uint32_t* lengths;
+    uint32_t* hashes;
+    char* data;
+    size_t used;
+    size_t dataCapacity;
+    size_t dead;
+    uint32_t* slots;
+    size_t slotCapacity;
+    char** argv;
+    size_t argvCapacity;
+} StringPool;
+
 
 Vector vectorInit(size_t capacity);
+Vector vectorInitArena(size_t capacity, Arena* pArena);
 bool vectorInsert(Vector* pVector, char* string, size_t size);
 bool vectorRemove(Vector* pVector, char* string, size_t size);
 void vectorDestroy(Vector* pVector);
 
+StringPool stringPoolInit(size_t capacity);
+bool stringPoolInsert(StringPool* pPool, const char* string, size_t size);
+const char* stringPoolGet(const StringPool* pPool, size_t index);
+size_t stringPoolLength(const StringPool* pPool, size_t index);
+bool stringPoolFind(const StringPool* pPool, const char* string, size_t size, size_t* pIndex);
+bool stringPoolSwapRemove(StringPool* pPool, size_t index);
+bool stringPoolStableRemove(StringPool* pPool, size_t index);
+char** stringPoolArgv(StringPool* pPool);
+void stringPoolClear(StringPool* pPool);
+void stringPoolDestroy(StringPool* pPool);
+
 #endif
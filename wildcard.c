@@ -0,0 +1,312 @@
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <linux/limits.h>
+#include "wildcard.h"
+
+static bool matchOne(const char* pattern, size_t length, size_t p, char c, size_t* pNext);
+static void expandFrom(DirCache* pCache, char* path, size_t pathLen, const char* pattern, StringPool* pMatches);
+static size_t unescape(const char* pattern, size_t length, char* out);
+static int compareStrings(const void* a, const void* b);
+static size_t literalHead(const char* pattern, size_t length);
+static size_t literalTail(const char* pattern, size_t length);
+
+/************************************************
+ * globHasMeta: Check for an unescaped *, ? or [
+ *
+ * pattern:     Pattern to check
+ *
+ * length:      Number of bytes in pattern
+ *
+ * return:      Whether the pattern needs matching
+ ***********************************************/
+bool globHasMeta(const char* pattern, size_t length)
+{
+    for(size_t i = 0; i < length; i++) {
+        if(pattern[i] == '\\')
+            i++;
+        else if(pattern[i] == '*' || pattern[i] == '?' || pattern[i] == '[')
+            return true;
+    }
+
+    return false;
+}
+
+/************************************************
+ * globMatch:   Match a name against one pattern
+ *              component. '*' backtracks to the
+ *              last star only, so a match is
+ *              linear in practice
+ *
+ * pattern:     Pattern using *, ?, [...] and
+ *              backslash escapes
+ *
+ * length:      Number of bytes in pattern
+ *
+ * name:        NUL terminated name
+ *
+ * return:      Whether the whole name matched
+ ***********************************************/
+bool globMatch(const char* pattern, size_t length, const char* name)
+{
+    size_t p = 0, n = 0;
+    size_t starP = SIZE_MAX, starN = 0;
+    while(name[n]) {
+        if(p < length && pattern[p] == '*') {
+            starP = ++p;
+            starN = n;
+            continue;
+        }
+
+        size_t next;
+        if(p < length && matchOne(pattern, length, p, name[n], &next)) {
+            p = next;
+            n++;
+            continue;
+        }
+
+        if(starP == SIZE_MAX)
+            return false;
+
+        p = starP;
+        n = ++starN;
+    }
+
+    while(p < length && pattern[p] == '*')
+        p++;
+
+    return p == length;
+}
+
+/************************************************
+ * globExpand:  Expand a pattern into the sorted
+ *              paths it matches. Every directory
+ *              is listed through the cache
+ *
+ * pCache:      Directory listing cache
+ *
+ * pattern:     NUL terminated pattern, quoted
+ *              characters escaped with '\'
+ *
+ * pMatches:    Cleared and filled with matches
+ *
+ * return:      Whether anything matched
+ ***********************************************/
+bool globExpand(DirCache* pCache, const char* pattern, StringPool* pMatches)
+{
+    if(!pCache || !pattern || !pMatches)
+        return false;
+
+    stringPoolClear(pMatches);
+
+    char path[PATH_MAX] = {0};
+    size_t pathLen = 0;
+    if(pattern[0] == '/') {
+        path[pathLen++] = '/';
+        while(*pattern == '/')
+            pattern++;
+    }
+
+    expandFrom(pCache, path, pathLen, pattern, pMatches);
+    if(pMatches->size == 0)
+        return false;
+
+    // Sort through the exported pointers, then rebuild in order
+    char** sorted = stringPoolArgv(pMatches);
+    if(!sorted)
+        return true;
+
+    qsort(sorted, pMatches->size, sizeof(char*), compareStrings);
+
+    StringPool ordered = stringPoolInit(pMatches->size);
+    for(size_t i = 0; sorted[i]; i++)
+        stringPoolInsert(&ordered, sorted[i], strlen(sorted[i]));
+
+    if(ordered.size == pMatches->size) {
+        stringPoolDestroy(pMatches);
+        *pMatches = ordered;
+    } else {
+        stringPoolDestroy(&ordered);
+    }
+
+    return true;
+}
+
+static bool matchOne(const char* pattern, size_t length, size_t p, char c, size_t* pNext)
+{
+    if(pattern[p] == '?') {
+        *pNext = p + 1;
+        return true;
+    }
+
+    if(pattern[p] == '[') {
+        size_t i = p + 1;
+        bool negate = i < length && (pattern[i] == '!' || pattern[i] == '^');
+        if(negate)
+            i++;
+
+        // A ']' straight after the opening bracket is a member
+        bool matched = false, first = true;
+        for(; i < length && (pattern[i] != ']' || first); i++) {
+            first = false;
+
+            unsigned char lo = pattern[i];
+            if(lo == '\\' && i + 1 < length)
+                lo = pattern[++i];
+
+            unsigned char hi = lo;
+            if(i + 2 < length && pattern[i + 1] == '-' && pattern[i + 2] != ']') {
+                i += 2;
+                hi = pattern[i];
+                if(hi == '\\' && i + 1 < length)
+                    hi = pattern[++i];
+            }
+
+            if((unsigned char)c >= lo && (unsigned char)c <= hi)
+                matched = true;
+        }
+
+        if(i < length) {
+            *pNext = i + 1;
+            return matched != negate;
+        }
+        // No closing bracket, so '[' is an ordinary character
+    }
+
+    if(pattern[p] == '\\' && p + 1 < length) {
+        *pNext = p + 2;
+        return pattern[p + 1] == c;
+    }
+
+    *pNext = p + 1;
+    return pattern[p] == c;
+}
+
+static void expandFrom(DirCache* pCache, char* path, size_t pathLen, const char* pattern, StringPool* pMatches)
+{
+    // Split off the next component
+    const char* slash = pattern;
+    while(*slash && *slash != '/') {
+        if(*slash == '\\' && slash[1])
+            slash++;
+        slash++;
+    }
+
+    size_t compLen = slash - pattern;
+    const char* rest = slash;
+    while(*rest == '/')
+        rest++;
+
+    if(compLen == 0) { // Trailing '/', the match must be a directory
+        struct stat st;
+        if(pathLen > 0 && stat(path, &st) == 0 && S_ISDIR(st.st_mode) &&
+           pathLen + 1 < PATH_MAX && path[pathLen - 1] != '/') {
+            path[pathLen] = '/';
+            stringPoolInsert(pMatches, path, pathLen + 1);
+            path[pathLen] = '\0';
+        }
+        return;
+    }
+
+    // Literal components are appended without listing the directory
+    if(!globHasMeta(pattern, compLen)) {
+        if(pathLen + compLen + 1 >= PATH_MAX)
+            return;
+
+        size_t len = pathLen + unescape(pattern, compLen, path + pathLen);
+        path[len] = '\0';
+
+        if(*slash == '\0') {
+            struct stat st;
+            if(lstat(path, &st) == 0)
+                stringPoolInsert(pMatches, path, len);
+        } else if(*rest == '\0') {
+            expandFrom(pCache, path, len, rest, pMatches);
+        } else {
+            path[len] = '/';
+            path[len + 1] = '\0';
+            expandFrom(pCache, path, len + 1, rest, pMatches);
+        }
+
+        path[pathLen] = '\0';
+        return;
+    }
+
+    DirListing* listing = dirCacheGet(pCache, path);
+    if(!listing)
+        return;
+
+    // Literal text around the wildcards rejects most names without matching
+    size_t headLen = literalHead(pattern, compLen);
+    size_t tailLen = literalTail(pattern, compLen);
+    const char* tail = pattern + compLen - tailLen;
+
+    bool showHidden = pattern[0] == '.';
+    for(size_t i = 0; i < listing->names.size; i++) {
+        const char* name = stringPoolGet(&listing->names, i);
+        size_t nameLen = stringPoolLength(&listing->names, i);
+        if(nameLen < headLen + tailLen || memcmp(name, pattern, headLen) != 0 ||
+           memcmp(name + nameLen - tailLen, tail, tailLen) != 0)
+            continue;
+        if(name[0] == '.' && (!showHidden || strcmp(name, ".") == 0 || strcmp(name, "..") == 0))
+            continue;
+        if(!globMatch(pattern, compLen, name))
+            continue;
+        if(pathLen + nameLen + 1 >= PATH_MAX)
+            continue;
+
+        memcpy(path + pathLen, name, nameLen + 1);
+        size_t len = pathLen + nameLen;
+
+        if(*slash == '\0') {
+            stringPoolInsert(pMatches, path, len);
+        } else if(dirListingIsDir(listing, i, path)) {
+            if(*rest == '\0') {
+                expandFrom(pCache, path, len, rest, pMatches);
+            } else {
+                path[len] = '/';
+                path[len + 1] = '\0';
+                expandFrom(pCache, path, len + 1, rest, pMatches);
+            }
+        }
+    }
+
+    path[pathLen] = '\0';
+    dirCacheRelease(listing);
+}
+
+static size_t unescape(const char* pattern, size_t length, char* out)
+{
+    size_t n = 0;
+    for(size_t i = 0; i < length; i++) {
+        if(pattern[i] == '\\' && i + 1 < length)
+            i++;
+        out[n++] = pattern[i];
+    }
+
+    return n;
+}
+
+static int compareStrings(const void* a, const void* b)
+{
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+static size_t literalHead(const char* pattern, size_t length)
+{
+    size_t i = 0;
+    while(i < length && !strchr("*?[\\", pattern[i]))
+        i++;
+
+    return i;
+}
+
+static size_t literalTail(const char* pattern, size_t length)
+{
+    // A backslash before the tail would escape its first character
+    size_t i = length;
+    while(i > 0 && !strchr("*?[]\\", pattern[i - 1]))
+        i--;
+
+    return length - i;
+}
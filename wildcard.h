@@ -0,0 +1,13 @@
+#ifndef WILDCARD_H
+#define WILDCARD_H
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include "dircache.h"
+#include "vector.h"
+
+bool globHasMeta(const char* pattern, size_t length);
+bool globMatch(const char* pattern, size_t length, const char* name);
+bool globExpand(DirCache* pCache, const char* pattern, StringPool* pMatches);
+
+#endif